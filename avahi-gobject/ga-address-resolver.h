@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* Avahi drop-in compatibility wrapper - redirects to resolve-avahi-compat */
+
+#ifndef __AVAHI_GOBJECT_GA_ADDRESS_RESOLVER_H_COMPAT__
+#define __AVAHI_GOBJECT_GA_ADDRESS_RESOLVER_H_COMPAT__
+
+#include "../ga-address-resolver.h"
+
+#endif /* __AVAHI_GOBJECT_GA_ADDRESS_RESOLVER_H_COMPAT__ */
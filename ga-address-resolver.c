@@ -0,0 +1,503 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-address-resolver.c - Source for GaAddressResolver (systemd-resolved compatibility) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <gio/gio.h>
+#include <systemd/sd-varlink.h>
+
+#include "ga-address-resolver.h"
+#include "ga-client-private.h"
+#include "ga-error.h"
+
+/* How long reverse lookups are served from the client's cache */
+#define ADDRESS_CACHE_TTL_MS 60000
+
+/* signal enum */
+enum {
+    FOUND,
+    FAILURE,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* properties */
+enum {
+    PROP_PROTOCOL = 1,
+    PROP_IFINDEX,
+    PROP_ADDRESS,
+    PROP_FLAGS,
+    PROP_TIMEOUT_MS,
+    PROP_CANCELLABLE,
+    PROP_PRIORITY
+};
+
+struct _GaAddressResolverPrivate {
+    GaClient *client;
+    GaIfIndex interface;
+    GaProtocol protocol;
+    GaAddress address;
+    GaLookupFlags flags;
+    guint timeout_ms;
+    GaRequestPriority priority;
+    GCancellable *cancellable;
+    GSource *cancel_source;
+    GSource *cached_source;     /* Reports a cached result */
+    GVariant *cached;           /* (ua(is)): result flags, (ifindex, name) */
+    GaVarlinkCall *call;        /* ResolveAddress in flight */
+    gchar *cache_key;
+    gboolean dispose_has_run;
+};
+
+#define GA_ADDRESS_RESOLVER_GET_PRIVATE(o) \
+    ((GaAddressResolverPrivate *)ga_address_resolver_get_instance_private(o))
+
+G_DEFINE_TYPE_WITH_PRIVATE(GaAddressResolver, ga_address_resolver, G_TYPE_OBJECT)
+
+static void ga_address_resolver_init(GaAddressResolver *obj) {
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(obj);
+
+    priv->client = NULL;
+    priv->interface = GA_IF_UNSPEC;
+    priv->protocol = GA_PROTOCOL_UNSPEC;
+    memset(&priv->address, 0, sizeof(priv->address));
+    priv->address.proto = GA_PROTOCOL_UNSPEC;
+    priv->call = NULL;
+}
+
+static void ga_address_resolver_dispose(GObject *object);
+static void ga_address_resolver_finalize(GObject *object);
+static void resolve_stop(GaAddressResolver *resolver);
+
+static void ga_address_resolver_set_property(GObject *object,
+                                             guint property_id,
+                                             const GValue *value,
+                                             GParamSpec *pspec) {
+    GaAddressResolver *resolver = GA_ADDRESS_RESOLVER(object);
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+    const GaAddress *address;
+
+    switch (property_id) {
+        case PROP_PROTOCOL:
+            priv->protocol = g_value_get_enum(value);
+            break;
+        case PROP_IFINDEX:
+            priv->interface = g_value_get_int(value);
+            break;
+        case PROP_ADDRESS:
+            address = g_value_get_pointer(value);
+            if (address)
+                priv->address = *address;
+            break;
+        case PROP_FLAGS:
+            priv->flags = g_value_get_flags(value);
+            break;
+        case PROP_TIMEOUT_MS:
+            priv->timeout_ms = g_value_get_uint(value);
+            break;
+        case PROP_CANCELLABLE:
+            if (priv->cancellable)
+                g_object_unref(priv->cancellable);
+            priv->cancellable = g_value_dup_object(value);
+            break;
+        case PROP_PRIORITY:
+            priv->priority = g_value_get_enum(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void ga_address_resolver_get_property(GObject *object,
+                                             guint property_id,
+                                             GValue *value,
+                                             GParamSpec *pspec) {
+    GaAddressResolver *resolver = GA_ADDRESS_RESOLVER(object);
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+
+    switch (property_id) {
+        case PROP_PROTOCOL:
+            g_value_set_enum(value, priv->protocol);
+            break;
+        case PROP_IFINDEX:
+            g_value_set_int(value, priv->interface);
+            break;
+        case PROP_ADDRESS:
+            g_value_set_pointer(value, &priv->address);
+            break;
+        case PROP_FLAGS:
+            g_value_set_flags(value, priv->flags);
+            break;
+        case PROP_TIMEOUT_MS:
+            g_value_set_uint(value, priv->timeout_ms);
+            break;
+        case PROP_CANCELLABLE:
+            g_value_set_object(value, priv->cancellable);
+            break;
+        case PROP_PRIORITY:
+            g_value_set_enum(value, priv->priority);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void ga_address_resolver_class_init(GaAddressResolverClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GParamSpec *param_spec;
+
+    object_class->dispose = ga_address_resolver_dispose;
+    object_class->finalize = ga_address_resolver_finalize;
+    object_class->set_property = ga_address_resolver_set_property;
+    object_class->get_property = ga_address_resolver_get_property;
+
+    /* Emitted once for every name of the address */
+    signals[FOUND] =
+        g_signal_new("found",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,  /* Use default marshaller */
+                     G_TYPE_NONE, 5,
+                     G_TYPE_INT,            /* interface */
+                     GA_TYPE_PROTOCOL,      /* protocol */
+                     G_TYPE_POINTER,        /* address (GaAddress*) */
+                     G_TYPE_STRING,         /* name */
+                     GA_TYPE_LOOKUP_RESULT_FLAGS);
+
+    signals[FAILURE] =
+        g_signal_new("failure",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__POINTER,
+                     G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    param_spec = g_param_spec_enum("protocol", "Protocol",
+                                   "Protocol to resolve on",
+                                   GA_TYPE_PROTOCOL,
+                                   GA_PROTOCOL_UNSPEC,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PROTOCOL, param_spec);
+
+    param_spec = g_param_spec_int("interface", "Interface index",
+                                  "Interface to use for resolver",
+                                  G_MININT, G_MAXINT,
+                                  GA_IF_UNSPEC,
+                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_IFINDEX, param_spec);
+
+    param_spec = g_param_spec_pointer("address", "Address",
+                                      "Address to resolve (GaAddress*)",
+                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_ADDRESS, param_spec);
+
+    param_spec = g_param_spec_flags("flags", "Lookup flags",
+                                    "Resolver lookup flags",
+                                    GA_TYPE_LOOKUP_FLAGS,
+                                    GA_LOOKUP_NO_FLAGS,
+                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
+
+    param_spec = g_param_spec_uint("timeout-ms", "Timeout",
+                                   "Deadline of the lookup in milliseconds, 0 for the default",
+                                   0, G_MAXUINT,
+                                   0,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_TIMEOUT_MS, param_spec);
+
+    /* Cancelling stops the resolver without emitting any further signal */
+    param_spec = g_param_spec_object("cancellable", "Cancellable",
+                                     "Cancellable to abort the lookup with",
+                                     G_TYPE_CANCELLABLE,
+                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_CANCELLABLE, param_spec);
+
+    param_spec = g_param_spec_enum("priority", "Priority",
+                                   "Scheduling class of the resolver's requests",
+                                   GA_TYPE_REQUEST_PRIORITY,
+                                   GA_REQUEST_PRIORITY_INTERACTIVE,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PRIORITY, param_spec);
+}
+
+void ga_address_resolver_dispose(GObject *object) {
+    GaAddressResolver *self = GA_ADDRESS_RESOLVER(object);
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(self);
+
+    if (priv->dispose_has_run)
+        return;
+
+    priv->dispose_has_run = TRUE;
+
+    resolve_stop(self);
+
+    if (priv->cancellable) {
+        g_object_unref(priv->cancellable);
+        priv->cancellable = NULL;
+    }
+
+    if (priv->client) {
+        g_object_unref(priv->client);
+        priv->client = NULL;
+    }
+
+    if (G_OBJECT_CLASS(ga_address_resolver_parent_class)->dispose)
+        G_OBJECT_CLASS(ga_address_resolver_parent_class)->dispose(object);
+}
+
+void ga_address_resolver_finalize(GObject *object) {
+    GaAddressResolver *self = GA_ADDRESS_RESOLVER(object);
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(self);
+
+    g_free(priv->cache_key);
+
+    G_OBJECT_CLASS(ga_address_resolver_parent_class)->finalize(object);
+}
+
+/* Stop the lookup; no signal is emitted afterwards */
+static void resolve_stop(GaAddressResolver *resolver) {
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+
+    if (priv->call) {
+        ga_varlink_call_cancel(priv->call);
+        priv->call = NULL;
+    }
+
+    if (priv->cancel_source) {
+        g_source_destroy(priv->cancel_source);
+        g_source_unref(priv->cancel_source);
+        priv->cancel_source = NULL;
+    }
+
+    if (priv->cached_source) {
+        g_source_destroy(priv->cached_source);
+        g_source_unref(priv->cached_source);
+        priv->cached_source = NULL;
+    }
+
+    if (priv->cached) {
+        g_variant_unref(priv->cached);
+        priv->cached = NULL;
+    }
+}
+
+static gboolean resolve_cancelled_cb(G_GNUC_UNUSED GCancellable *cancellable,
+                                     gpointer user_data) {
+    GaAddressResolver *resolver = GA_ADDRESS_RESOLVER(user_data);
+
+    g_debug("GaAddressResolver: Lookup cancelled");
+    resolve_stop(resolver);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Emit found for every (ifindex, name) in @names */
+static void emit_names(GaAddressResolver *resolver,
+                       GVariant *names,
+                       GaLookupResultFlags result_flags) {
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+    GVariantIter iter;
+    gint32 ifindex;
+    const gchar *name;
+
+    /* Handlers may drop the last reference */
+    g_object_ref(resolver);
+
+    g_variant_iter_init(&iter, names);
+    while (!priv->dispose_has_run &&
+           g_variant_iter_next(&iter, "(i&s)", &ifindex, &name)) {
+        g_signal_emit(resolver, signals[FOUND], 0,
+                      ifindex,
+                      priv->protocol,
+                      &priv->address,
+                      name,
+                      result_flags);
+    }
+
+    g_object_unref(resolver);
+}
+
+static gboolean cached_result_cb(gpointer user_data) {
+    GaAddressResolver *resolver = GA_ADDRESS_RESOLVER(user_data);
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+    GVariant *cached = priv->cached;
+    GVariant *names;
+    guint32 result_flags;
+
+    priv->cached = NULL;
+    g_source_unref(priv->cached_source);
+    priv->cached_source = NULL;
+    resolve_stop(resolver);
+
+    g_variant_get(cached, "(u@a(is))", &result_flags, &names);
+    emit_names(resolver, names, (GaLookupResultFlags)result_flags | GA_LOOKUP_RESULT_CACHED);
+    g_variant_unref(names);
+    g_variant_unref(cached);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void resolve_reply_cb(sd_json_variant *reply,
+                             const GError *error,
+                             gpointer user_data) {
+    GaAddressResolver *resolver = GA_ADDRESS_RESOLVER(user_data);
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+    GVariantBuilder builder;
+
+    priv->call = NULL;
+    resolve_stop(resolver);
+
+    if (error) {
+        g_signal_emit(resolver, signals[FAILURE], 0, error);
+        return;
+    }
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(is)"));
+
+    sd_json_variant *names_v = sd_json_variant_by_key(reply, "names");
+    if (names_v && sd_json_variant_is_array(names_v)) {
+        size_t n = sd_json_variant_elements(names_v);
+        for (size_t i = 0; i < n; i++) {
+            sd_json_variant *entry = sd_json_variant_by_index(names_v, i);
+            sd_json_variant *name_v = entry ? sd_json_variant_by_key(entry, "name") : NULL;
+            sd_json_variant *ifindex_v = entry ? sd_json_variant_by_key(entry, "ifindex") : NULL;
+            gint32 ifindex = priv->interface;
+
+            if (!name_v || !sd_json_variant_is_string(name_v))
+                continue;
+            if (ifindex_v && sd_json_variant_is_integer(ifindex_v))
+                ifindex = (gint32)sd_json_variant_integer(ifindex_v);
+
+            g_variant_builder_add(&builder, "(is)", ifindex, sd_json_variant_string(name_v));
+        }
+    }
+
+    GVariant *names = g_variant_ref_sink(g_variant_builder_end(&builder));
+    sd_json_variant *flags_v = sd_json_variant_by_key(reply, "flags");
+    GaLookupResultFlags result_flags =
+        ga_varlink_result_flags(flags_v && sd_json_variant_is_unsigned(flags_v)
+                                ? sd_json_variant_unsigned(flags_v) : 0);
+
+    /* Cached with the flags of the reply, unicast answers stay unicast */
+    ga_client_cache_insert(priv->client, priv->cache_key,
+                           g_variant_new("(u@a(is))", (guint32)result_flags, names),
+                           ADDRESS_CACHE_TTL_MS);
+
+    emit_names(resolver, names, result_flags);
+    g_variant_unref(names);
+}
+
+GaAddressResolver *ga_address_resolver_new(GaIfIndex interface,
+                                           GaProtocol protocol,
+                                           const GaAddress *address,
+                                           GaLookupFlags flags) {
+    return g_object_new(GA_TYPE_ADDRESS_RESOLVER,
+                        "interface", interface,
+                        "protocol", protocol,
+                        "address", address,
+                        "flags", flags,
+                        NULL);
+}
+
+gboolean ga_address_resolver_attach(GaAddressResolver *resolver,
+                                    GaClient *client,
+                                    GError **error) {
+    GaAddressResolverPrivate *priv = GA_ADDRESS_RESOLVER_GET_PRIVATE(resolver);
+    gchar address_str[INET6_ADDRSTRLEN];
+    sd_json_variant *params = NULL;
+    size_t len;
+    int family;
+    int r;
+
+    g_return_val_if_fail(IS_GA_ADDRESS_RESOLVER(resolver), FALSE);
+    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+
+    g_object_ref(client);
+    priv->client = client;
+
+    if (priv->address.proto == GA_PROTOCOL_INET) {
+        family = AF_INET;
+        len = 4;
+    } else if (priv->address.proto == GA_PROTOCOL_INET6) {
+        family = AF_INET6;
+        len = 16;
+    } else {
+        if (error)
+            *error = g_error_new(GA_ERROR, GA_ERROR_INVALID_ADDRESS,
+                                 "No valid address to resolve");
+        return FALSE;
+    }
+
+    if (!ga_client_has_feature(client, GA_CLIENT_FEATURE_RESOLVE_ADDRESS)) {
+        if (error)
+            *error = g_error_new(GA_ERROR, GA_ERROR_NOT_SUPPORTED,
+                                 "systemd-resolved does not support ResolveAddress");
+        return FALSE;
+    }
+
+    if (priv->cancellable && g_cancellable_is_cancelled(priv->cancellable)) {
+        if (error)
+            *error = g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "Lookup was cancelled");
+        return FALSE;
+    }
+
+    /* Cancellation and cached results are dispatched from the attaching
+     * thread's context, like the replies */
+    if (priv->cancellable) {
+        priv->cancel_source = g_cancellable_source_new(priv->cancellable);
+        g_source_set_callback(priv->cancel_source,
+                              (GSourceFunc)(void (*)(void))resolve_cancelled_cb,
+                              resolver, NULL);
+        g_source_attach(priv->cancel_source, g_main_context_get_thread_default());
+    }
+
+    if (!ga_address_snprint(address_str, sizeof(address_str), &priv->address))
+        address_str[0] = '\0';
+    g_free(priv->cache_key);
+    priv->cache_key = g_strdup_printf("reverse:%d:%s", priv->interface, address_str);
+
+    priv->cached = ga_client_cache_lookup(client, priv->cache_key);
+    if (priv->cached) {
+        g_debug("GaAddressResolver: Using cached names of %s", address_str);
+        priv->cached_source = g_idle_source_new();
+        g_source_set_callback(priv->cached_source, cached_result_cb, resolver, NULL);
+        g_source_attach(priv->cached_source, g_main_context_get_thread_default());
+        return TRUE;
+    }
+
+    /* GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
+     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics). */
+    r = sd_json_buildo(&params,
+                       SD_JSON_BUILD_PAIR_INTEGER("ifindex", priv->interface),
+                       SD_JSON_BUILD_PAIR_INTEGER("family", family),
+                       SD_JSON_BUILD_PAIR_BYTE_ARRAY("address", priv->address.data.data, len),
+                       SD_JSON_BUILD_PAIR_UNSIGNED("flags",
+                                                   ga_varlink_lookup_flags(priv->flags & GA_LOOKUP_CACHE_ONLY)));
+    if (r < 0) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to build params: %s",
+                                 g_strerror(-r));
+        }
+        resolve_stop(resolver);
+        return FALSE;
+    }
+
+    priv->call = ga_client_call_full(client, resolver, priv->priority,
+                                     "io.systemd.Resolve.ResolveAddress", params,
+                                     priv->timeout_ms, resolve_reply_cb, resolver, NULL);
+    sd_json_variant_unref(params);
+
+    return TRUE;
+}
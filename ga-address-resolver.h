@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-address-resolver.h - Header for GaAddressResolver (systemd-resolved compatibility) */
+
+#ifndef __GA_ADDRESS_RESOLVER_H__
+#define __GA_ADDRESS_RESOLVER_H__
+
+#include <glib-object.h>
+#include "ga-client.h"
+#include "ga-enums.h"
+#include "ga-service-resolver.h"  /* For GaAddress */
+
+G_BEGIN_DECLS
+
+typedef struct _GaAddressResolver GaAddressResolver;
+typedef struct _GaAddressResolverClass GaAddressResolverClass;
+typedef struct _GaAddressResolverPrivate GaAddressResolverPrivate;
+
+struct _GaAddressResolverClass {
+    GObjectClass parent_class;
+};
+
+struct _GaAddressResolver {
+    GObject parent;
+    GaAddressResolverPrivate *priv;
+};
+
+GType ga_address_resolver_get_type(void);
+
+/* TYPE MACROS */
+#define GA_TYPE_ADDRESS_RESOLVER \
+  (ga_address_resolver_get_type())
+#define GA_ADDRESS_RESOLVER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GA_TYPE_ADDRESS_RESOLVER, GaAddressResolver))
+#define GA_ADDRESS_RESOLVER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GA_TYPE_ADDRESS_RESOLVER, GaAddressResolverClass))
+#define IS_GA_ADDRESS_RESOLVER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GA_TYPE_ADDRESS_RESOLVER))
+#define IS_GA_ADDRESS_RESOLVER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GA_TYPE_ADDRESS_RESOLVER))
+#define GA_ADDRESS_RESOLVER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GA_TYPE_ADDRESS_RESOLVER, GaAddressResolverClass))
+
+GaAddressResolver *ga_address_resolver_new(GaIfIndex interface,
+                                            GaProtocol protocol,
+                                            const GaAddress * address,
+                                            GaLookupFlags flags);
+
+gboolean
+ga_address_resolver_attach(GaAddressResolver * resolver,
+                           GaClient * client, GError ** error);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_ADDRESS_RESOLVER_H__ */
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * ga-client-private.h - GaClient internals shared with the other objects
+ * (not installed)
+ */
+
+#ifndef __GA_CLIENT_PRIVATE_H__
+#define __GA_CLIENT_PRIVATE_H__
+
+#include "ga-client.h"
+#include "ga-varlink.h"
+#include "ga-timer-wheel.h"
+
+G_BEGIN_DECLS
+
+/* Timeout for the watchdog's liveness ping */
+#define GA_CLIENT_PING_TIMEOUT_MS 5000
+
+/*
+ * Optional systemd-resolved features. Method availability is read from the
+ * io.systemd.Resolve interface description when the client starts; the
+ * rest can only be learned from how resolved reacts to a call.
+ */
+typedef enum {
+    GA_CLIENT_FEATURE_BROWSE_SERVICES = 1 << 0,
+    GA_CLIENT_FEATURE_RESOLVE_SERVICE = 1 << 1,
+    GA_CLIENT_FEATURE_RESOLVE_RECORD = 1 << 2,
+    GA_CLIENT_FEATURE_RESOLVE_HOSTNAME = 1 << 3,
+    GA_CLIENT_FEATURE_RESOLVE_ADDRESS = 1 << 4,
+    /* BrowseServices accepts ifindex 0/-1 for all links (systemd#40133) */
+    GA_CLIENT_FEATURE_BROWSE_ALL_INTERFACES = 1 << 5
+} GaClientFeature;
+
+/* Features not probed yet are assumed to be supported */
+gboolean ga_client_has_feature(GaClient *client, GaClientFeature feature);
+
+void ga_client_set_feature(GaClient *client, GaClientFeature feature, gboolean supported);
+
+/*
+ * Issue a one-shot varlink call to systemd-resolved over the client's
+ * connection pool. See ga_varlink_pool_call() for the reply semantics.
+ */
+GaVarlinkCall *ga_client_call(GaClient *client,
+                              const char *method,
+                              sd_json_variant *params,
+                              guint timeout_ms,
+                              GaVarlinkReplyFunc func,
+                              gpointer user_data);
+
+/*
+ * Like ga_client_call(), scheduled as @owner's (the calling object's)
+ * request in @priority's class. See ga_varlink_pool_call_full().
+ */
+GaVarlinkCall *ga_client_call_full(GaClient *client,
+                                   gconstpointer owner,
+                                   GaRequestPriority priority,
+                                   const char *method,
+                                   sd_json_variant *params,
+                                   guint timeout_ms,
+                                   GaVarlinkReplyFunc func,
+                                   gpointer user_data,
+                                   GDestroyNotify destroy);
+
+/*
+ * Called after every watchdog ping. @daemon_alive is FALSE when the ping
+ * failed, i.e. resolved is gone or not answering.
+ */
+typedef void (*GaClientWatchdogFunc)(GaClient *client,
+                                     gboolean daemon_alive,
+                                     gpointer user_data);
+
+guint ga_client_add_watchdog_watch(GaClient *client,
+                                   GaClientWatchdogFunc func,
+                                   gpointer user_data);
+
+void ga_client_remove_watchdog_watch(GaClient *client, guint id);
+
+/* Idle time after which a subscription is refreshed, in microseconds */
+gint64 ga_client_get_stall_timeout(GaClient *client);
+
+/* Counters updated by the objects attached to the client */
+GaClientStatistics *ga_client_peek_statistics(GaClient *client);
+
+/* Tick of the client's timer wheel */
+#define GA_CLIENT_TIMER_TICK_MS 1000
+
+/*
+ * Coarse (one second) timers shared by the objects attached to the
+ * client, for deadlines that are numerous and need not be exact.
+ */
+GaTimerWheel *ga_client_get_timer_wheel(GaClient *client);
+
+/* Upper bound of cached lookup results per client */
+#define GA_CLIENT_CACHE_MAX_ENTRIES 512
+
+/*
+ * Lookup results shared by the objects attached to the client, keyed by a
+ * string of the caller's choosing. Lookup returns a new reference, or NULL
+ * if @key is unknown or expired; insert sinks a floating @value.
+ */
+GVariant *ga_client_cache_lookup(GaClient *client, const gchar *key);
+
+void ga_client_cache_insert(GaClient *client,
+                            const gchar *key,
+                            GVariant *value,
+                            guint ttl_ms);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_CLIENT_PRIVATE_H__ */
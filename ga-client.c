@@ -4,13 +4,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <systemd/sd-varlink.h>
 
 #include "ga-client.h"
+#include "ga-client-private.h"
 #include "ga-error.h"
 #include "ga-enums.h"
 
-#define RESOLVED_VARLINK_ADDRESS "/run/systemd/resolve/io.systemd.Resolve"
+/* Defaults for the subscription watchdog, in milliseconds */
+#define GA_CLIENT_DEFAULT_WATCHDOG_INTERVAL 30000
+#define GA_CLIENT_DEFAULT_STALL_TIMEOUT     300000
 
 /* signal enum */
 enum {
@@ -23,13 +27,36 @@ static guint signals[LAST_SIGNAL] = { 0 };
 /* properties */
 enum {
     PROP_STATE = 1,
-    PROP_FLAGS
+    PROP_FLAGS,
+    PROP_WATCHDOG_INTERVAL,
+    PROP_STALL_TIMEOUT,
+    PROP_MAX_IN_FLIGHT
 };
 
+typedef struct {
+    guint id;
+    GaClientWatchdogFunc func;
+    gpointer user_data;
+} WatchdogWatch;
+
 struct _GaClientPrivate {
     GaClientFlags flags;
     GaClientState state;
     GMainContext *context;
+    GaVarlinkPool *pool;
+    GaTimerWheel *timers;
+    guint watchdog_interval;        /* ms, 0 disables the watchdog */
+    guint stall_timeout;            /* ms */
+    guint max_in_flight;            /* Calls to resolved at once */
+    GSource *watchdog_source;
+    GaVarlinkCall *ping_call;
+    GaVarlinkCall *introspect_call;
+    GaClientFeature features;       /* Supported, valid where probed */
+    GaClientFeature features_probed;
+    GArray *watches;                /* WatchdogWatch */
+    guint next_watch_id;
+    GaClientStatistics stats;
+    GHashTable *cache;              /* gchar * -> CacheEntry */
     gboolean dispose_has_run;
 };
 
@@ -74,14 +101,41 @@ GType ga_client_flags_get_type(void) {
 
 #define GA_TYPE_CLIENT_FLAGS (ga_client_flags_get_type())
 
+typedef struct {
+    GVariant *value;
+    gint64 expires;     /* Monotonic time, µs */
+} CacheEntry;
+
+static void cache_entry_free(gpointer data) {
+    CacheEntry *entry = data;
+
+    g_variant_unref(entry->value);
+    g_free(entry);
+}
+
 static void ga_client_init(GaClient *self) {
     GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(self);
     priv->state = GA_CLIENT_STATE_NOT_STARTED;
     priv->flags = GA_CLIENT_FLAG_NO_FLAGS;
     priv->context = NULL;
+    priv->pool = NULL;
+    priv->watchdog_interval = GA_CLIENT_DEFAULT_WATCHDOG_INTERVAL;
+    priv->stall_timeout = GA_CLIENT_DEFAULT_STALL_TIMEOUT;
+    priv->max_in_flight = GA_VARLINK_POOL_DEFAULT_SIZE;
+    priv->watchdog_source = NULL;
+    priv->ping_call = NULL;
+    priv->introspect_call = NULL;
+    priv->features = 0;
+    priv->features_probed = 0;
+    priv->watches = g_array_new(FALSE, FALSE, sizeof(WatchdogWatch));
+    priv->next_watch_id = 1;
+    priv->cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, cache_entry_free);
     priv->dispose_has_run = FALSE;
 }
 
+static void watchdog_start(GaClient *client);
+static void introspect_start(GaClient *client);
+
 static void ga_client_dispose(GObject *object);
 static void ga_client_finalize(GObject *object);
 
@@ -96,6 +150,19 @@ static void ga_client_set_property(GObject *object,
         case PROP_FLAGS:
             priv->flags = g_value_get_flags(value);
             break;
+        case PROP_WATCHDOG_INTERVAL:
+            priv->watchdog_interval = g_value_get_uint(value);
+            if (priv->state == GA_CLIENT_STATE_S_RUNNING)
+                watchdog_start(client);
+            break;
+        case PROP_STALL_TIMEOUT:
+            priv->stall_timeout = g_value_get_uint(value);
+            break;
+        case PROP_MAX_IN_FLIGHT:
+            priv->max_in_flight = g_value_get_uint(value);
+            if (priv->pool)
+                ga_varlink_pool_set_max_connections(priv->pool, priv->max_in_flight);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -116,6 +183,15 @@ static void ga_client_get_property(GObject *object,
         case PROP_FLAGS:
             g_value_set_flags(value, priv->flags);
             break;
+        case PROP_WATCHDOG_INTERVAL:
+            g_value_set_uint(value, priv->watchdog_interval);
+            break;
+        case PROP_STALL_TIMEOUT:
+            g_value_set_uint(value, priv->stall_timeout);
+            break;
+        case PROP_MAX_IN_FLIGHT:
+            g_value_set_uint(value, priv->max_in_flight);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -174,6 +250,36 @@ static void ga_client_class_init(GaClientClass *ga_client_class) {
                                     G_PARAM_STATIC_BLURB);
     g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
 
+    param_spec = g_param_spec_uint("watchdog-interval", "Watchdog interval",
+                                   "Milliseconds between liveness pings to "
+                                   "systemd-resolved, 0 to disable",
+                                   0, G_MAXUINT,
+                                   GA_CLIENT_DEFAULT_WATCHDOG_INTERVAL,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_NAME |
+                                   G_PARAM_STATIC_BLURB);
+    g_object_class_install_property(object_class, PROP_WATCHDOG_INTERVAL, param_spec);
+
+    param_spec = g_param_spec_uint("stall-timeout", "Stall timeout",
+                                   "Milliseconds without notifications after "
+                                   "which a browse subscription is refreshed",
+                                   1000, G_MAXUINT,
+                                   GA_CLIENT_DEFAULT_STALL_TIMEOUT,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_NAME |
+                                   G_PARAM_STATIC_BLURB);
+    g_object_class_install_property(object_class, PROP_STALL_TIMEOUT, param_spec);
+
+    param_spec = g_param_spec_uint("max-in-flight", "Maximum requests in flight",
+                                   "Requests sent to systemd-resolved at once; "
+                                   "further ones wait in the client's queue",
+                                   1, 256,
+                                   GA_VARLINK_POOL_DEFAULT_SIZE,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_NAME |
+                                   G_PARAM_STATIC_BLURB);
+    g_object_class_install_property(object_class, PROP_MAX_IN_FLIGHT, param_spec);
+
     signals[STATE_CHANGED] =
         g_signal_new("state-changed",
                      G_OBJECT_CLASS_TYPE(ga_client_class),
@@ -193,6 +299,32 @@ void ga_client_dispose(GObject *object) {
 
     priv->dispose_has_run = TRUE;
 
+    if (priv->watchdog_source) {
+        g_source_destroy(priv->watchdog_source);
+        g_source_unref(priv->watchdog_source);
+        priv->watchdog_source = NULL;
+    }
+
+    if (priv->ping_call) {
+        ga_varlink_call_cancel(priv->ping_call);
+        priv->ping_call = NULL;
+    }
+
+    if (priv->introspect_call) {
+        ga_varlink_call_cancel(priv->introspect_call);
+        priv->introspect_call = NULL;
+    }
+
+    if (priv->pool) {
+        ga_varlink_pool_free(priv->pool);
+        priv->pool = NULL;
+    }
+
+    if (priv->timers) {
+        ga_timer_wheel_free(priv->timers);
+        priv->timers = NULL;
+    }
+
     if (priv->context) {
         g_main_context_unref(priv->context);
         priv->context = NULL;
@@ -203,6 +335,12 @@ void ga_client_dispose(GObject *object) {
 }
 
 void ga_client_finalize(GObject *object) {
+    GaClient *self = GA_CLIENT(object);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(self);
+
+    g_array_free(priv->watches, TRUE);
+    g_hash_table_destroy(priv->cache);
+
     G_OBJECT_CLASS(ga_client_parent_class)->finalize(object);
 }
 
@@ -250,9 +388,281 @@ gboolean ga_client_start_in_context(GaClient *client, GMainContext *context, GEr
     g_signal_emit(client, signals[STATE_CHANGED],
                   detail_for_state(priv->state), priv->state);
 
+    watchdog_start(client);
+    introspect_start(client);
+
     return TRUE;
 }
 
+GaVarlinkCall *ga_client_call(GaClient *client,
+                              const char *method,
+                              sd_json_variant *params,
+                              guint timeout_ms,
+                              GaVarlinkReplyFunc func,
+                              gpointer user_data) {
+    return ga_client_call_full(client, client, GA_REQUEST_PRIORITY_INTERACTIVE,
+                               method, params, timeout_ms, func, user_data, NULL);
+}
+
+GaVarlinkCall *ga_client_call_full(GaClient *client,
+                                   gconstpointer owner,
+                                   GaRequestPriority priority,
+                                   const char *method,
+                                   sd_json_variant *params,
+                                   guint timeout_ms,
+                                   GaVarlinkReplyFunc func,
+                                   gpointer user_data,
+                                   GDestroyNotify destroy) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), NULL);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    if (!priv->pool)
+        priv->pool = ga_varlink_pool_new(priv->context, priv->max_in_flight);
+
+    return ga_varlink_pool_call_full(priv->pool, owner, priority,
+                                     method, params, timeout_ms, func, user_data, destroy);
+}
+
+/*
+ * Capability negotiation.
+ *
+ * The interface description tells which methods the running resolved
+ * implements; features that do not change the IDL, such as BrowseServices
+ * accepting ifindex 0, are recorded by the callers once they find out.
+ */
+
+static void introspect_cb(sd_json_variant *reply,
+                          const GError *error,
+                          gpointer user_data) {
+    GaClient *client = GA_CLIENT(user_data);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+    static const struct {
+        GaClientFeature feature;
+        const char *declaration;
+    } methods[] = {
+        { GA_CLIENT_FEATURE_BROWSE_SERVICES, "method BrowseServices(" },
+        { GA_CLIENT_FEATURE_RESOLVE_SERVICE, "method ResolveService(" },
+        { GA_CLIENT_FEATURE_RESOLVE_RECORD, "method ResolveRecord(" },
+        { GA_CLIENT_FEATURE_RESOLVE_HOSTNAME, "method ResolveHostname(" },
+        { GA_CLIENT_FEATURE_RESOLVE_ADDRESS, "method ResolveAddress(" },
+    };
+
+    priv->introspect_call = NULL;
+
+    if (error) {
+        g_debug("GaClient: interface introspection failed: %s", error->message);
+        return;
+    }
+
+    sd_json_variant *v = sd_json_variant_by_key(reply, "description");
+    if (!v || !sd_json_variant_is_string(v))
+        return;
+
+    const char *description = sd_json_variant_string(v);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(methods); i++)
+        ga_client_set_feature(client, methods[i].feature,
+                              strstr(description, methods[i].declaration) != NULL);
+
+    g_debug("GaClient: resolved features 0x%x", priv->features);
+}
+
+static void introspect_start(GaClient *client) {
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+    sd_json_variant *params = NULL;
+
+    if (priv->introspect_call || priv->features_probed)
+        return;
+
+    if (sd_json_buildo(&params,
+                       SD_JSON_BUILD_PAIR_STRING("interface", "io.systemd.Resolve")) < 0)
+        return;
+
+    priv->introspect_call = ga_client_call(client,
+                                           "org.varlink.service.GetInterfaceDescription",
+                                           params, 0, introspect_cb, client);
+    sd_json_variant_unref(params);
+}
+
+gboolean ga_client_has_feature(GaClient *client, GaClientFeature feature) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    if (!(priv->features_probed & feature))
+        return TRUE;
+
+    return (priv->features & feature) != 0;
+}
+
+void ga_client_set_feature(GaClient *client, GaClientFeature feature, gboolean supported) {
+    g_return_if_fail(IS_GA_CLIENT(client));
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    priv->features_probed |= feature;
+    if (supported)
+        priv->features |= feature;
+    else
+        priv->features &= ~feature;
+}
+
+/*
+ * Subscription watchdog.
+ *
+ * A browse subscription that stops delivering notifications looks exactly
+ * like a quiet network, so the client periodically pings resolved over the
+ * connection pool and lets the attached browsers check their subscriptions
+ * against the result.
+ */
+
+static void watchdog_notify(GaClient *client, gboolean daemon_alive) {
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+    guint n_ids = priv->watches->len;
+    guint *ids;
+
+    /* Watches may be added or removed from within the callbacks */
+    ids = g_new(guint, MAX(n_ids, 1));
+    for (guint i = 0; i < n_ids; i++)
+        ids[i] = g_array_index(priv->watches, WatchdogWatch, i).id;
+
+    g_object_ref(client);
+
+    for (guint i = 0; i < n_ids; i++) {
+        for (guint j = 0; j < priv->watches->len; j++) {
+            WatchdogWatch *watch = &g_array_index(priv->watches, WatchdogWatch, j);
+            if (watch->id == ids[i]) {
+                watch->func(client, daemon_alive, watch->user_data);
+                break;
+            }
+        }
+    }
+
+    g_object_unref(client);
+    g_free(ids);
+}
+
+static void watchdog_ping_cb(G_GNUC_UNUSED sd_json_variant *reply,
+                             const GError *error,
+                             gpointer user_data) {
+    GaClient *client = GA_CLIENT(user_data);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    priv->ping_call = NULL;
+
+    if (error) {
+        g_debug("GaClient: watchdog ping failed: %s", error->message);
+        priv->stats.watchdog_ping_failures++;
+    }
+
+    watchdog_notify(client, error == NULL);
+}
+
+static gboolean watchdog_timeout_cb(gpointer user_data) {
+    GaClient *client = GA_CLIENT(user_data);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    /* Previous ping still outstanding: its own timeout will report it */
+    if (priv->ping_call)
+        return G_SOURCE_CONTINUE;
+
+    priv->stats.watchdog_pings++;
+    priv->ping_call = ga_client_call(client, "org.varlink.service.GetInfo", NULL,
+                                     GA_CLIENT_PING_TIMEOUT_MS,
+                                     watchdog_ping_cb, client);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void watchdog_start(GaClient *client) {
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    if (priv->watchdog_source) {
+        g_source_destroy(priv->watchdog_source);
+        g_source_unref(priv->watchdog_source);
+        priv->watchdog_source = NULL;
+    }
+
+    if (priv->watchdog_interval == 0)
+        return;
+
+    priv->watchdog_source = g_timeout_source_new(priv->watchdog_interval);
+    g_source_set_callback(priv->watchdog_source, watchdog_timeout_cb, client, NULL);
+    g_source_attach(priv->watchdog_source, priv->context);
+}
+
+guint ga_client_add_watchdog_watch(GaClient *client,
+                                   GaClientWatchdogFunc func,
+                                   gpointer user_data) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), 0);
+    g_return_val_if_fail(func != NULL, 0);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    WatchdogWatch watch = {
+        .id = priv->next_watch_id++,
+        .func = func,
+        .user_data = user_data,
+    };
+    g_array_append_val(priv->watches, watch);
+
+    return watch.id;
+}
+
+void ga_client_remove_watchdog_watch(GaClient *client, guint id) {
+    g_return_if_fail(IS_GA_CLIENT(client));
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    for (guint i = 0; i < priv->watches->len; i++) {
+        if (g_array_index(priv->watches, WatchdogWatch, i).id == id) {
+            g_array_remove_index(priv->watches, i);
+            return;
+        }
+    }
+}
+
+gint64 ga_client_get_stall_timeout(GaClient *client) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), 0);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    return (gint64)priv->stall_timeout * G_TIME_SPAN_MILLISECOND;
+}
+
+GaTimerWheel *ga_client_get_timer_wheel(GaClient *client) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), NULL);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    if (!priv->timers)
+        priv->timers = ga_timer_wheel_new(priv->context, GA_CLIENT_TIMER_TICK_MS);
+
+    return priv->timers;
+}
+
+GaClientStatistics *ga_client_peek_statistics(GaClient *client) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), NULL);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    return &priv->stats;
+}
+
+void ga_client_get_statistics(GaClient *client, GaClientStatistics *stats) {
+    g_return_if_fail(IS_GA_CLIENT(client));
+    g_return_if_fail(stats != NULL);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+
+    *stats = priv->stats;
+
+    if (priv->pool) {
+        GaVarlinkPoolStats pool_stats;
+
+        ga_varlink_pool_get_stats(priv->pool, &pool_stats);
+        stats->requests_in_flight = pool_stats.in_flight;
+        stats->requests_queued = pool_stats.queued;
+        stats->requests_queued_max = pool_stats.queued_max;
+        stats->requests_started = pool_stats.started;
+        stats->request_wait_last = pool_stats.wait_last;
+        stats->request_wait_max = pool_stats.wait_max;
+        stats->request_wait_total = pool_stats.wait_total;
+    }
+}
+
 GaClientState ga_client_get_state(GaClient *client) {
     g_return_val_if_fail(IS_GA_CLIENT(client), GA_CLIENT_STATE_FAILURE);
     GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
@@ -338,3 +748,59 @@ GaClientState avahi_client_get_state(GaClient *client) {
 int avahi_client_errno(GaClient *client) {
     return ga_client_get_errno(client);
 }
+
+/*
+ * Result cache.
+ *
+ * Entries expire after their TTL; when the cache is full the expired ones
+ * are dropped first, then arbitrary ones.
+ */
+
+GVariant *ga_client_cache_lookup(GaClient *client, const gchar *key) {
+    g_return_val_if_fail(IS_GA_CLIENT(client), NULL);
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+    CacheEntry *entry = g_hash_table_lookup(priv->cache, key);
+
+    if (!entry)
+        return NULL;
+
+    if (entry->expires <= g_get_monotonic_time()) {
+        g_hash_table_remove(priv->cache, key);
+        return NULL;
+    }
+
+    return g_variant_ref(entry->value);
+}
+
+static gboolean cache_entry_expired(G_GNUC_UNUSED gpointer key,
+                                    gpointer value,
+                                    gpointer user_data) {
+    const CacheEntry *entry = value;
+
+    return entry->expires <= *(const gint64 *)user_data;
+}
+
+void ga_client_cache_insert(GaClient *client,
+                            const gchar *key,
+                            GVariant *value,
+                            guint ttl_ms) {
+    g_return_if_fail(IS_GA_CLIENT(client));
+    GaClientPrivate *priv = GA_CLIENT_GET_PRIVATE(client);
+    gint64 now = g_get_monotonic_time();
+
+    if (g_hash_table_size(priv->cache) >= GA_CLIENT_CACHE_MAX_ENTRIES &&
+        !g_hash_table_contains(priv->cache, key)) {
+        g_hash_table_foreach_remove(priv->cache, cache_entry_expired, &now);
+
+        GHashTableIter iter;
+        g_hash_table_iter_init(&iter, priv->cache);
+        while (g_hash_table_size(priv->cache) >= GA_CLIENT_CACHE_MAX_ENTRIES &&
+               g_hash_table_iter_next(&iter, NULL, NULL))
+            g_hash_table_iter_remove(&iter);
+    }
+
+    CacheEntry *entry = g_new0(CacheEntry, 1);
+    entry->value = g_variant_ref_sink(value);
+    entry->expires = now + (gint64)ttl_ms * 1000;
+    g_hash_table_replace(priv->cache, g_strdup(key), entry);
+}
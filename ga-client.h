@@ -79,6 +79,43 @@ typedef struct _GaClient GaClient;
 typedef struct _GaClientClass GaClientClass;
 typedef struct _GaClientPrivate GaClientPrivate;
 
+/*
+ * Health counters of a client and the browsers attached to it.
+ * Latencies are in microseconds.
+ */
+typedef struct {
+    guint64 watchdog_pings;
+    guint64 watchdog_ping_failures;
+    guint64 subscription_refreshes;   /* Idle subscriptions re-established */
+    guint64 subscription_stalls;      /* Subscriptions found to have stalled */
+    guint64 resubscribe_count;
+    guint64 resubscribe_latency_last;
+    guint64 resubscribe_latency_max;
+    guint64 resubscribe_latency_total;
+    /* Admission control of requests to systemd-resolved (max-in-flight) */
+    guint64 requests_in_flight;
+    guint64 requests_queued;          /* Waiting for a slot right now */
+    guint64 requests_queued_max;
+    guint64 requests_started;
+    guint64 request_wait_last;        /* Time spent queued */
+    guint64 request_wait_max;
+    guint64 request_wait_total;
+    /* DNS-SD reloads for the entry groups, and the requests for one that
+     * were folded into another group's reload */
+    guint64 dnssd_reloads;
+    guint64 dnssd_reloads_saved;
+    /* TXT updates of published services written out, and held back by
+     * their minimum publish interval */
+    guint64 txt_publishes;
+    guint64 txt_publishes_suppressed;
+    /* Commits found visible through resolved, and the time from commit
+     * to visible */
+    guint64 publish_verifications;
+    guint64 publish_latency_last;
+    guint64 publish_latency_max;
+    guint64 publish_latency_total;
+} GaClientStatistics;
+
 struct _GaClientClass {
     GObjectClass parent_class;
 };
@@ -122,6 +159,9 @@ const gchar *ga_client_get_domain_name(GaClient *client);
 /* Get the last error code from the client */
 gint ga_client_get_errno(GaClient *client);
 
+/* Copy the client's health counters into @stats */
+void ga_client_get_statistics(GaClient *client, GaClientStatistics *stats);
+
 G_END_DECLS
 
 #endif /* #ifndef __GA_CLIENT_H__ */
@@ -8,7 +8,10 @@
  * systemd-resolved is signaled to reload its configuration.
  */
 
+#define _GNU_SOURCE     /* syncfs() */
+
 #include <stdarg.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,9 +21,26 @@
 #include <gio/gio.h>
 
 #include "ga-entry-group.h"
+#include "ga-client-private.h"
+#include "ga-service-resolver-private.h"
 #include "ga-error.h"
 
+/* Overridden at build time by the benchmarks, which must not publish */
+#ifndef DNSSD_RUNTIME_DIR
 #define DNSSD_RUNTIME_DIR "/run/systemd/dnssd"
+#endif
+
+/* Deadline of a ReloadDNSSD call */
+#define DNSSD_RELOAD_TIMEOUT_MS 5000
+
+/* Reload requests made within this window share one ReloadDNSSD */
+#define DNSSD_RELOAD_DEBOUNCE_MS 50
+
+/* Deadline of the lookup that checks a committed service is visible */
+#define PUBLISH_VERIFY_TIMEOUT_MS 5000
+
+/* Worker threads of a bulk commit */
+#define BULK_MAX_THREADS 8
 
 /* signal enum */
 enum {
@@ -32,7 +52,8 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 /* properties */
 enum {
-    PROP_STATE = 1
+    PROP_STATE = 1,
+    PROP_BULK
 };
 
 struct _GaEntryGroupPrivate {
@@ -40,6 +61,10 @@ struct _GaEntryGroupPrivate {
     GaClient *client;
     GHashTable *services;
     GPtrArray *created_files;  /* Track .dnssd files we created */
+    guint commit_generation;   /* Bumped by every commit and reset */
+    GPtrArray *commits;        /* CommitData in flight, not owned */
+    struct _CommitData *verifying; /* Commit whose services are being looked up */
+    gboolean bulk;
     gboolean dispose_has_run;
 };
 
@@ -48,7 +73,14 @@ typedef struct {
     GaEntryGroup *group;
     gboolean frozen;
     GHashTable *txt_entries;
+    GHashTable *txt_pending;    /* Changes made while frozen, TXT_REMOVED for removals */
     gchar *dnssd_filename;  /* Filename in DNSSD_RUNTIME_DIR */
+    gchar *content_hash;    /* Of the file as last written, NULL if not on disk */
+    guint min_publish_interval;     /* ms between TXT publications, 0 for no limit */
+    gint64 last_publish;            /* Monotonic time of the last one */
+    GSource *publish_timer;         /* Trailing publication of held back changes */
+    guint64 publishes;
+    guint64 publishes_suppressed;
 } GaEntryGroupServicePrivate;
 
 #define GA_ENTRY_GROUP_GET_PRIVATE(o) \
@@ -58,8 +90,29 @@ G_DEFINE_TYPE_WITH_PRIVATE(GaEntryGroup, ga_entry_group, G_TYPE_OBJECT)
 
 /* Forward declarations for helper functions */
 static gchar *generate_dnssd_content(GaEntryGroupServicePrivate *service);
-static void signal_resolved_reload(void);
+static gboolean write_service_file(GaEntryGroupPrivate *priv,
+                                   GaEntryGroupServicePrivate *service,
+                                   gboolean *written,
+                                   GError **error);
+static void signal_resolved_reload(GaClient *client);
 static void cleanup_dnssd_files(GaEntryGroupPrivate *priv);
+static void commit_abort_all(GaEntryGroupPrivate *priv);
+
+/* The system bus, shared by all groups once connected */
+static GDBusConnection *system_bus = NULL;
+
+/*
+ * Reload scheduler, shared by all groups. A request waits
+ * DNSSD_RELOAD_DEBOUNCE_MS for others to join it, then one reload
+ * covers the whole batch. Requests made while a reload is in flight
+ * form the next batch, which goes out as soon as that one is done:
+ * files written after a reload started are not necessarily seen by it.
+ */
+static struct {
+    GPtrArray *waiting;     /* GTask, for the next reload */
+    GSource *timer;
+    gboolean in_flight;
+} reload_scheduler;
 
 GType ga_entry_group_state_get_type(void) {
     static GType type = 0;
@@ -87,7 +140,14 @@ static void free_service(gpointer data) {
     g_free(s->host);
     if (p->txt_entries)
         g_hash_table_destroy(p->txt_entries);
+    if (p->txt_pending)
+        g_hash_table_destroy(p->txt_pending);
     g_free(p->dnssd_filename);
+    g_free(p->content_hash);
+    if (p->publish_timer) {
+        g_source_destroy(p->publish_timer);
+        g_source_unref(p->publish_timer);
+    }
     g_free(s);
 }
 
@@ -99,11 +159,29 @@ static void ga_entry_group_init(GaEntryGroup *obj) {
     priv->services = g_hash_table_new_full(g_direct_hash, g_direct_equal,
                                            NULL, free_service);
     priv->created_files = g_ptr_array_new_with_free_func(g_free);
+    priv->commits = g_ptr_array_new();
 }
 
 static void ga_entry_group_dispose(GObject *object);
 static void ga_entry_group_finalize(GObject *object);
 
+static void ga_entry_group_set_property(GObject *object,
+                                        guint property_id,
+                                        const GValue *value,
+                                        GParamSpec *pspec) {
+    GaEntryGroup *group = GA_ENTRY_GROUP(object);
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+
+    switch (property_id) {
+        case PROP_BULK:
+            priv->bulk = g_value_get_boolean(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
 static void ga_entry_group_get_property(GObject *object,
                                         guint property_id,
                                         GValue *value,
@@ -115,6 +193,9 @@ static void ga_entry_group_get_property(GObject *object,
         case PROP_STATE:
             g_value_set_enum(value, priv->state);
             break;
+        case PROP_BULK:
+            g_value_set_boolean(value, priv->bulk);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -151,6 +232,7 @@ static void ga_entry_group_class_init(GaEntryGroupClass *klass) {
 
     object_class->dispose = ga_entry_group_dispose;
     object_class->finalize = ga_entry_group_finalize;
+    object_class->set_property = ga_entry_group_set_property;
     object_class->get_property = ga_entry_group_get_property;
 
     param_spec = g_param_spec_enum("state", "Entry Group state",
@@ -160,6 +242,15 @@ static void ga_entry_group_class_init(GaEntryGroupClass *klass) {
                                    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
     g_object_class_install_property(object_class, PROP_STATE, param_spec);
 
+    /* For groups of thousands of services: files are generated and written
+     * in parallel and synced once, and a single service is looked up to
+     * verify the commit */
+    param_spec = g_param_spec_boolean("bulk", "Bulk",
+                                      "Commit the services in bulk",
+                                      FALSE,
+                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_BULK, param_spec);
+
     signals[STATE_CHANGED] =
         g_signal_new("state-changed",
                      G_OBJECT_CLASS_TYPE(klass),
@@ -172,9 +263,17 @@ static void ga_entry_group_class_init(GaEntryGroupClass *klass) {
 
 /* Delete all .dnssd files we created and signal reload */
 static void cleanup_dnssd_files(GaEntryGroupPrivate *priv) {
+    GHashTableIter iter;
+    gpointer value;
+
     if (!priv->created_files || priv->created_files->len == 0)
         return;
 
+    /* Nothing is on disk any more */
+    g_hash_table_iter_init(&iter, priv->services);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        g_clear_pointer(&((GaEntryGroupServicePrivate *)value)->content_hash, g_free);
+
     for (guint i = 0; i < priv->created_files->len; i++) {
         const gchar *filepath = g_ptr_array_index(priv->created_files, i);
         if (unlink(filepath) != 0 && errno != ENOENT) {
@@ -183,22 +282,9 @@ static void cleanup_dnssd_files(GaEntryGroupPrivate *priv) {
     }
     g_ptr_array_set_size(priv->created_files, 0);
 
-    /* Signal systemd-resolved to reload via D-Bus */
-    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
-    if (bus) {
-        g_dbus_connection_call_sync(bus,
-                                     "org.freedesktop.resolve1",
-                                     "/org/freedesktop/resolve1",
-                                     "org.freedesktop.resolve1.Manager",
-                                     "ReloadDNSSD",
-                                     NULL,
-                                     NULL,
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     NULL);
-        g_object_unref(bus);
-    }
+    /* Signal systemd-resolved to reload via D-Bus; this does not wait for
+     * the reply, so disposing a group never blocks */
+    signal_resolved_reload(priv->client);
 }
 
 void ga_entry_group_dispose(GObject *object) {
@@ -210,6 +296,9 @@ void ga_entry_group_dispose(GObject *object) {
 
     priv->dispose_has_run = TRUE;
 
+    /* Nothing in flight holds the group: settle what still waits on it */
+    commit_abort_all(priv);
+
     /* Clean up any published services */
     cleanup_dnssd_files(priv);
 
@@ -236,6 +325,8 @@ void ga_entry_group_finalize(GObject *object) {
         priv->created_files = NULL;
     }
 
+    g_ptr_array_free(priv->commits, TRUE);
+
     G_OBJECT_CLASS(ga_entry_group_parent_class)->finalize(object);
 }
 
@@ -389,8 +480,40 @@ gboolean ga_entry_group_add_record_full(G_GNUC_UNUSED GaEntryGroup *group,
     return FALSE;
 }
 
+/*
+ * While a service is frozen its TXT changes are only recorded in
+ * txt_pending, the last one per key winning; thaw applies them all at
+ * once.
+ */
+
+/* Value of a key removed while frozen */
+static gchar txt_removed[] = "";
+#define TXT_REMOVED txt_removed
+
+static void txt_pending_value_free(gpointer value) {
+    if (value != TXT_REMOVED)
+        g_free(value);
+}
+
+/* Record a TXT change; takes @value, TXT_REMOVED to remove @key */
+static void service_txt_change(GaEntryGroupServicePrivate *priv,
+                               const gchar *key,
+                               gchar *value) {
+    if (priv->frozen) {
+        g_hash_table_insert(priv->txt_pending, g_strdup(key), value);
+    } else if (value == TXT_REMOVED) {
+        g_hash_table_remove(priv->txt_entries, key);
+    } else {
+        g_hash_table_insert(priv->txt_entries, g_strdup(key), value);
+    }
+}
+
 void ga_entry_group_service_freeze(GaEntryGroupService *service) {
     GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
+
+    if (!priv->txt_pending)
+        priv->txt_pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, txt_pending_value_free);
     priv->frozen = TRUE;
 }
 
@@ -400,8 +523,7 @@ gboolean ga_entry_group_service_set(GaEntryGroupService *service,
                                     G_GNUC_UNUSED GError **error) {
     GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
 
-    g_hash_table_insert(priv->txt_entries, g_strdup(key),
-                        value ? g_strdup(value) : NULL);
+    service_txt_change(priv, key, value ? g_strdup(value) : NULL);
 
     return TRUE;
 }
@@ -413,8 +535,7 @@ gboolean ga_entry_group_service_set_arbitrary(GaEntryGroupService *service,
                                               G_GNUC_UNUSED GError **error) {
     GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
 
-    gchar *value_copy = g_strndup((const gchar *)value, size);
-    g_hash_table_insert(priv->txt_entries, g_strdup(key), value_copy);
+    service_txt_change(priv, key, g_strndup((const gchar *)value, size));
 
     return TRUE;
 }
@@ -424,45 +545,119 @@ gboolean ga_entry_group_service_remove_key(GaEntryGroupService *service,
                                            G_GNUC_UNUSED GError **error) {
     GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
 
-    g_hash_table_remove(priv->txt_entries, key);
+    service_txt_change(priv, key, TXT_REMOVED);
 
     return TRUE;
 }
 
+static void service_count_publish(GaEntryGroupServicePrivate *priv, gboolean published) {
+    GaEntryGroupPrivate *group_priv = GA_ENTRY_GROUP_GET_PRIVATE(priv->group);
+    GaClientStatistics *stats = group_priv->client ? ga_client_peek_statistics(group_priv->client) : NULL;
+
+    if (published) {
+        priv->publishes++;
+        if (stats)
+            stats->txt_publishes++;
+    } else {
+        priv->publishes_suppressed++;
+        if (stats)
+            stats->txt_publishes_suppressed++;
+    }
+}
+
+/* Write the file if its content changed, and have resolved reload it */
+static gboolean service_publish(GaEntryGroupServicePrivate *priv, GError **error) {
+    GaEntryGroupPrivate *group_priv = GA_ENTRY_GROUP_GET_PRIVATE(priv->group);
+    gboolean written;
+
+    if (!write_service_file(group_priv, priv, &written, error))
+        return FALSE;
+
+    /* Signal reload, unless the TXT set came out the same */
+    if (written) {
+        priv->last_publish = g_get_monotonic_time();
+        service_count_publish(priv, TRUE);
+        signal_resolved_reload(group_priv->client);
+    }
+
+    return TRUE;
+}
+
+static gboolean service_publish_timer_cb(gpointer user_data) {
+    GaEntryGroupServicePrivate *priv = user_data;
+    GaEntryGroupPrivate *group_priv = GA_ENTRY_GROUP_GET_PRIVATE(priv->group);
+
+    g_source_unref(priv->publish_timer);
+    priv->publish_timer = NULL;
+
+    /* Failures were logged by the write */
+    if (!group_priv->dispose_has_run &&
+        group_priv->state == GA_ENTRY_GROUP_STATE_ESTABLISHED && priv->dnssd_filename)
+        service_publish(priv, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
 gboolean ga_entry_group_service_thaw(GaEntryGroupService *service,
                                      GError **error) {
     GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
     GaEntryGroupPrivate *group_priv = GA_ENTRY_GROUP_GET_PRIVATE(priv->group);
 
-    priv->frozen = FALSE;
+    /* Apply what was held back */
+    if (priv->frozen) {
+        GHashTableIter iter;
+        gpointer key, value;
 
-    /* If the group is already established, update the .dnssd file */
-    if (group_priv->state == GA_ENTRY_GROUP_STATE_ESTABLISHED && priv->dnssd_filename) {
-        gchar *filepath = g_build_filename(DNSSD_RUNTIME_DIR, priv->dnssd_filename, NULL);
-        gchar *content = generate_dnssd_content(priv);
+        priv->frozen = FALSE;
+        g_hash_table_iter_init(&iter, priv->txt_pending);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_hash_table_iter_steal(&iter);
+            service_txt_change(priv, key, value);
+            g_free(key);
+        }
+    }
 
-        GError *write_error = NULL;
-        if (!g_file_set_contents(filepath, content, -1, &write_error)) {
-            g_warning("Failed to update %s: %s", filepath, write_error->message);
-            if (error) {
-                *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
-                                     "Failed to update .dnssd file: %s",
-                                     write_error->message);
+    /* If the group is already established, update the .dnssd file: at
+     * most one write and one (coalesced) reload per thaw */
+    if (group_priv->state != GA_ENTRY_GROUP_STATE_ESTABLISHED || !priv->dnssd_filename)
+        return TRUE;
+
+    /* Within min_publish_interval of the last publication the update is
+     * held back; the latest TXT set goes out when the interval is over */
+    if (priv->min_publish_interval > 0) {
+        gint64 now = g_get_monotonic_time();
+        gint64 due = priv->last_publish + (gint64)priv->min_publish_interval * 1000;
+
+        if (priv->publish_timer || (priv->last_publish && now < due)) {
+            service_count_publish(priv, FALSE);
+            if (!priv->publish_timer) {
+                priv->publish_timer = g_timeout_source_new((guint)((due - now + 999) / 1000));
+                g_source_set_callback(priv->publish_timer, service_publish_timer_cb, priv, NULL);
+                g_source_attach(priv->publish_timer, g_main_context_get_thread_default());
             }
-            g_error_free(write_error);
-            g_free(filepath);
-            g_free(content);
-            return FALSE;
+            return TRUE;
         }
+    }
 
-        g_free(filepath);
-        g_free(content);
+    return service_publish(priv, error);
+}
 
-        /* Signal reload */
-        signal_resolved_reload();
-    }
+void ga_entry_group_service_set_min_publish_interval(GaEntryGroupService *service,
+                                                     guint interval_ms) {
+    GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
 
-    return TRUE;
+    priv->min_publish_interval = interval_ms;
+}
+
+void ga_entry_group_service_get_publish_stats(GaEntryGroupService *service,
+                                              guint64 *published,
+                                              guint64 *suppressed) {
+    GaEntryGroupServicePrivate *priv = (GaEntryGroupServicePrivate *)service;
+
+    if (published)
+        *published = priv->publishes;
+    if (suppressed)
+        *suppressed = priv->publishes_suppressed;
 }
 
 /* Generate a sanitized filename for a .dnssd file */
@@ -493,6 +688,10 @@ static gchar *generate_dnssd_filename(const gchar *name, const gchar *type) {
     return g_string_free(filename, FALSE);
 }
 
+static int compare_txt_keys(const void *a, const void *b) {
+    return strcmp(*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
 /* Generate .dnssd file content for a service */
 static gchar *generate_dnssd_content(GaEntryGroupServicePrivate *service) {
     GString *content = g_string_new("[Service]\n");
@@ -506,22 +705,25 @@ static gchar *generate_dnssd_content(GaEntryGroupServicePrivate *service) {
     /* Port= */
     g_string_append_printf(content, "Port=%u\n", service->public.port);
 
-    /* TxtText= for each TXT record */
+    /* TxtText= for each TXT record, sorted so that the same set always
+     * gives the same file */
     if (service->txt_entries && g_hash_table_size(service->txt_entries) > 0) {
-        GHashTableIter iter;
-        gpointer key, value;
+        guint n;
+        gpointer *keys = g_hash_table_get_keys_as_array(service->txt_entries, &n);
+
+        qsort(keys, n, sizeof(gpointer), compare_txt_keys);
+        for (guint i = 0; i < n; i++) {
+            const gchar *value = g_hash_table_lookup(service->txt_entries, keys[i]);
 
-        g_hash_table_iter_init(&iter, service->txt_entries);
-        while (g_hash_table_iter_next(&iter, &key, &value)) {
             if (value) {
                 g_string_append_printf(content, "TxtText=%s=%s\n",
-                                       (const gchar *)key,
-                                       (const gchar *)value);
+                                       (const gchar *)keys[i], value);
             } else {
                 g_string_append_printf(content, "TxtText=%s\n",
-                                       (const gchar *)key);
+                                       (const gchar *)keys[i]);
             }
         }
+        g_free(keys);
     }
 
     return g_string_free(content, FALSE);
@@ -540,115 +742,878 @@ static gboolean ensure_dnssd_dir(GError **error) {
     return TRUE;
 }
 
-/* Signal systemd-resolved to reload DNS-SD configuration */
-static void signal_resolved_reload(void) {
-    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
-    if (bus) {
-        GError *err = NULL;
-        g_dbus_connection_call_sync(bus,
-                                     "org.freedesktop.resolve1",
-                                     "/org/freedesktop/resolve1",
-                                     "org.freedesktop.resolve1.Manager",
-                                     "ReloadDNSSD",
-                                     NULL,
-                                     NULL,
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     &err);
-        if (err) {
-            g_debug("ReloadDNSSD call failed (may not be supported): %s", err->message);
-            g_error_free(err);
+/*
+ * Write the file of @service, unless it already holds the same content.
+ * *@written tells whether it was (re)written.
+ */
+static gboolean write_service_file(GaEntryGroupPrivate *priv,
+                                   GaEntryGroupServicePrivate *service,
+                                   gboolean *written,
+                                   GError **error) {
+    gchar *content = generate_dnssd_content(service);
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, content, -1);
+    gchar *filepath;
+    GError *write_error = NULL;
+
+    *written = FALSE;
+
+    if (service->content_hash && strcmp(hash, service->content_hash) == 0) {
+        g_free(hash);
+        g_free(content);
+        return TRUE;
+    }
+
+    if (!service->dnssd_filename)
+        service->dnssd_filename = generate_dnssd_filename(service->public.name,
+                                                          service->public.type);
+    filepath = g_build_filename(DNSSD_RUNTIME_DIR, service->dnssd_filename, NULL);
+
+    if (!g_file_set_contents(filepath, content, -1, &write_error)) {
+        g_warning("Failed to write %s: %s", filepath, write_error->message);
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to write .dnssd file: %s",
+                                 write_error->message);
         }
-        g_object_unref(bus);
+        g_error_free(write_error);
+        g_free(filepath);
+        g_free(hash);
+        g_free(content);
+        return FALSE;
     }
+
+    g_debug("Wrote DNS-SD service file: %s", filepath);
+
+    /* Track the file for cleanup */
+    if (!g_ptr_array_find_with_equal_func(priv->created_files, filepath, g_str_equal, NULL))
+        g_ptr_array_add(priv->created_files, filepath);
+    else
+        g_free(filepath);
+
+    g_free(service->content_hash);
+    service->content_hash = hash;
+    *written = TRUE;
+
+    g_free(content);
+    return TRUE;
 }
 
-gboolean ga_entry_group_commit(GaEntryGroup *group, GError **error) {
-    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+/*
+ * Bulk commits.
+ *
+ * Worker threads generate the contents and write the changed ones to
+ * temporary files, without syncing each. One syncfs() makes them all
+ * durable, they are renamed into place, and one fsync() of the
+ * directory makes the renames durable.
+ */
+
+typedef struct {
+    GaEntryGroupServicePrivate *service;
+    gchar *filepath;
+    gchar *tmppath;
+    gchar *hash;        /* Of the new content, NULL if unchanged */
+    int error_code;     /* errno of a failed write */
+} BulkJob;
+
+static void bulk_job_free(BulkJob *job) {
+    g_free(job->filepath);
+    g_free(job->tmppath);
+    g_free(job->hash);
+    g_free(job);
+}
+
+/* Runs in a worker thread; services are only read */
+static void bulk_job_run(gpointer job_data, G_GNUC_UNUSED gpointer user_data) {
+    BulkJob *job = job_data;
+    gchar *content = generate_dnssd_content(job->service);
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, content, -1);
+    gsize len = strlen(content);
+    gsize done = 0;
+    int fd;
+
+    if (job->service->content_hash && strcmp(hash, job->service->content_hash) == 0) {
+        g_free(hash);
+        g_free(content);
+        return;
+    }
+
+    fd = open(job->tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        job->error_code = errno;
+        g_free(hash);
+        g_free(content);
+        return;
+    }
+
+    while (done < len) {
+        ssize_t n = write(fd, content + done, len - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            job->error_code = errno;
+            break;
+        }
+        done += (gsize)n;
+    }
+
+    if (close(fd) != 0 && !job->error_code)
+        job->error_code = errno;
+
+    if (job->error_code) {
+        unlink(job->tmppath);
+        g_free(hash);
+    } else {
+        job->hash = hash;
+    }
+    g_free(content);
+}
+
+static gboolean write_service_files_bulk(GaEntryGroupPrivate *priv,
+                                         gboolean *changed,
+                                         GError **error) {
+    GPtrArray *jobs = g_ptr_array_new_with_free_func((GDestroyNotify)bulk_job_free);
+    GThreadPool *pool;
     GHashTableIter iter;
-    gpointer key, value;
-    gboolean success = TRUE;
+    gpointer value;
+    guint written = 0;
+    int dirfd;
 
-    /* Transition to registering state */
-    priv->state = GA_ENTRY_GROUP_STATE_REGISTERING;
-    g_signal_emit(group, signals[STATE_CHANGED],
-                  detail_for_state(priv->state), priv->state);
+    pool = g_thread_pool_new(bulk_job_run, NULL,
+                             (gint)MIN(g_get_num_processors(), BULK_MAX_THREADS),
+                             FALSE, NULL);
 
-    /* Ensure the directory exists */
-    if (!ensure_dnssd_dir(error)) {
-        priv->state = GA_ENTRY_GROUP_STATE_FAILURE;
-        g_signal_emit(group, signals[STATE_CHANGED],
-                      detail_for_state(priv->state), priv->state);
+    g_hash_table_iter_init(&iter, priv->services);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        GaEntryGroupServicePrivate *service = value;
+        BulkJob *job = g_new0(BulkJob, 1);
+
+        if (!service->dnssd_filename)
+            service->dnssd_filename = generate_dnssd_filename(service->public.name,
+                                                              service->public.type);
+        job->service = service;
+        job->filepath = g_build_filename(DNSSD_RUNTIME_DIR, service->dnssd_filename, NULL);
+        job->tmppath = g_strconcat(job->filepath, ".tmp", NULL);
+        g_ptr_array_add(jobs, job);
+        g_thread_pool_push(pool, job, NULL);
+    }
+
+    /* Wait for every job */
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (guint i = 0; i < jobs->len; i++) {
+        BulkJob *job = g_ptr_array_index(jobs, i);
+
+        if (!job->error_code)
+            continue;
+
+        g_warning("Failed to write %s: %s", job->tmppath, g_strerror(job->error_code));
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to write .dnssd file: %s",
+                                 g_strerror(job->error_code));
+        }
+        for (guint j = 0; j < jobs->len; j++) {
+            job = g_ptr_array_index(jobs, j);
+            if (job->hash)
+                unlink(job->tmppath);
+        }
+        g_ptr_array_unref(jobs);
         return FALSE;
     }
 
-    /* Write .dnssd files for each service */
-    g_hash_table_iter_init(&iter, priv->services);
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-        GaEntryGroupServicePrivate *service = (GaEntryGroupServicePrivate *)value;
+    /* One barrier for all the contents */
+    dirfd = open(DNSSD_RUNTIME_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd >= 0 && syncfs(dirfd) != 0)
+        g_warning("Failed to sync %s: %s", DNSSD_RUNTIME_DIR, g_strerror(errno));
+
+    for (guint i = 0; i < jobs->len; i++) {
+        BulkJob *job = g_ptr_array_index(jobs, i);
+
+        if (!job->hash)
+            continue;
 
-        /* Generate filename and content */
-        gchar *filename = generate_dnssd_filename(service->public.name, service->public.type);
-        gchar *filepath = g_build_filename(DNSSD_RUNTIME_DIR, filename, NULL);
-        gchar *content = generate_dnssd_content(service);
+        if (rename(job->tmppath, job->filepath) != 0) {
+            int rename_errno = errno;
 
-        /* Write the file */
-        GError *write_error = NULL;
-        if (!g_file_set_contents(filepath, content, -1, &write_error)) {
-            g_warning("Failed to write %s: %s", filepath, write_error->message);
-            if (error && !*error) {
+            /* Like a failed write: the commit fails and removes what it
+             * already put in place */
+            g_warning("Failed to rename %s: %s", job->tmppath, g_strerror(rename_errno));
+            if (error) {
                 *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
                                      "Failed to write .dnssd file: %s",
-                                     write_error->message);
+                                     g_strerror(rename_errno));
             }
-            g_error_free(write_error);
-            success = FALSE;
-        } else {
-            /* Track the file for cleanup */
-            g_ptr_array_add(priv->created_files, g_strdup(filepath));
-            service->dnssd_filename = g_strdup(filename);
-            g_debug("Created DNS-SD service file: %s", filepath);
+            for (guint j = i; j < jobs->len; j++) {
+                job = g_ptr_array_index(jobs, j);
+                if (job->hash)
+                    unlink(job->tmppath);
+            }
+            if (dirfd >= 0)
+                close(dirfd);
+            g_ptr_array_unref(jobs);
+            return FALSE;
         }
 
-        g_free(filename);
-        g_free(filepath);
-        g_free(content);
+        if (!g_ptr_array_find_with_equal_func(priv->created_files, job->filepath, g_str_equal, NULL))
+            g_ptr_array_add(priv->created_files, g_steal_pointer(&job->filepath));
+        g_free(job->service->content_hash);
+        job->service->content_hash = g_steal_pointer(&job->hash);
+        written++;
+    }
 
-        if (!success)
-            break;
+    /* And one for the renames */
+    if (dirfd >= 0) {
+        if (written > 0 && fsync(dirfd) != 0)
+            g_warning("Failed to sync %s: %s", DNSSD_RUNTIME_DIR, g_strerror(errno));
+        close(dirfd);
+    }
+
+    g_debug("Bulk commit wrote %u of %u service files", written, jobs->len);
+
+    *changed |= written > 0;
+    g_ptr_array_unref(jobs);
+    return TRUE;
+}
+
+static void reload_call_cb(GObject *source, GAsyncResult *result, gpointer user_data) {
+    GTask *task = G_TASK(user_data);
+    GError *error = NULL;
+    GVariant *reply;
+
+    reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    if (reply) {
+        g_variant_unref(reply);
+        g_task_return_boolean(task, TRUE);
+    } else {
+        g_debug("ReloadDNSSD call failed: %s", error->message);
+        g_task_return_error(task, error);
+    }
+
+    g_object_unref(task);
+}
+
+static void reload_call(GTask *task) {
+    g_dbus_connection_call(system_bus,
+                           "org.freedesktop.resolve1",
+                           "/org/freedesktop/resolve1",
+                           "org.freedesktop.resolve1.Manager",
+                           "ReloadDNSSD",
+                           NULL,
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           DNSSD_RELOAD_TIMEOUT_MS,
+                           g_task_get_cancellable(task),
+                           reload_call_cb,
+                           task);
+}
+
+static void reload_bus_cb(G_GNUC_UNUSED GObject *source, GAsyncResult *result, gpointer user_data) {
+    GTask *task = G_TASK(user_data);
+    GError *error = NULL;
+    GDBusConnection *bus = g_bus_get_finish(result, &error);
+
+    if (!bus) {
+        g_debug("Failed to connect to the system bus: %s", error->message);
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    /* Another reload may have connected in the meantime */
+    if (!system_bus || g_dbus_connection_is_closed(system_bus)) {
+        g_clear_object(&system_bus);
+        system_bus = bus;
+    } else {
+        g_object_unref(bus);
     }
 
-    if (success) {
-        /* Signal systemd-resolved to reload */
-        signal_resolved_reload();
+    reload_call(task);
+}
+
+/*
+ * Ask systemd-resolved to reload its DNS-SD configuration. The system bus
+ * is connected once, asynchronously, and kept for all later reloads.
+ */
+static void reload_dnssd_async(GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+
+    g_task_set_source_tag(task, reload_dnssd_async);
+
+    if (system_bus && !g_dbus_connection_is_closed(system_bus))
+        reload_call(task);
+    else
+        g_bus_get(G_BUS_TYPE_SYSTEM, cancellable, reload_bus_cb, task);
+}
+
+static gboolean reload_dnssd_finish(GAsyncResult *result, GError **error) {
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+static void reload_schedule(void);
+
+/* Complete every request of a batch with the result of its reload */
+static void reload_batch_cb(G_GNUC_UNUSED GObject *source, GAsyncResult *result, gpointer user_data) {
+    GPtrArray *batch = user_data;
+    GHashTable *clients = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GError *error = NULL;
+    gboolean success = reload_dnssd_finish(result, &error);
+    GHashTableIter iter;
+    gpointer client, count;
+
+    g_debug("ReloadDNSSD done for %u requests", batch->len);
+
+    for (guint i = 0; i < batch->len; i++) {
+        GTask *task = g_ptr_array_index(batch, i);
+        GaClient *owner = g_task_get_task_data(task);
+
+        if (owner) {
+            count = g_hash_table_lookup(clients, owner);
+            g_hash_table_insert(clients, owner, GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+        }
+
+        if (g_task_return_error_if_cancelled(task))
+            continue;
+        if (success)
+            g_task_return_boolean(task, TRUE);
+        else
+            g_task_return_error(task, g_error_copy(error));
+    }
+
+    /* Every client saw one reload, whatever the number of its requests */
+    g_hash_table_iter_init(&iter, clients);
+    while (g_hash_table_iter_next(&iter, &client, &count)) {
+        GaClientStatistics *stats = ga_client_peek_statistics(client);
+
+        stats->dnssd_reloads++;
+        stats->dnssd_reloads_saved += GPOINTER_TO_UINT(count) - 1;
+    }
+
+    g_hash_table_unref(clients);
+    g_clear_error(&error);
+    g_ptr_array_unref(batch);
+
+    reload_scheduler.in_flight = FALSE;
+    if (reload_scheduler.waiting->len > 0 && !reload_scheduler.timer)
+        reload_schedule();
+}
+
+/* Send the waiting requests' reload */
+static void reload_schedule(void) {
+    GPtrArray *batch = reload_scheduler.waiting;
+
+    reload_scheduler.waiting = g_ptr_array_new_with_free_func(g_object_unref);
+    reload_scheduler.in_flight = TRUE;
+    reload_dnssd_async(NULL, reload_batch_cb, batch);
+}
+
+static gboolean reload_timer_cb(G_GNUC_UNUSED gpointer user_data) {
+    g_source_unref(reload_scheduler.timer);
+    reload_scheduler.timer = NULL;
+
+    if (!reload_scheduler.in_flight)
+        reload_schedule();
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Request a reload on behalf of a group attached to @client (may be
+ * NULL); it completes when the reload covering it does. Cancelling only
+ * changes the result, the shared reload goes ahead.
+ */
+static void reload_request_async(GaClient *client,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+
+    g_task_set_source_tag(task, reload_request_async);
+    if (client)
+        g_task_set_task_data(task, g_object_ref(client), g_object_unref);
+
+    if (!reload_scheduler.waiting)
+        reload_scheduler.waiting = g_ptr_array_new_with_free_func(g_object_unref);
+    g_ptr_array_add(reload_scheduler.waiting, task);
+
+    if (!reload_scheduler.timer && !reload_scheduler.in_flight) {
+        reload_scheduler.timer = g_timeout_source_new(DNSSD_RELOAD_DEBOUNCE_MS);
+        g_source_set_callback(reload_scheduler.timer, reload_timer_cb, NULL, NULL);
+        g_source_attach(reload_scheduler.timer, g_main_context_get_thread_default());
+    }
+}
+
+static gboolean reload_request_finish(GAsyncResult *result, GError **error) {
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/* Signal systemd-resolved to reload DNS-SD configuration, without waiting */
+static void signal_resolved_reload(GaClient *client) {
+    reload_request_async(client, NULL, NULL, NULL);
+}
+
+static void set_state(GaEntryGroup *group, GaEntryGroupState state) {
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+
+    priv->state = state;
+    g_signal_emit(group, signals[STATE_CHANGED],
+                  detail_for_state(priv->state), priv->state);
+}
+
+typedef struct _CommitData CommitData;
+
+/* A committed service being looked up */
+typedef struct {
+    CommitData *data;
+    GaEntryGroupServicePrivate *service;
+    GaVarlinkCall *call;
+} VerifyCall;
+
+/*
+ * A commit in flight. It holds no reference to the group, so dropping
+ * the group still disposes it: dispose aborts its commits, and a reload
+ * that completes afterwards finds group cleared.
+ */
+struct _CommitData {
+    GaEntryGroup *group;    /* NULL once the group is disposed */
+    GTask *task;            /* Of ga_entry_group_commit_async(), NULL once returned */
+    GSource *cancel_source; /* Watches the task's cancellable */
+    guint generation;
+    gint64 started;
+    GPtrArray *calls;       /* VerifyCall, while verifying */
+    guint pending;
+    gboolean cancelled;     /* The caller gave up: no lookups */
+    gboolean collision;     /* A service resolved to another host or port */
+    GError *error;          /* First service found missing */
+};
+
+static void verify_call_free(VerifyCall *vc) {
+    if (vc->call)
+        ga_varlink_call_cancel(vc->call);
+    g_free(vc);
+}
+
+static void commit_data_free(CommitData *data) {
+    if (data->cancel_source) {
+        g_source_destroy(data->cancel_source);
+        g_source_unref(data->cancel_source);
+    }
+    if (data->calls)
+        g_ptr_array_unref(data->calls);
+    g_clear_object(&data->task);
+    g_clear_error(&data->error);
+    g_free(data);
+}
+
+/* Complete the caller's task, if there is one; takes over @error */
+static void commit_return(CommitData *data, GError *error) {
+    if (data->cancel_source) {
+        g_source_destroy(data->cancel_source);
+        g_clear_pointer(&data->cancel_source, g_source_unref);
+    }
+
+    if (!data->task) {
+        g_clear_error(&error);
+        return;
+    }
+
+    if (error)
+        g_task_return_error(data->task, error);
+    else
+        g_task_return_boolean(data->task, TRUE);
+    g_clear_object(&data->task);
+}
+
+/* The commit is over: detach it from the group, then report and free it */
+static void commit_complete(CommitData *data, GError *error) {
+    if (data->group) {
+        GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(data->group);
+
+        g_ptr_array_remove_fast(priv->commits, data);
+        if (priv->verifying == data)
+            priv->verifying = NULL;
+    }
+
+    commit_return(data, error);
+    commit_data_free(data);
+}
+
+/*
+ * The caller stopped waiting. The reload is shared and goes ahead
+ * regardless, so the commit carries on and settles the state of the
+ * group, but no services are looked up: lookups in progress are
+ * cancelled and the group is established on the reload alone.
+ */
+static gboolean commit_cancelled_cb(G_GNUC_UNUSED GCancellable *cancellable,
+                                    gpointer user_data) {
+    CommitData *data = user_data;
+    GaEntryGroup *group = data->group;
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+    GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED, "The commit was cancelled");
+
+    data->cancelled = TRUE;
+
+    if (priv->verifying != data) {
+        g_debug("Entry group commit cancelled, the reload still settles the state");
+        commit_return(data, error);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_debug("Entry group commit cancelled, skipping the remaining lookups");
+    g_ptr_array_set_size(data->calls, 0);
+    data->pending = 0;
+
+    /* State-changed handlers may drop the group */
+    g_object_ref(group);
+    set_state(group, GA_ENTRY_GROUP_STATE_ESTABLISHED);
+    commit_complete(data, error);
+    g_object_unref(group);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Give up the verification of a commit that a later one or a reset replaced */
+static void commit_verify_abort(GaEntryGroupPrivate *priv) {
+    CommitData *data = priv->verifying;
+
+    if (!data)
+        return;
+
+    g_ptr_array_set_size(data->calls, 0);
+    commit_complete(data, NULL);
+}
+
+/* The group is being disposed: fail every commit still in flight */
+static void commit_abort_all(GaEntryGroupPrivate *priv) {
+    while (priv->commits->len > 0) {
+        CommitData *data = g_ptr_array_remove_index_fast(priv->commits, 0);
+        gboolean verifying = data == priv->verifying;
+
+        data->group = NULL;
+        if (verifying) {
+            priv->verifying = NULL;
+            g_ptr_array_set_size(data->calls, 0);
+        }
+
+        commit_return(data, g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                        "The entry group was disposed"));
+
+        /* Otherwise the reload is still out; its callback frees it */
+        if (verifying)
+            commit_data_free(data);
+    }
+}
 
-        priv->state = GA_ENTRY_GROUP_STATE_ESTABLISHED;
-        g_signal_emit(group, signals[STATE_CHANGED],
-                      detail_for_state(priv->state), priv->state);
+/* Every lookup is done: settle the state of the group */
+static void commit_verify_done(CommitData *data) {
+    GaEntryGroup *group = data->group;
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+
+    if (data->collision) {
+        set_state(group, GA_ENTRY_GROUP_STATE_COLLISION);
+        commit_complete(data, g_error_new(GA_ERROR, GA_ERROR_COLLISION,
+                                          "A service name is already taken by another host"));
+    } else if (data->error) {
+        set_state(group, GA_ENTRY_GROUP_STATE_FAILURE);
+        commit_complete(data, g_steal_pointer(&data->error));
     } else {
+        GaClientStatistics *stats = ga_client_peek_statistics(priv->client);
+        guint64 latency = (guint64)(g_get_monotonic_time() - data->started);
+
+        stats->publish_verifications++;
+        stats->publish_latency_last = latency;
+        stats->publish_latency_max = MAX(stats->publish_latency_max, latency);
+        stats->publish_latency_total += latency;
+
+        set_state(group, GA_ENTRY_GROUP_STATE_ESTABLISHED);
+        commit_complete(data, NULL);
+    }
+}
+
+/* Host names without the trailing dot and the .local domain */
+static gboolean host_name_equal(const gchar *a, const gchar *b) {
+    gsize la = strlen(a), lb = strlen(b);
+
+    if (la > 0 && a[la - 1] == '.')
+        la--;
+    if (lb > 0 && b[lb - 1] == '.')
+        lb--;
+    if (la > 6 && g_ascii_strncasecmp(a + la - 6, ".local", 6) == 0)
+        la -= 6;
+    if (lb > 6 && g_ascii_strncasecmp(b + lb - 6, ".local", 6) == 0)
+        lb -= 6;
+
+    return la == lb && g_ascii_strncasecmp(a, b, la) == 0;
+}
+
+static void commit_verify_cb(GVariant *result, const GError *error, gpointer user_data) {
+    VerifyCall *vc = user_data;
+    CommitData *data = vc->data;
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(data->group);
+    const gchar *name = vc->service->public.name;
+    const gchar *own_host = vc->service->public.host ? vc->service->public.host
+                                                     : ga_client_get_host_name_fqdn(priv->client);
+    const gchar *host = NULL;
+    guint16 port = 0;
+
+    vc->call = NULL;
+
+    if (error) {
+        g_debug("Published service '%s' not visible: %s", name, error->message);
+        if (!data->error)
+            data->error = g_error_new(GA_ERROR, GA_ERROR_NOT_FOUND,
+                                      "Service '%s' is not visible: %s", name, error->message);
+    } else if (g_variant_lookup(result, "host", "&s", &host) &&
+               g_variant_lookup(result, "port", "q", &port) &&
+               (!host_name_equal(host, own_host) || port != vc->service->public.port)) {
+        /* resolved withdrew ours for another host's, which now answers */
+        g_debug("Published service '%s' resolves to %s:%u instead of %s:%u",
+                name, host, port, own_host, vc->service->public.port);
+        data->collision = TRUE;
+    }
+
+    if (--data->pending > 0)
+        return;
+
+    /* State-changed handlers may drop the group */
+    GaEntryGroup *group = g_object_ref(data->group);
+    commit_verify_done(data);
+    g_object_unref(group);
+}
+
+/*
+ * Look every service up through the client once resolved has reloaded.
+ * The group is only established when all of them are visible.
+ */
+static void commit_verify_start(CommitData *data) {
+    GaEntryGroup *group = data->group;
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+    GHashTableIter iter;
+    gpointer value;
+
+    data->calls = g_ptr_array_new_with_free_func((GDestroyNotify)verify_call_free);
+    priv->verifying = data;
+
+    g_hash_table_iter_init(&iter, priv->services);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        VerifyCall *vc;
+
+        /* A bulk commit is one reload: one service stands for all */
+        if (priv->bulk && data->pending > 0)
+            break;
+
+        vc = g_new0(VerifyCall, 1);
+
+        vc->data = data;
+        vc->service = value;
+        g_ptr_array_add(data->calls, vc);
+        data->pending++;
+
+        vc->call = ga_service_resolve_start(priv->client, group, GA_REQUEST_PRIORITY_BACKGROUND,
+                                            vc->service->public.interface,
+                                            vc->service->public.name,
+                                            vc->service->public.type,
+                                            vc->service->public.domain,
+                                            GA_PROTOCOL_UNSPEC, GA_LOOKUP_NO_TXT,
+                                            PUBLISH_VERIFY_TIMEOUT_MS,
+                                            commit_verify_cb, vc);
+    }
+
+    if (data->pending == 0)
+        commit_verify_done(data);
+}
+
+/* The reload is done: verify the services, then the group is established */
+static void commit_reload_cb(G_GNUC_UNUSED GObject *source, GAsyncResult *result, gpointer user_data) {
+    CommitData *data = user_data;
+    GaEntryGroup *group = data->group;
+    GaEntryGroupPrivate *priv;
+    GError *error = NULL;
+    gboolean success = reload_request_finish(result, &error);
+
+    /* Resolved without ReloadDNSSD picks the files up when it restarts */
+    if (!success && g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+        g_debug("ReloadDNSSD not supported, assuming the services are published");
+        g_clear_error(&error);
+        success = TRUE;
+    }
+
+    /* The group was disposed and the commit already failed */
+    if (!group) {
+        g_clear_error(&error);
+        commit_data_free(data);
+        return;
+    }
+
+    /* State-changed handlers may drop the group */
+    g_object_ref(group);
+    priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+
+    /* A later commit or a reset took over */
+    if (data->generation == priv->commit_generation) {
+        if (success && priv->client && !data->cancelled &&
+            ga_client_has_feature(priv->client, GA_CLIENT_FEATURE_RESOLVE_SERVICE)) {
+            commit_verify_start(data);
+            g_object_unref(group);
+            return;
+        }
+
+        set_state(group, success ? GA_ENTRY_GROUP_STATE_ESTABLISHED
+                                 : GA_ENTRY_GROUP_STATE_FAILURE);
+    }
+
+    commit_complete(data, error);
+    g_object_unref(group);
+}
+
+/*
+ * Write the service files that changed and start the reload; @task, if
+ * not NULL, completes when the reload does, or at once if the group is
+ * established and nothing changed. Returns FALSE if the files could not
+ * be written.
+ */
+static gboolean commit_start(GaEntryGroup *group, GTask *task, GError **error) {
+    GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
+    GHashTable *current = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GHashTableIter iter;
+    gpointer value;
+    gboolean success = TRUE;
+    gboolean changed = FALSE;
+    CommitData *data;
+
+    priv->commit_generation++;
+    commit_verify_abort(priv);
+
+    /* Ensure the directory exists */
+    if (!ensure_dnssd_dir(error)) {
+        g_hash_table_unref(current);
+        set_state(group, GA_ENTRY_GROUP_STATE_FAILURE);
+        return FALSE;
+    }
+
+    /* Write the .dnssd files whose content changed */
+    if (priv->bulk)
+        success = write_service_files_bulk(priv, &changed, error);
+
+    g_hash_table_iter_init(&iter, priv->services);
+    while (success && g_hash_table_iter_next(&iter, NULL, &value)) {
+        GaEntryGroupServicePrivate *service = (GaEntryGroupServicePrivate *)value;
+        gboolean written;
+
+        if (!priv->bulk) {
+            success = write_service_file(priv, service, &written, error);
+            changed |= written;
+        }
+
+        /* The file now holds the latest TXT set */
+        if (service->publish_timer) {
+            g_source_destroy(service->publish_timer);
+            g_clear_pointer(&service->publish_timer, g_source_unref);
+        }
+        if (service->dnssd_filename)
+            g_hash_table_add(current, g_build_filename(DNSSD_RUNTIME_DIR,
+                                                       service->dnssd_filename, NULL));
+    }
+
+    if (!success) {
+        g_hash_table_unref(current);
         /* Clean up any files we created on failure */
         cleanup_dnssd_files(priv);
+        set_state(group, GA_ENTRY_GROUP_STATE_FAILURE);
+        return FALSE;
+    }
 
-        priv->state = GA_ENTRY_GROUP_STATE_FAILURE;
-        g_signal_emit(group, signals[STATE_CHANGED],
-                      detail_for_state(priv->state), priv->state);
+    /* Files of services that are gone */
+    for (guint i = priv->created_files->len; i > 0; i--) {
+        const gchar *filepath = g_ptr_array_index(priv->created_files, i - 1);
+
+        if (g_hash_table_contains(current, filepath))
+            continue;
+        if (unlink(filepath) != 0 && errno != ENOENT)
+            g_warning("Failed to remove .dnssd file %s: %s", filepath, g_strerror(errno));
+        g_ptr_array_remove_index_fast(priv->created_files, i - 1);
+        changed = TRUE;
     }
+    g_hash_table_unref(current);
 
-    return success;
+    if (!changed && priv->state == GA_ENTRY_GROUP_STATE_ESTABLISHED) {
+        g_debug("Entry group unchanged, no reload needed");
+        if (task)
+            g_task_return_boolean(task, TRUE);
+        return TRUE;
+    }
+
+    set_state(group, GA_ENTRY_GROUP_STATE_REGISTERING);
+
+    /* Signal systemd-resolved to reload; the group is established once
+     * it has answered */
+    data = g_new0(CommitData, 1);
+    data->group = group;
+    data->task = task ? g_object_ref(task) : NULL;
+    data->generation = priv->commit_generation;
+    data->started = g_get_monotonic_time();
+    g_ptr_array_add(priv->commits, data);
+
+    if (task && g_task_get_cancellable(task)) {
+        data->cancel_source = g_cancellable_source_new(g_task_get_cancellable(task));
+        g_source_set_callback(data->cancel_source,
+                              (GSourceFunc)(void (*)(void))commit_cancelled_cb,
+                              data, NULL);
+        g_source_attach(data->cancel_source, g_task_get_context(task));
+    }
+
+    reload_request_async(priv->client, NULL, commit_reload_cb, data);
+
+    return TRUE;
+}
+
+gboolean ga_entry_group_commit(GaEntryGroup *group, GError **error) {
+    g_return_val_if_fail(IS_GA_ENTRY_GROUP(group), FALSE);
+
+    /* Nobody waits for the reload; state-changed reports how it went */
+    return commit_start(group, NULL, error);
+}
+
+void ga_entry_group_commit_async(GaEntryGroup *group,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data) {
+    GTask *task;
+    GError *error = NULL;
+
+    g_return_if_fail(IS_GA_ENTRY_GROUP(group));
+
+    task = g_task_new(group, cancellable, callback, user_data);
+    g_task_set_source_tag(task, ga_entry_group_commit_async);
+
+    if (!commit_start(group, task, &error))
+        g_task_return_error(task, error);
+    g_object_unref(task);
+}
+
+gboolean ga_entry_group_commit_finish(GaEntryGroup *group,
+                                      GAsyncResult *result,
+                                      GError **error) {
+    g_return_val_if_fail(g_task_is_valid(result, group), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
 }
 
 gboolean ga_entry_group_reset(GaEntryGroup *group, G_GNUC_UNUSED GError **error) {
     GaEntryGroupPrivate *priv = GA_ENTRY_GROUP_GET_PRIVATE(group);
 
+    /* A commit still waiting for its reload no longer applies */
+    priv->commit_generation++;
+    commit_verify_abort(priv);
+
     /* Clean up .dnssd files */
     cleanup_dnssd_files(priv);
 
     g_hash_table_remove_all(priv->services);
 
-    priv->state = GA_ENTRY_GROUP_STATE_UNCOMMITED;
-    g_signal_emit(group, signals[STATE_CHANGED],
-                  detail_for_state(priv->state), priv->state);
+    set_state(group, GA_ENTRY_GROUP_STATE_UNCOMMITED);
 
     return TRUE;
 }
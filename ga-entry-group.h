@@ -6,6 +6,7 @@
 #define __GA_ENTRY_GROUP_H__
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include "ga-client.h"
 #include "ga-enums.h"
 
@@ -179,9 +180,57 @@ gboolean ga_entry_group_service_remove_key(GaEntryGroupService * service,
 /* Update the txt record of the frozen service */
 gboolean ga_entry_group_service_thaw(GaEntryGroupService * service, GError ** error);
 
-/* Commit all newly added services */
+/*
+ * Publish TXT updates of @service at most once per @interval_ms (0, the
+ * default, for no limit). Thaws within the interval are held back and
+ * the latest TXT set is published when it is over.
+ */
+void ga_entry_group_service_set_min_publish_interval(GaEntryGroupService * service,
+                                                     guint interval_ms);
+
+/* TXT updates of @service published, and held back by the interval */
+void ga_entry_group_service_get_publish_stats(GaEntryGroupService * service,
+                                              guint64 * published,
+                                              guint64 * suppressed);
+
+/*
+ * Commit all newly added services. Only writing the service files is
+ * synchronous: once systemd-resolved has reloaded them every service is
+ * looked up, and the group turns ESTABLISHED when all are visible, or
+ * FAILURE (GA_ERROR_NOT_FOUND) when one is not. A service that resolves
+ * to another host or port means resolved withdrew ours for a host that
+ * holds the name: the group turns COLLISION (GA_ERROR_COLLISION). The
+ * pending reload and lookups hold no reference to @group: dropping the last one
+ * disposes it as usual, which abandons them and removes its files.
+ */
 gboolean ga_entry_group_commit(GaEntryGroup * group, GError ** error);
 
+/**
+ * ga_entry_group_commit_async:
+ * @group: A GaEntryGroup
+ * @cancellable: (nullable): A GCancellable
+ * @callback: Called when the services are visible, or found not to be
+ * @user_data: Data for @callback
+ *
+ * Like ga_entry_group_commit(), completing along with the transition
+ * out of GA_ENTRY_GROUP_STATE_REGISTERING. As usual for asynchronous
+ * calls, @group is kept alive until @callback has run; a commit still
+ * pending when the group is disposed fails with G_IO_ERROR_CANCELLED.
+ * Cancelling only stops waiting: the files are written and the reload,
+ * shared with other groups, goes ahead, so the group stays REGISTERING
+ * and state-changed reports how the commit ends. Services are not looked
+ * up after cancelling, and lookups in progress are abandoned; the group
+ * is then established once the reload succeeds.
+ */
+void ga_entry_group_commit_async(GaEntryGroup * group,
+                                 GCancellable * cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data);
+
+gboolean ga_entry_group_commit_finish(GaEntryGroup * group,
+                                      GAsyncResult * result,
+                                      GError ** error);
+
 /* Invalidate all GaEntryGroupServices */
 gboolean ga_entry_group_reset(GaEntryGroup * group, GError ** error);
 
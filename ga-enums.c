@@ -45,6 +45,9 @@ GType ga_lookup_flags_get_type(void) {
             { GA_LOOKUP_USE_MULTICAST, "GA_LOOKUP_USE_MULTICAST", "use-multicast" },
             { GA_LOOKUP_NO_TXT, "GA_LOOKUP_NO_TXT", "no-txt" },
             { GA_LOOKUP_NO_ADDRESS, "GA_LOOKUP_NO_ADDRESS", "no-address" },
+            { GA_LOOKUP_COLLAPSE_INTERFACES, "GA_LOOKUP_COLLAPSE_INTERFACES", "collapse-interfaces" },
+            { GA_LOOKUP_CACHE_ONLY, "GA_LOOKUP_CACHE_ONLY", "cache-only" },
+            { GA_LOOKUP_STALE_WHILE_REVALIDATE, "GA_LOOKUP_STALE_WHILE_REVALIDATE", "stale-while-revalidate" },
             { 0, NULL, NULL }
         };
         type = g_flags_register_static("GaLookupFlags", values);
@@ -80,3 +83,16 @@ GType ga_browser_event_get_type(void) {
     }
     return type;
 }
+
+GType ga_request_priority_get_type(void) {
+    static GType type = 0;
+    if (G_UNLIKELY(type == 0)) {
+        static const GEnumValue values[] = {
+            { GA_REQUEST_PRIORITY_INTERACTIVE, "GA_REQUEST_PRIORITY_INTERACTIVE", "interactive" },
+            { GA_REQUEST_PRIORITY_BACKGROUND, "GA_REQUEST_PRIORITY_BACKGROUND", "background" },
+            { 0, NULL, NULL }
+        };
+        type = g_enum_register_static("GaRequestPriority", values);
+    }
+    return type;
+}
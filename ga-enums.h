@@ -39,7 +39,11 @@ typedef enum {
     GA_LOOKUP_USE_WIDE_AREA = 1,    /**< Force lookup via wide area DNS */
     GA_LOOKUP_USE_MULTICAST = 2,    /**< Force lookup via multicast DNS */
     GA_LOOKUP_NO_TXT = 4,           /**< When doing service resolving, don't lookup TXT record */
-    GA_LOOKUP_NO_ADDRESS = 8        /**< When doing service resolving, don't lookup A/AAAA record */
+    GA_LOOKUP_NO_ADDRESS = 8,       /**< When doing service resolving, don't lookup A/AAAA record */
+    /* Extensions, not part of the Avahi API */
+    GA_LOOKUP_COLLAPSE_INTERFACES = 1 << 8, /**< When browsing, report a service once across all interfaces */
+    GA_LOOKUP_CACHE_ONLY = 1 << 9,          /**< Answer from the cache only, never query the network */
+    GA_LOOKUP_STALE_WHILE_REVALIDATE = 1 << 10 /**< When resolving, report the last known result at once and refresh it */
 } GaLookupFlags;
 
 typedef GaLookupFlags AvahiLookupFlags;
@@ -50,6 +54,13 @@ typedef GaLookupFlags AvahiLookupFlags;
 #define AVAHI_LOOKUP_NO_TXT         GA_LOOKUP_NO_TXT
 #define AVAHI_LOOKUP_NO_ADDRESS     GA_LOOKUP_NO_ADDRESS
 
+/* Scheduling class of the requests an object sends to systemd-resolved
+ * (extension, not part of the Avahi API) */
+typedef enum {
+    GA_REQUEST_PRIORITY_INTERACTIVE = 0, /**< Served first */
+    GA_REQUEST_PRIORITY_BACKGROUND = 1   /**< Served when no interactive request waits, with a small share to avoid starving */
+} GaRequestPriority;
+
 typedef enum {
     GA_RESOLVER_FOUND = 0,           /**< RR found, resolving successful */
     GA_RESOLVER_FAILURE = 1          /**< Resolving failed */
@@ -177,12 +188,14 @@ GType ga_lookup_result_flags_get_type(void) G_GNUC_CONST;
 GType ga_lookup_flags_get_type(void) G_GNUC_CONST;
 GType ga_resolver_event_get_type(void) G_GNUC_CONST;
 GType ga_browser_event_get_type(void) G_GNUC_CONST;
+GType ga_request_priority_get_type(void) G_GNUC_CONST;
 
 #define GA_TYPE_PROTOCOL (ga_protocol_get_type())
 #define GA_TYPE_LOOKUP_RESULT_FLAGS (ga_lookup_result_flags_get_type())
 #define GA_TYPE_LOOKUP_FLAGS (ga_lookup_flags_get_type())
 #define GA_TYPE_RESOLVER_EVENT (ga_resolver_event_get_type())
 #define GA_TYPE_BROWSER_EVENT (ga_browser_event_get_type())
+#define GA_TYPE_REQUEST_PRIORITY (ga_request_priority_get_type())
 
 G_END_DECLS
 
@@ -0,0 +1,456 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-host-name-resolver.c - Source for GaHostNameResolver (systemd-resolved compatibility) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <gio/gio.h>
+#include <systemd/sd-varlink.h>
+
+#include "ga-host-name-resolver.h"
+#include "ga-service-resolver-private.h"
+#include "ga-client-private.h"
+#include "ga-error.h"
+
+/* signal enum */
+enum {
+    FOUND,
+    FAILURE,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* properties */
+enum {
+    PROP_PROTOCOL = 1,
+    PROP_IFINDEX,
+    PROP_NAME,
+    PROP_FLAGS,
+    PROP_APROTOCOL,
+    PROP_TIMEOUT_MS,
+    PROP_CANCELLABLE,
+    PROP_PRIORITY
+};
+
+struct _GaHostNameResolverPrivate {
+    GaClient *client;
+    GaIfIndex interface;
+    GaProtocol protocol;
+    GaProtocol aprotocol;
+    char *name;
+    GaLookupFlags flags;
+    guint timeout_ms;
+    GaRequestPriority priority;
+    GCancellable *cancellable;
+    GSource *cancel_source;
+    GaVarlinkCall *call;    /* ResolveHostname in flight */
+    GaAddress address;
+    gboolean resolved;
+    gboolean dispose_has_run;
+};
+
+#define GA_HOST_NAME_RESOLVER_GET_PRIVATE(o) \
+    ((GaHostNameResolverPrivate *)ga_host_name_resolver_get_instance_private(o))
+
+G_DEFINE_TYPE_WITH_PRIVATE(GaHostNameResolver, ga_host_name_resolver, G_TYPE_OBJECT)
+
+static void ga_host_name_resolver_init(GaHostNameResolver *obj) {
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(obj);
+
+    priv->client = NULL;
+    priv->name = NULL;
+    priv->interface = GA_IF_UNSPEC;
+    priv->protocol = GA_PROTOCOL_UNSPEC;
+    priv->aprotocol = GA_PROTOCOL_UNSPEC;
+    priv->call = NULL;
+    priv->resolved = FALSE;
+}
+
+static void ga_host_name_resolver_dispose(GObject *object);
+static void ga_host_name_resolver_finalize(GObject *object);
+static void resolve_stop(GaHostNameResolver *resolver);
+
+static void ga_host_name_resolver_set_property(GObject *object,
+                                               guint property_id,
+                                               const GValue *value,
+                                               GParamSpec *pspec) {
+    GaHostNameResolver *resolver = GA_HOST_NAME_RESOLVER(object);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+
+    switch (property_id) {
+        case PROP_PROTOCOL:
+            priv->protocol = g_value_get_enum(value);
+            break;
+        case PROP_APROTOCOL:
+            priv->aprotocol = g_value_get_enum(value);
+            break;
+        case PROP_IFINDEX:
+            priv->interface = g_value_get_int(value);
+            break;
+        case PROP_NAME:
+            g_free(priv->name);
+            priv->name = g_strdup(g_value_get_string(value));
+            break;
+        case PROP_FLAGS:
+            priv->flags = g_value_get_flags(value);
+            break;
+        case PROP_TIMEOUT_MS:
+            priv->timeout_ms = g_value_get_uint(value);
+            break;
+        case PROP_CANCELLABLE:
+            if (priv->cancellable)
+                g_object_unref(priv->cancellable);
+            priv->cancellable = g_value_dup_object(value);
+            break;
+        case PROP_PRIORITY:
+            priv->priority = g_value_get_enum(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void ga_host_name_resolver_get_property(GObject *object,
+                                               guint property_id,
+                                               GValue *value,
+                                               GParamSpec *pspec) {
+    GaHostNameResolver *resolver = GA_HOST_NAME_RESOLVER(object);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+
+    switch (property_id) {
+        case PROP_APROTOCOL:
+            g_value_set_enum(value, priv->aprotocol);
+            break;
+        case PROP_PROTOCOL:
+            g_value_set_enum(value, priv->protocol);
+            break;
+        case PROP_IFINDEX:
+            g_value_set_int(value, priv->interface);
+            break;
+        case PROP_NAME:
+            g_value_set_string(value, priv->name);
+            break;
+        case PROP_FLAGS:
+            g_value_set_flags(value, priv->flags);
+            break;
+        case PROP_TIMEOUT_MS:
+            g_value_set_uint(value, priv->timeout_ms);
+            break;
+        case PROP_CANCELLABLE:
+            g_value_set_object(value, priv->cancellable);
+            break;
+        case PROP_PRIORITY:
+            g_value_set_enum(value, priv->priority);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void ga_host_name_resolver_class_init(GaHostNameResolverClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GParamSpec *param_spec;
+
+    object_class->dispose = ga_host_name_resolver_dispose;
+    object_class->finalize = ga_host_name_resolver_finalize;
+    object_class->set_property = ga_host_name_resolver_set_property;
+    object_class->get_property = ga_host_name_resolver_get_property;
+
+    /* Emitted once for every address of the host */
+    signals[FOUND] =
+        g_signal_new("found",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,  /* Use default marshaller */
+                     G_TYPE_NONE, 5,
+                     G_TYPE_INT,            /* interface */
+                     GA_TYPE_PROTOCOL,      /* protocol */
+                     G_TYPE_STRING,         /* name */
+                     G_TYPE_POINTER,        /* address (GaAddress*) */
+                     GA_TYPE_LOOKUP_RESULT_FLAGS);
+
+    signals[FAILURE] =
+        g_signal_new("failure",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__POINTER,
+                     G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    param_spec = g_param_spec_enum("protocol", "Protocol",
+                                   "Protocol to resolve on",
+                                   GA_TYPE_PROTOCOL,
+                                   GA_PROTOCOL_UNSPEC,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PROTOCOL, param_spec);
+
+    param_spec = g_param_spec_enum("aprotocol", "Address protocol",
+                                   "Protocol of the addresses to be resolved",
+                                   GA_TYPE_PROTOCOL,
+                                   GA_PROTOCOL_UNSPEC,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_APROTOCOL, param_spec);
+
+    param_spec = g_param_spec_int("interface", "Interface index",
+                                  "Interface to use for resolver",
+                                  G_MININT, G_MAXINT,
+                                  GA_IF_UNSPEC,
+                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_IFINDEX, param_spec);
+
+    param_spec = g_param_spec_string("name", "Host name",
+                                     "Host name to resolve",
+                                     NULL,
+                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_NAME, param_spec);
+
+    param_spec = g_param_spec_flags("flags", "Lookup flags",
+                                    "Resolver lookup flags",
+                                    GA_TYPE_LOOKUP_FLAGS,
+                                    GA_LOOKUP_NO_FLAGS,
+                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
+
+    param_spec = g_param_spec_uint("timeout-ms", "Timeout",
+                                   "Deadline of the lookup in milliseconds, 0 for the default",
+                                   0, G_MAXUINT,
+                                   0,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_TIMEOUT_MS, param_spec);
+
+    /* Cancelling stops the resolver without emitting any further signal */
+    param_spec = g_param_spec_object("cancellable", "Cancellable",
+                                     "Cancellable to abort the lookup with",
+                                     G_TYPE_CANCELLABLE,
+                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_CANCELLABLE, param_spec);
+
+    param_spec = g_param_spec_enum("priority", "Priority",
+                                   "Scheduling class of the resolver's requests",
+                                   GA_TYPE_REQUEST_PRIORITY,
+                                   GA_REQUEST_PRIORITY_INTERACTIVE,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PRIORITY, param_spec);
+}
+
+void ga_host_name_resolver_dispose(GObject *object) {
+    GaHostNameResolver *self = GA_HOST_NAME_RESOLVER(object);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(self);
+
+    if (priv->dispose_has_run)
+        return;
+
+    priv->dispose_has_run = TRUE;
+
+    resolve_stop(self);
+
+    if (priv->cancellable) {
+        g_object_unref(priv->cancellable);
+        priv->cancellable = NULL;
+    }
+
+    if (priv->client) {
+        g_object_unref(priv->client);
+        priv->client = NULL;
+    }
+
+    if (G_OBJECT_CLASS(ga_host_name_resolver_parent_class)->dispose)
+        G_OBJECT_CLASS(ga_host_name_resolver_parent_class)->dispose(object);
+}
+
+void ga_host_name_resolver_finalize(GObject *object) {
+    GaHostNameResolver *self = GA_HOST_NAME_RESOLVER(object);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(self);
+
+    g_free(priv->name);
+
+    G_OBJECT_CLASS(ga_host_name_resolver_parent_class)->finalize(object);
+}
+
+/* Stop the lookup; no signal is emitted afterwards */
+static void resolve_stop(GaHostNameResolver *resolver) {
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+
+    if (priv->call) {
+        ga_varlink_call_cancel(priv->call);
+        priv->call = NULL;
+    }
+
+    if (priv->cancel_source) {
+        g_source_destroy(priv->cancel_source);
+        g_source_unref(priv->cancel_source);
+        priv->cancel_source = NULL;
+    }
+}
+
+static gboolean resolve_cancelled_cb(G_GNUC_UNUSED GCancellable *cancellable,
+                                     gpointer user_data) {
+    GaHostNameResolver *resolver = GA_HOST_NAME_RESOLVER(user_data);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+
+    g_debug("GaHostNameResolver: Resolving '%s' cancelled", priv->name);
+    resolve_stop(resolver);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void resolve_reply_cb(sd_json_variant *reply,
+                             const GError *error,
+                             gpointer user_data) {
+    GaHostNameResolver *resolver = GA_HOST_NAME_RESOLVER(user_data);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+    const char *name = priv->name;
+
+    priv->call = NULL;
+    resolve_stop(resolver);
+
+    if (error) {
+        g_signal_emit(resolver, signals[FAILURE], 0, error);
+        return;
+    }
+
+    /* resolved reports the canonical name */
+    sd_json_variant *name_v = sd_json_variant_by_key(reply, "name");
+    if (name_v && sd_json_variant_is_string(name_v))
+        name = sd_json_variant_string(name_v);
+
+    sd_json_variant *flags_v = sd_json_variant_by_key(reply, "flags");
+    GaLookupResultFlags result_flags =
+        ga_varlink_result_flags(flags_v && sd_json_variant_is_unsigned(flags_v)
+                                ? sd_json_variant_unsigned(flags_v) : 0);
+
+    /* Handlers may drop the last reference */
+    g_object_ref(resolver);
+
+    sd_json_variant *addresses = sd_json_variant_by_key(reply, "addresses");
+    if (addresses && sd_json_variant_is_array(addresses)) {
+        size_t n = sd_json_variant_elements(addresses);
+        for (size_t i = 0; i < n && !priv->dispose_has_run; i++) {
+            sd_json_variant *entry = sd_json_variant_by_index(addresses, i);
+            GaAddress address;
+            GaIfIndex ifindex = priv->interface;
+
+            if (!entry || !ga_address_from_json(entry, &address))
+                continue;
+
+            sd_json_variant *ifindex_v = sd_json_variant_by_key(entry, "ifindex");
+            if (ifindex_v && sd_json_variant_is_integer(ifindex_v))
+                ifindex = (GaIfIndex)sd_json_variant_integer(ifindex_v);
+
+            if (!priv->resolved) {
+                priv->address = address;
+                priv->resolved = TRUE;
+            }
+
+            g_signal_emit(resolver, signals[FOUND], 0,
+                          ifindex,
+                          priv->protocol,
+                          name,
+                          &address,
+                          result_flags);
+        }
+    }
+
+    g_object_unref(resolver);
+}
+
+GaHostNameResolver *ga_host_name_resolver_new(GaIfIndex interface,
+                                              GaProtocol protocol,
+                                              const gchar *name,
+                                              GaProtocol aprotocol,
+                                              GaLookupFlags flags) {
+    return g_object_new(GA_TYPE_HOST_NAME_RESOLVER,
+                        "interface", interface,
+                        "protocol", protocol,
+                        "name", name,
+                        "aprotocol", aprotocol,
+                        "flags", flags,
+                        NULL);
+}
+
+gboolean ga_host_name_resolver_attach(GaHostNameResolver *resolver,
+                                      GaClient *client,
+                                      GError **error) {
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+    sd_json_variant *params = NULL;
+    int family = AF_UNSPEC;
+    int r;
+
+    g_return_val_if_fail(IS_GA_HOST_NAME_RESOLVER(resolver), FALSE);
+    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+
+    g_object_ref(client);
+    priv->client = client;
+
+    if (!ga_client_has_feature(client, GA_CLIENT_FEATURE_RESOLVE_HOSTNAME)) {
+        if (error)
+            *error = g_error_new(GA_ERROR, GA_ERROR_NOT_SUPPORTED,
+                                 "systemd-resolved does not support ResolveHostname");
+        return FALSE;
+    }
+
+    if (priv->cancellable && g_cancellable_is_cancelled(priv->cancellable)) {
+        if (error)
+            *error = g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "Resolving '%s' was cancelled", priv->name);
+        return FALSE;
+    }
+
+    if (priv->aprotocol == GA_PROTOCOL_INET)
+        family = AF_INET;
+    else if (priv->aprotocol == GA_PROTOCOL_INET6)
+        family = AF_INET6;
+
+    /* GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
+     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics). */
+    r = sd_json_buildo(&params,
+                       SD_JSON_BUILD_PAIR_INTEGER("ifindex", priv->interface),
+                       SD_JSON_BUILD_PAIR_STRING("name", priv->name),
+                       SD_JSON_BUILD_PAIR_INTEGER("family", family),
+                       SD_JSON_BUILD_PAIR_UNSIGNED("flags",
+                                                   ga_varlink_lookup_flags(priv->flags & GA_LOOKUP_CACHE_ONLY)));
+    if (r < 0) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to build params: %s",
+                                 g_strerror(-r));
+        }
+        return FALSE;
+    }
+
+    priv->call = ga_client_call_full(client, resolver, priv->priority,
+                                     "io.systemd.Resolve.ResolveHostname", params,
+                                     priv->timeout_ms, resolve_reply_cb, resolver, NULL);
+    sd_json_variant_unref(params);
+
+    /* Cancellation is dispatched from the attaching thread's context */
+    if (priv->cancellable) {
+        priv->cancel_source = g_cancellable_source_new(priv->cancellable);
+        g_source_set_callback(priv->cancel_source,
+                              (GSourceFunc)(void (*)(void))resolve_cancelled_cb,
+                              resolver, NULL);
+        g_source_attach(priv->cancel_source, g_main_context_get_thread_default());
+    }
+
+    return TRUE;
+}
+
+gboolean ga_host_name_resolver_get_address(GaHostNameResolver *resolver,
+                                           GaAddress *address) {
+    g_return_val_if_fail(IS_GA_HOST_NAME_RESOLVER(resolver), FALSE);
+    GaHostNameResolverPrivate *priv = GA_HOST_NAME_RESOLVER_GET_PRIVATE(resolver);
+
+    if (!priv->resolved)
+        return FALSE;
+
+    *address = priv->address;
+    return TRUE;
+}
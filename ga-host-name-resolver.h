@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-host-name-resolver.h - Header for GaHostNameResolver (systemd-resolved compatibility) */
+
+#ifndef __GA_HOST_NAME_RESOLVER_H__
+#define __GA_HOST_NAME_RESOLVER_H__
+
+#include <glib-object.h>
+#include "ga-client.h"
+#include "ga-enums.h"
+#include "ga-service-resolver.h"  /* For GaAddress */
+
+G_BEGIN_DECLS
+
+typedef struct _GaHostNameResolver GaHostNameResolver;
+typedef struct _GaHostNameResolverClass GaHostNameResolverClass;
+typedef struct _GaHostNameResolverPrivate GaHostNameResolverPrivate;
+
+struct _GaHostNameResolverClass {
+    GObjectClass parent_class;
+};
+
+struct _GaHostNameResolver {
+    GObject parent;
+    GaHostNameResolverPrivate *priv;
+};
+
+GType ga_host_name_resolver_get_type(void);
+
+/* TYPE MACROS */
+#define GA_TYPE_HOST_NAME_RESOLVER \
+  (ga_host_name_resolver_get_type())
+#define GA_HOST_NAME_RESOLVER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GA_TYPE_HOST_NAME_RESOLVER, GaHostNameResolver))
+#define GA_HOST_NAME_RESOLVER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GA_TYPE_HOST_NAME_RESOLVER, GaHostNameResolverClass))
+#define IS_GA_HOST_NAME_RESOLVER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GA_TYPE_HOST_NAME_RESOLVER))
+#define IS_GA_HOST_NAME_RESOLVER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GA_TYPE_HOST_NAME_RESOLVER))
+#define GA_HOST_NAME_RESOLVER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GA_TYPE_HOST_NAME_RESOLVER, GaHostNameResolverClass))
+
+GaHostNameResolver *ga_host_name_resolver_new(GaIfIndex interface,
+                                              GaProtocol protocol,
+                                              const gchar * name,
+                                              GaProtocol aprotocol,
+                                              GaLookupFlags flags);
+
+gboolean
+ga_host_name_resolver_attach(GaHostNameResolver * resolver,
+                             GaClient * client, GError ** error);
+
+/* First address found, if any */
+gboolean
+ga_host_name_resolver_get_address(GaHostNameResolver * resolver,
+                                  GaAddress * address);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_HOST_NAME_RESOLVER_H__ */
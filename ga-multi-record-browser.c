@@ -0,0 +1,551 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-multi-record-browser.c - Source for GaMultiRecordBrowser (systemd-resolved compatibility) */
+
+#include <string.h>
+#include <systemd/sd-varlink.h>
+
+#include "ga-multi-record-browser.h"
+#include "ga-record-browser-private.h"
+#include "ga-client-private.h"
+#include "ga-error.h"
+
+/* Queries of one browser in flight at a time */
+#define MULTI_DEFAULT_MAX_CONCURRENT 4
+
+/* signal enum */
+enum {
+    NEW_RECORD,
+    NEW_RECORD_PARSED,
+    QUERY_DONE,
+    QUERY_FAILURE,
+    ALL_FOR_NOW,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* properties */
+enum {
+    PROP_IFINDEX = 1,
+    PROP_FLAGS,
+    PROP_TIMEOUT_MS,
+    PROP_PRIORITY,
+    PROP_MAX_CONCURRENT
+};
+
+/* One (name, class, type) key */
+typedef struct {
+    GaMultiRecordBrowser *browser;
+    gchar *key;             /* "class:type:name", name in lower case */
+    gchar *name;
+    guint16 clazz;
+    guint16 type;
+    GaVarlinkCall *call;    /* ResolveRecord in flight */
+    GList *link;            /* In the pending queue, waiting for a slot */
+    gboolean busy;          /* Its results are being emitted */
+    gboolean removed;       /* Removed while busy, freed afterwards */
+} Query;
+
+struct _GaMultiRecordBrowserPrivate {
+    GaClient *client;
+    GaIfIndex interface;
+    GaLookupFlags flags;
+    guint timeout_ms;
+    GaRequestPriority priority;
+    guint max_concurrent;
+    GHashTable *queries;    /* key -> Query */
+    GQueue pending;         /* Query, in the order added */
+    guint in_flight;
+    gboolean dispose_has_run;
+};
+
+#define GA_MULTI_RECORD_BROWSER_GET_PRIVATE(o) \
+    ((GaMultiRecordBrowserPrivate *)ga_multi_record_browser_get_instance_private(o))
+
+G_DEFINE_TYPE_WITH_PRIVATE(GaMultiRecordBrowser, ga_multi_record_browser, G_TYPE_OBJECT)
+
+static void ga_multi_record_browser_init(GaMultiRecordBrowser *obj) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(obj);
+
+    priv->client = NULL;
+    priv->interface = GA_IF_UNSPEC;
+    priv->max_concurrent = MULTI_DEFAULT_MAX_CONCURRENT;
+    priv->queries = g_hash_table_new(g_str_hash, g_str_equal);
+    g_queue_init(&priv->pending);
+}
+
+static void ga_multi_record_browser_dispose(GObject *object);
+static void ga_multi_record_browser_finalize(GObject *object);
+
+static void ga_multi_record_browser_set_property(GObject *object,
+                                                 guint property_id,
+                                                 const GValue *value,
+                                                 GParamSpec *pspec) {
+    GaMultiRecordBrowser *browser = GA_MULTI_RECORD_BROWSER(object);
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+
+    switch (property_id) {
+        case PROP_IFINDEX:
+            priv->interface = g_value_get_int(value);
+            break;
+        case PROP_FLAGS:
+            priv->flags = g_value_get_flags(value);
+            break;
+        case PROP_TIMEOUT_MS:
+            priv->timeout_ms = g_value_get_uint(value);
+            break;
+        case PROP_PRIORITY:
+            priv->priority = g_value_get_enum(value);
+            break;
+        case PROP_MAX_CONCURRENT:
+            priv->max_concurrent = g_value_get_uint(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void ga_multi_record_browser_get_property(GObject *object,
+                                                 guint property_id,
+                                                 GValue *value,
+                                                 GParamSpec *pspec) {
+    GaMultiRecordBrowser *browser = GA_MULTI_RECORD_BROWSER(object);
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+
+    switch (property_id) {
+        case PROP_IFINDEX:
+            g_value_set_int(value, priv->interface);
+            break;
+        case PROP_FLAGS:
+            g_value_set_flags(value, priv->flags);
+            break;
+        case PROP_TIMEOUT_MS:
+            g_value_set_uint(value, priv->timeout_ms);
+            break;
+        case PROP_PRIORITY:
+            g_value_set_enum(value, priv->priority);
+            break;
+        case PROP_MAX_CONCURRENT:
+            g_value_set_uint(value, priv->max_concurrent);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void ga_multi_record_browser_class_init(GaMultiRecordBrowserClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GParamSpec *param_spec;
+
+    object_class->dispose = ga_multi_record_browser_dispose;
+    object_class->finalize = ga_multi_record_browser_finalize;
+    object_class->set_property = ga_multi_record_browser_set_property;
+    object_class->get_property = ga_multi_record_browser_get_property;
+
+    /* Name, class and type are those of the key the record answers */
+    signals[NEW_RECORD] =
+        g_signal_new("new-record",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 5,
+                     G_TYPE_STRING,        /* name */
+                     G_TYPE_UINT,          /* class */
+                     G_TYPE_UINT,          /* type */
+                     G_TYPE_INT,           /* interface */
+                     G_TYPE_BYTES | G_SIGNAL_TYPE_STATIC_SCOPE);
+
+    /* As in GaRecordBrowser, only decoded while a handler is connected */
+    signals[NEW_RECORD_PARSED] =
+        g_signal_new("new-record-parsed",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 2,
+                     G_TYPE_STRING,        /* name of the key */
+                     GA_TYPE_RECORD | G_SIGNAL_TYPE_STATIC_SCOPE);
+
+    /* After the records of a key's reply */
+    signals[QUERY_DONE] =
+        g_signal_new("query-done",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 3,
+                     G_TYPE_STRING,
+                     G_TYPE_UINT,
+                     G_TYPE_UINT);
+
+    signals[QUERY_FAILURE] =
+        g_signal_new("query-failure",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 4,
+                     G_TYPE_STRING,
+                     G_TYPE_UINT,
+                     G_TYPE_UINT,
+                     G_TYPE_POINTER);      /* GError */
+
+    /* No query is queued or in flight any more */
+    signals[ALL_FOR_NOW] =
+        g_signal_new("all-for-now",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__VOID,
+                     G_TYPE_NONE, 0);
+
+    param_spec = g_param_spec_int("interface", "Interface index",
+                                  "Interface to query on",
+                                  G_MININT, G_MAXINT,
+                                  GA_IF_UNSPEC,
+                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_IFINDEX, param_spec);
+
+    param_spec = g_param_spec_flags("flags", "Lookup flags",
+                                    "Browser lookup flags",
+                                    GA_TYPE_LOOKUP_FLAGS,
+                                    GA_LOOKUP_NO_FLAGS,
+                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
+
+    param_spec = g_param_spec_uint("timeout-ms", "Timeout",
+                                   "Deadline of each query in milliseconds, 0 for the default",
+                                   0, G_MAXUINT,
+                                   0,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_TIMEOUT_MS, param_spec);
+
+    param_spec = g_param_spec_enum("priority", "Priority",
+                                   "Scheduling class of the browser's requests",
+                                   GA_TYPE_REQUEST_PRIORITY,
+                                   GA_REQUEST_PRIORITY_INTERACTIVE,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PRIORITY, param_spec);
+
+    /* The rest wait in the order they were added */
+    param_spec = g_param_spec_uint("max-concurrent", "Maximum concurrent queries",
+                                   "Queries of this browser in flight at a time",
+                                   1, 256,
+                                   MULTI_DEFAULT_MAX_CONCURRENT,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_MAX_CONCURRENT, param_spec);
+}
+
+static gchar *query_key(const gchar *name, guint16 clazz, guint16 type) {
+    gchar *lower = g_ascii_strdown(name, -1);
+    gchar *key = g_strdup_printf("%u:%u:%s", clazz, type, lower);
+
+    g_free(lower);
+    return key;
+}
+
+static void query_free(Query *query) {
+    g_free(query->key);
+    g_free(query->name);
+    g_free(query);
+}
+
+/* Forget a query already taken out of the table */
+static void query_drop(Query *query) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(query->browser);
+
+    if (query->call) {
+        ga_varlink_call_cancel(query->call);
+        query->call = NULL;
+        priv->in_flight--;
+    }
+
+    if (query->link) {
+        g_queue_delete_link(&priv->pending, query->link);
+        query->link = NULL;
+    }
+
+    if (query->busy)
+        query->removed = TRUE;
+    else
+        query_free(query);
+}
+
+static void query_enqueue(Query *query) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(query->browser);
+
+    if (query->call || query->link)
+        return;
+
+    g_queue_push_tail(&priv->pending, query);
+    query->link = priv->pending.tail;
+}
+
+static void query_reply_cb(sd_json_variant *reply,
+                           const GError *error,
+                           gpointer user_data);
+
+/* Start waiting queries while there is room; never emits */
+static void multi_pump(GaMultiRecordBrowser *browser) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+
+    if (!priv->client)
+        return;
+
+    while (priv->in_flight < priv->max_concurrent && !g_queue_is_empty(&priv->pending)) {
+        Query *query = g_queue_pop_head(&priv->pending);
+        sd_json_variant *params;
+        GError *error = NULL;
+
+        query->link = NULL;
+
+        params = ga_record_build_params(priv->interface, query->name, query->clazz,
+                                        query->type, priv->flags, &error);
+        if (!params) {
+            g_warning("GaMultiRecordBrowser: query for '%s' not sent: %s",
+                      query->name, error->message);
+            g_error_free(error);
+            continue;
+        }
+
+        /* All queries share the client's pooled connections; as one
+         * owner they take turns with the other objects' requests */
+        query->call = ga_client_call_full(priv->client, browser, priv->priority,
+                                          "io.systemd.Resolve.ResolveRecord", params,
+                                          priv->timeout_ms, query_reply_cb, query, NULL);
+        sd_json_variant_unref(params);
+        priv->in_flight++;
+    }
+}
+
+static void query_emit_records(Query *query, sd_json_variant *rrs) {
+    GaMultiRecordBrowser *browser = query->browser;
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+    size_t n = sd_json_variant_elements(rrs);
+
+    for (size_t i = 0; i < n && !query->removed && !priv->dispose_has_run; i++) {
+        sd_json_variant *rr = sd_json_variant_by_index(rrs, i);
+        GaIfIndex interface;
+        guint32 ttl;
+        GBytes *rdata;
+
+        if (!rr || !sd_json_variant_is_object(rr))
+            continue;
+        if (!(rdata = ga_record_rr_parse(rr, priv->interface, &interface, &ttl)))
+            continue;
+
+        g_signal_emit(browser, signals[NEW_RECORD], 0,
+                      query->name,
+                      (guint)query->clazz,
+                      (guint)query->type,
+                      interface,
+                      rdata);
+        g_bytes_unref(rdata);
+
+        if (query->removed || priv->dispose_has_run)
+            break;
+
+        if (g_signal_has_handler_pending(browser, signals[NEW_RECORD_PARSED], 0, TRUE)) {
+            GaRecord *record = ga_record_decode(rr, interface, ttl);
+
+            if (record) {
+                g_signal_emit(browser, signals[NEW_RECORD_PARSED], 0, query->name, record);
+                ga_record_unref(record);
+            }
+        }
+    }
+}
+
+static void query_reply_cb(sd_json_variant *reply,
+                           const GError *error,
+                           gpointer user_data) {
+    Query *query = user_data;
+    GaMultiRecordBrowser *browser = g_object_ref(query->browser);
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+
+    query->call = NULL;
+    priv->in_flight--;
+
+    /* Handlers may remove the key, or drop the browser */
+    query->busy = TRUE;
+
+    if (error) {
+        g_debug("GaMultiRecordBrowser: query for '%s' failed: %s", query->name, error->message);
+        g_signal_emit(browser, signals[QUERY_FAILURE], 0,
+                      query->name, (guint)query->clazz, (guint)query->type, error);
+    } else {
+        sd_json_variant *rrs = sd_json_variant_by_key(reply, "rrs");
+
+        if (rrs && sd_json_variant_is_array(rrs))
+            query_emit_records(query, rrs);
+
+        if (!query->removed && !priv->dispose_has_run)
+            g_signal_emit(browser, signals[QUERY_DONE], 0,
+                          query->name, (guint)query->clazz, (guint)query->type);
+    }
+
+    query->busy = FALSE;
+    if (query->removed)
+        query_free(query);
+
+    if (!priv->dispose_has_run) {
+        multi_pump(browser);
+        if (priv->in_flight == 0 && g_queue_is_empty(&priv->pending))
+            g_signal_emit(browser, signals[ALL_FOR_NOW], 0);
+    }
+
+    g_object_unref(browser);
+}
+
+void ga_multi_record_browser_dispose(GObject *object) {
+    GaMultiRecordBrowser *self = GA_MULTI_RECORD_BROWSER(object);
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(self);
+    GHashTableIter iter;
+    Query *query;
+
+    if (priv->dispose_has_run)
+        return;
+
+    priv->dispose_has_run = TRUE;
+
+    g_hash_table_iter_init(&iter, priv->queries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&query)) {
+        g_hash_table_iter_remove(&iter);
+        query_drop(query);
+    }
+
+    if (priv->client) {
+        g_object_unref(priv->client);
+        priv->client = NULL;
+    }
+
+    if (G_OBJECT_CLASS(ga_multi_record_browser_parent_class)->dispose)
+        G_OBJECT_CLASS(ga_multi_record_browser_parent_class)->dispose(object);
+}
+
+void ga_multi_record_browser_finalize(GObject *object) {
+    GaMultiRecordBrowser *self = GA_MULTI_RECORD_BROWSER(object);
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(self);
+
+    g_hash_table_unref(priv->queries);
+
+    G_OBJECT_CLASS(ga_multi_record_browser_parent_class)->finalize(object);
+}
+
+GaMultiRecordBrowser *ga_multi_record_browser_new(void) {
+    return ga_multi_record_browser_new_full(GA_IF_UNSPEC, GA_LOOKUP_NO_FLAGS);
+}
+
+GaMultiRecordBrowser *ga_multi_record_browser_new_full(GaIfIndex interface,
+                                                       GaLookupFlags flags) {
+    return g_object_new(GA_TYPE_MULTI_RECORD_BROWSER,
+                        "interface", interface,
+                        "flags", flags,
+                        NULL);
+}
+
+gboolean ga_multi_record_browser_add(GaMultiRecordBrowser *browser,
+                                     const gchar *name,
+                                     guint16 clazz,
+                                     guint16 type) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+    Query *query;
+    gchar *key;
+
+    g_return_val_if_fail(IS_GA_MULTI_RECORD_BROWSER(browser), FALSE);
+    g_return_val_if_fail(name != NULL, FALSE);
+
+    if (priv->dispose_has_run)
+        return FALSE;
+
+    key = query_key(name, clazz, type);
+    if (g_hash_table_contains(priv->queries, key)) {
+        g_free(key);
+        return FALSE;
+    }
+
+    query = g_new0(Query, 1);
+    query->browser = browser;
+    query->key = key;
+    query->name = g_strdup(name);
+    query->clazz = clazz;
+    query->type = type;
+    g_hash_table_insert(priv->queries, query->key, query);
+
+    query_enqueue(query);
+    multi_pump(browser);
+
+    return TRUE;
+}
+
+gboolean ga_multi_record_browser_remove(GaMultiRecordBrowser *browser,
+                                        const gchar *name,
+                                        guint16 clazz,
+                                        guint16 type) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+    gchar *key;
+    Query *query;
+
+    g_return_val_if_fail(IS_GA_MULTI_RECORD_BROWSER(browser), FALSE);
+    g_return_val_if_fail(name != NULL, FALSE);
+
+    key = query_key(name, clazz, type);
+    query = g_hash_table_lookup(priv->queries, key);
+    g_free(key);
+
+    if (!query)
+        return FALSE;
+
+    g_hash_table_remove(priv->queries, query->key);
+    query_drop(query);
+
+    /* Its slot, if it had one, goes to the next in line */
+    multi_pump(browser);
+
+    return TRUE;
+}
+
+void ga_multi_record_browser_refresh(GaMultiRecordBrowser *browser) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+    GHashTableIter iter;
+    Query *query;
+
+    g_return_if_fail(IS_GA_MULTI_RECORD_BROWSER(browser));
+
+    /* Queries still queued or in flight are left alone */
+    g_hash_table_iter_init(&iter, priv->queries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&query))
+        query_enqueue(query);
+
+    multi_pump(browser);
+}
+
+gboolean ga_multi_record_browser_attach(GaMultiRecordBrowser *browser,
+                                        GaClient *client,
+                                        G_GNUC_UNUSED GError **error) {
+    GaMultiRecordBrowserPrivate *priv = GA_MULTI_RECORD_BROWSER_GET_PRIVATE(browser);
+
+    g_return_val_if_fail(IS_GA_MULTI_RECORD_BROWSER(browser), FALSE);
+    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+    g_return_val_if_fail(priv->client == NULL, FALSE);
+
+    g_object_ref(client);
+    priv->client = client;
+
+    g_debug("GaMultiRecordBrowser: attached with %u queries",
+            g_hash_table_size(priv->queries));
+
+    /* Keys added so far go out now, at most max-concurrent at a time */
+    multi_pump(browser);
+
+    return TRUE;
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-multi-record-browser.h - Header for GaMultiRecordBrowser (systemd-resolved compatibility) */
+
+#ifndef __GA_MULTI_RECORD_BROWSER_H__
+#define __GA_MULTI_RECORD_BROWSER_H__
+
+#include <glib-object.h>
+#include "ga-client.h"
+#include "ga-enums.h"
+#include "ga-record-browser.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GaMultiRecordBrowser GaMultiRecordBrowser;
+typedef struct _GaMultiRecordBrowserClass GaMultiRecordBrowserClass;
+typedef struct _GaMultiRecordBrowserPrivate GaMultiRecordBrowserPrivate;
+
+struct _GaMultiRecordBrowserClass {
+    GObjectClass parent_class;
+};
+
+struct _GaMultiRecordBrowser {
+    GObject parent;
+    GaMultiRecordBrowserPrivate *priv;
+};
+
+GType ga_multi_record_browser_get_type(void);
+
+/* TYPE MACROS */
+#define GA_TYPE_MULTI_RECORD_BROWSER \
+  (ga_multi_record_browser_get_type())
+#define GA_MULTI_RECORD_BROWSER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GA_TYPE_MULTI_RECORD_BROWSER, GaMultiRecordBrowser))
+#define GA_MULTI_RECORD_BROWSER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GA_TYPE_MULTI_RECORD_BROWSER, GaMultiRecordBrowserClass))
+#define IS_GA_MULTI_RECORD_BROWSER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GA_TYPE_MULTI_RECORD_BROWSER))
+#define IS_GA_MULTI_RECORD_BROWSER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GA_TYPE_MULTI_RECORD_BROWSER))
+#define GA_MULTI_RECORD_BROWSER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GA_TYPE_MULTI_RECORD_BROWSER, GaMultiRecordBrowserClass))
+
+GaMultiRecordBrowser *ga_multi_record_browser_new(void);
+
+GaMultiRecordBrowser *ga_multi_record_browser_new_full(GaIfIndex interface,
+                                                       GaLookupFlags flags);
+
+/*
+ * Queries are keyed by (name, class, type); names compare case-insensitively.
+ * Keys may be added and removed at any time, before or after attaching.
+ * Adding an existing key or removing an unknown one returns FALSE.
+ */
+gboolean ga_multi_record_browser_add(GaMultiRecordBrowser *browser,
+                                     const gchar *name,
+                                     guint16 clazz,
+                                     guint16 type);
+
+gboolean ga_multi_record_browser_remove(GaMultiRecordBrowser *browser,
+                                        const gchar *name,
+                                        guint16 clazz,
+                                        guint16 type);
+
+/* Query every key again, e.g. to poll the set periodically */
+void ga_multi_record_browser_refresh(GaMultiRecordBrowser *browser);
+
+gboolean
+ga_multi_record_browser_attach(GaMultiRecordBrowser *browser,
+                               GaClient *client, GError **error);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_MULTI_RECORD_BROWSER_H__ */
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * ga-record-browser-private.h - ResolveRecord helpers shared with the
+ * other objects (not installed)
+ */
+
+#ifndef __GA_RECORD_BROWSER_PRIVATE_H__
+#define __GA_RECORD_BROWSER_PRIVATE_H__
+
+#include "ga-record-browser.h"
+#include "ga-varlink.h"
+
+G_BEGIN_DECLS
+
+/* Build the ResolveRecord parameters */
+sd_json_variant *ga_record_build_params(GaIfIndex interface,
+                                        const gchar *name,
+                                        guint16 clazz,
+                                        guint16 type,
+                                        GaLookupFlags flags,
+                                        GError **error);
+
+/*
+ * Pull interface, TTL and rdata out of one of a ResolveRecord reply's
+ * "rrs". The interface is @default_interface unless the entry names one.
+ * Returns NULL if the entry carries no rdata.
+ */
+GBytes *ga_record_rr_parse(sd_json_variant *entry,
+                           GaIfIndex default_interface,
+                           GaIfIndex *interface,
+                           guint32 *ttl);
+
+/* Decode one of the "rrs"; NULL for types GaRecord does not cover */
+GaRecord *ga_record_decode(sd_json_variant *entry, GaIfIndex interface, guint32 ttl);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_RECORD_BROWSER_PRIVATE_H__ */
@@ -2,22 +2,36 @@
 
 /* ga-record-browser.c - Source for GaRecordBrowser (systemd-resolved compatibility) */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <systemd/sd-varlink.h>
 
+#include <gio/gio.h>
+
 #include "ga-record-browser.h"
+#include "ga-record-browser-private.h"
+#include "ga-client-private.h"
 #include "ga-error.h"
 
-#define RESOLVED_VARLINK_ADDRESS "/run/systemd/resolve/io.systemd.Resolve"
-
 /* DNS record classes */
 #define DNS_CLASS_IN 1
 
+/* Continuous mode: records re-queried at 80% of their TTL; replies that
+ * carry no TTL count as RECORD_DEFAULT_TTL seconds */
+#define RECORD_REQUERY_PERCENT 80
+#define RECORD_DEFAULT_TTL 120
+#define RECORD_RETRY_MS (10 * 1000)
+
+/* TTLs are capped so that they still fit in 32 bits as milliseconds */
+#define RECORD_MAX_TTL (G_MAXUINT32 / 1000)
+
 /* signal enum */
 enum {
     NEW_RECORD,
+    NEW_RECORD_BYTES,
+    NEW_RECORD_PARSED,
     REMOVED_RECORD,
     CACHE_EXHAUSTED,
     ALL_FOR_NOW,
@@ -34,20 +48,40 @@ enum {
     PROP_NAME,
     PROP_CLASS,
     PROP_TYPE,
-    PROP_FLAGS
+    PROP_FLAGS,
+    PROP_TIMEOUT_MS,
+    PROP_CANCELLABLE,
+    PROP_PRIORITY,
+    PROP_CONTINUOUS
 };
 
+/* A record held by a continuous browser until its TTL lapses */
+typedef struct {
+    GaRecordBrowser *browser;
+    GaIfIndex interface;
+    GBytes *rdata;
+    GaTimerWheelEntry *expiry;
+    guint generation;       /* Of the last reply that carried it */
+} StoredRecord;
+
 struct _GaRecordBrowserPrivate {
     GaClient *client;
-    sd_varlink *link;
-    int varlink_fd;
-    GSource *varlink_source;
+    GaVarlinkCall *call;    /* ResolveRecord in flight */
+    guint timeout_ms;
+    GaRequestPriority priority;
+    GCancellable *cancellable;
+    GSource *cancel_source;
     GaIfIndex interface;
     GaProtocol protocol;
     char *name;
     guint16 clazz;
     guint16 type;
     GaLookupFlags flags;
+    gboolean continuous;
+    GHashTable *records;    /* StoredRecord set */
+    GaTimerWheelEntry *requery;
+    guint generation;
+    gboolean all_for_now_sent;
     gboolean dispose_has_run;
 };
 
@@ -60,14 +94,15 @@ static void ga_record_browser_init(GaRecordBrowser *obj) {
     GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(obj);
 
     priv->client = NULL;
-    priv->link = NULL;
-    priv->varlink_fd = -1;
-    priv->varlink_source = NULL;
+    priv->call = NULL;
+    priv->cancellable = NULL;
+    priv->cancel_source = NULL;
     priv->name = NULL;
     priv->clazz = DNS_CLASS_IN;
     priv->type = 0;
     priv->interface = GA_IF_UNSPEC;
     priv->protocol = GA_PROTOCOL_UNSPEC;
+    priv->records = NULL;
 }
 
 static void ga_record_browser_dispose(GObject *object);
@@ -100,6 +135,20 @@ static void ga_record_browser_set_property(GObject *object,
         case PROP_FLAGS:
             priv->flags = g_value_get_flags(value);
             break;
+        case PROP_TIMEOUT_MS:
+            priv->timeout_ms = g_value_get_uint(value);
+            break;
+        case PROP_CANCELLABLE:
+            if (priv->cancellable)
+                g_object_unref(priv->cancellable);
+            priv->cancellable = g_value_dup_object(value);
+            break;
+        case PROP_PRIORITY:
+            priv->priority = g_value_get_enum(value);
+            break;
+        case PROP_CONTINUOUS:
+            priv->continuous = g_value_get_boolean(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -132,6 +181,18 @@ static void ga_record_browser_get_property(GObject *object,
         case PROP_FLAGS:
             g_value_set_flags(value, priv->flags);
             break;
+        case PROP_TIMEOUT_MS:
+            g_value_set_uint(value, priv->timeout_ms);
+            break;
+        case PROP_CANCELLABLE:
+            g_value_set_object(value, priv->cancellable);
+            break;
+        case PROP_PRIORITY:
+            g_value_set_enum(value, priv->priority);
+            break;
+        case PROP_CONTINUOUS:
+            g_value_set_boolean(value, priv->continuous);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -163,6 +224,33 @@ static void ga_record_browser_class_init(GaRecordBrowserClass *klass) {
                      G_TYPE_POINTER,       /* rdata */
                      G_TYPE_UINT);         /* size */
 
+    /* Like new-record, with the rdata as a GBytes; take a reference to keep it */
+    signals[NEW_RECORD_BYTES] =
+        g_signal_new("new-record-bytes",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 6,
+                     G_TYPE_INT,
+                     GA_TYPE_PROTOCOL,
+                     G_TYPE_STRING,
+                     G_TYPE_UINT,
+                     G_TYPE_UINT,
+                     G_TYPE_BYTES | G_SIGNAL_TYPE_STATIC_SCOPE);
+
+    /* Records of the common types, decoded; others are not emitted */
+    signals[NEW_RECORD_PARSED] =
+        g_signal_new("new-record-parsed",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 1,
+                     GA_TYPE_RECORD | G_SIGNAL_TYPE_STATIC_SCOPE);
+
     signals[REMOVED_RECORD] =
         g_signal_new("removed-record",
                      G_OBJECT_CLASS_TYPE(klass),
@@ -246,23 +334,59 @@ static void ga_record_browser_class_init(GaRecordBrowserClass *klass) {
                                     GA_LOOKUP_NO_FLAGS,
                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
     g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
+
+    param_spec = g_param_spec_uint("timeout-ms", "Timeout",
+                                   "Deadline of the query in milliseconds, 0 for the default",
+                                   0, G_MAXUINT,
+                                   0,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_TIMEOUT_MS, param_spec);
+
+    /* Cancelling stops the browser without emitting any further signal */
+    param_spec = g_param_spec_object("cancellable", "Cancellable",
+                                     "Cancellable to abort the query with",
+                                     G_TYPE_CANCELLABLE,
+                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_CANCELLABLE, param_spec);
+
+    param_spec = g_param_spec_enum("priority", "Priority",
+                                   "Scheduling class of the browser's requests",
+                                   GA_TYPE_REQUEST_PRIORITY,
+                                   GA_REQUEST_PRIORITY_INTERACTIVE,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PRIORITY, param_spec);
+
+    /* Keep the records, re-query them before their TTL runs out and emit
+     * removed-record for those that lapse */
+    param_spec = g_param_spec_boolean("continuous", "Continuous",
+                                      "Follow the records instead of querying once",
+                                      FALSE,
+                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_CONTINUOUS, param_spec);
 }
 
-static void disconnect_from_resolved(GaRecordBrowser *browser) {
+/* Stop the query; no signal is emitted afterwards */
+static void record_stop(GaRecordBrowser *browser) {
     GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
 
-    if (priv->varlink_source) {
-        g_source_destroy(priv->varlink_source);
-        g_source_unref(priv->varlink_source);
-        priv->varlink_source = NULL;
+    if (priv->call) {
+        ga_varlink_call_cancel(priv->call);
+        priv->call = NULL;
+    }
+
+    if (priv->cancel_source) {
+        g_source_destroy(priv->cancel_source);
+        g_source_unref(priv->cancel_source);
+        priv->cancel_source = NULL;
     }
 
-    if (priv->link) {
-        sd_varlink_unref(priv->link);
-        priv->link = NULL;
+    if (priv->requery) {
+        ga_timer_wheel_remove(ga_client_get_timer_wheel(priv->client), priv->requery);
+        priv->requery = NULL;
     }
 
-    priv->varlink_fd = -1;
+    if (priv->records)
+        g_hash_table_remove_all(priv->records);
 }
 
 void ga_record_browser_dispose(GObject *object) {
@@ -274,7 +398,12 @@ void ga_record_browser_dispose(GObject *object) {
 
     priv->dispose_has_run = TRUE;
 
-    disconnect_from_resolved(self);
+    record_stop(self);
+
+    if (priv->cancellable) {
+        g_object_unref(priv->cancellable);
+        priv->cancellable = NULL;
+    }
 
     if (priv->client) {
         g_object_unref(priv->client);
@@ -290,6 +419,8 @@ void ga_record_browser_finalize(GObject *object) {
     GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(self);
 
     g_free(priv->name);
+    if (priv->records)
+        g_hash_table_unref(priv->records);
 
     G_OBJECT_CLASS(ga_record_browser_parent_class)->finalize(object);
 }
@@ -315,111 +446,612 @@ GaRecordBrowser *ga_record_browser_new_full(GaIfIndex interface,
                         NULL);
 }
 
-gboolean ga_record_browser_attach(GaRecordBrowser *browser,
-                                  GaClient *client,
-                                  GError **error) {
+static gboolean record_cancelled_cb(G_GNUC_UNUSED GCancellable *cancellable,
+                                    gpointer user_data) {
+    GaRecordBrowser *browser = GA_RECORD_BROWSER(user_data);
     GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
-    int r;
 
-    g_return_val_if_fail(IS_GA_RECORD_BROWSER(browser), FALSE);
-    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+    g_debug("GaRecordBrowser: Query for '%s' cancelled", priv->name);
+    record_stop(browser);
 
-    g_object_ref(client);
-    priv->client = client;
+    return G_SOURCE_REMOVE;
+}
 
-    /* Connect to systemd-resolved */
-    r = sd_varlink_connect_address(&priv->link, RESOLVED_VARLINK_ADDRESS);
-    if (r < 0) {
-        if (error) {
-            *error = g_error_new(GA_ERROR, GA_ERROR_NO_DAEMON,
-                                 "Failed to connect to systemd-resolved: %s",
-                                 g_strerror(-r));
+/*
+ * Continuous mode.
+ *
+ * Every record carries an expiry timer on the client's timer wheel, set
+ * to its TTL each time a reply confirms it. The whole set is re-queried
+ * at RECORD_REQUERY_PERCENT of the shortest TTL; resolved answers from
+ * its cache while that is still valid. A record missing from a reply,
+ * or whose timer runs out, is reported with removed-record.
+ */
+
+static guint stored_record_hash(gconstpointer key) {
+    const StoredRecord *record = key;
+    return g_bytes_hash(record->rdata) ^ (guint)record->interface;
+}
+
+static gboolean stored_record_equal(gconstpointer a, gconstpointer b) {
+    const StoredRecord *x = a;
+    const StoredRecord *y = b;
+    return x->interface == y->interface && g_bytes_equal(x->rdata, y->rdata);
+}
+
+static void stored_record_free(StoredRecord *record) {
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(record->browser);
+
+    if (record->expiry)
+        ga_timer_wheel_remove(ga_client_get_timer_wheel(priv->client), record->expiry);
+    g_bytes_unref(record->rdata);
+    g_free(record);
+}
+
+/*
+ * Typed records.
+ *
+ * A GaRecord and everything it points to share one allocation: the
+ * RecordBlock, the TXT list nodes back to back, then the strings. It is
+ * decoded from the "rr" object of a reply, so the common types need no
+ * wire parsing at all.
+ */
+
+typedef struct {
+    gint ref_count;
+    GaRecord record;
+} RecordBlock;
+
+#define RECORD_ALIGN(n) (((n) + sizeof(gpointer) - 1) & ~(sizeof(gpointer) - 1))
+
+#define RECORD_BLOCK(r) ((RecordBlock *)((guint8 *)(r) - offsetof(RecordBlock, record)))
+
+GaRecord *ga_record_ref(GaRecord *record) {
+    g_return_val_if_fail(record != NULL, NULL);
+
+    g_atomic_int_inc(&RECORD_BLOCK(record)->ref_count);
+    return record;
+}
+
+void ga_record_unref(GaRecord *record) {
+    if (record && g_atomic_int_dec_and_test(&RECORD_BLOCK(record)->ref_count))
+        g_free(RECORD_BLOCK(record));
+}
+
+G_DEFINE_BOXED_TYPE(GaRecord, ga_record, ga_record_ref, ga_record_unref)
+
+/* Decode a JSON byte array into @out, at most @max bytes; -1 if it is not one */
+static gssize json_bytes(sd_json_variant *v, guint8 *out, gsize max) {
+    if (!v || !sd_json_variant_is_array(v) || sd_json_variant_elements(v) > max)
+        return -1;
+
+    size_t n = sd_json_variant_elements(v);
+    for (size_t i = 0; i < n; i++) {
+        sd_json_variant *b = sd_json_variant_by_index(v, i);
+        out[i] = (b && sd_json_variant_is_unsigned(b)) ? (guint8)sd_json_variant_unsigned(b) : 0;
+    }
+
+    return (gssize)n;
+}
+
+/*
+ * A TXT item is a string with octal escapes (\ooo) for anything not
+ * printable, or a byte array. Returns its length; with @out NULL it is
+ * only measured.
+ */
+static gsize txt_item_decode(sd_json_variant *item, guint8 *out) {
+    gsize n = 0;
+
+    if (sd_json_variant_is_string(item)) {
+        const char *s = sd_json_variant_string(item);
+
+        while (*s) {
+            guint8 c = (guint8)*s++;
+
+            if (c == '\\' && s[0] >= '0' && s[0] <= '3' &&
+                s[1] >= '0' && s[1] <= '7' && s[2] >= '0' && s[2] <= '7') {
+                c = (guint8)((s[0] - '0') << 6 | (s[1] - '0') << 3 | (s[2] - '0'));
+                s += 3;
+            }
+            if (out)
+                out[n] = c;
+            n++;
+        }
+    } else if (sd_json_variant_is_array(item)) {
+        size_t len = sd_json_variant_elements(item);
+
+        for (size_t i = 0; i < len; i++) {
+            sd_json_variant *b = sd_json_variant_by_index(item, i);
+            if (out)
+                out[n] = (b && sd_json_variant_is_unsigned(b)) ? (guint8)sd_json_variant_unsigned(b) : 0;
+            n++;
         }
-        return FALSE;
     }
 
-    /* Use ResolveRecord for DNS record browsing.
-     * Note: systemd-resolved doesn't have a streaming record browser like Avahi,
-     * so we do a one-shot query and emit results.
-     * GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
-     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics). */
-    sd_json_variant *params = NULL;
-    sd_json_variant *reply = NULL;
-    const char *error_id = NULL;
+    return n;
+}
 
-    int ifindex = priv->interface;
+GaRecord *ga_record_decode(sd_json_variant *entry, GaIfIndex interface, guint32 ttl) {
+    sd_json_variant *rr = sd_json_variant_by_key(entry, "rr");
+    sd_json_variant *key, *v, *items = NULL;
+    const char *name = "";
+    const char *target = NULL;
+    gint64 type = -1, clazz = DNS_CLASS_IN;
+    GaAddress address = { 0 };
+    gsize txt_size = 0;
 
-    r = sd_json_buildo(&params,
-                       SD_JSON_BUILD_PAIR_INTEGER("ifindex", ifindex),
-                       SD_JSON_BUILD_PAIR_STRING("name", priv->name),
-                       SD_JSON_BUILD_PAIR_INTEGER("class", priv->clazz),
-                       SD_JSON_BUILD_PAIR_INTEGER("type", priv->type),
-                       SD_JSON_BUILD_PAIR_UNSIGNED("flags", 0));
-    if (r < 0) {
-        if (error) {
-            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
-                                 "Failed to build params: %s",
-                                 g_strerror(-r));
+    if (!rr || !sd_json_variant_is_object(rr))
+        return NULL;
+    key = sd_json_variant_by_key(rr, "key");
+    if (!key || !sd_json_variant_is_object(key))
+        return NULL;
+
+    v = sd_json_variant_by_key(key, "type");
+    if (v && sd_json_variant_is_integer(v))
+        type = sd_json_variant_integer(v);
+    v = sd_json_variant_by_key(key, "class");
+    if (v && sd_json_variant_is_integer(v))
+        clazz = sd_json_variant_integer(v);
+    v = sd_json_variant_by_key(key, "name");
+    if (v && sd_json_variant_is_string(v))
+        name = sd_json_variant_string(v);
+
+    switch (type) {
+        case GA_DNS_TYPE_A:
+        case GA_DNS_TYPE_AAAA:
+            if (json_bytes(sd_json_variant_by_key(rr, "address"), address.data.data,
+                           type == GA_DNS_TYPE_A ? 4 : 16) != (type == GA_DNS_TYPE_A ? 4 : 16))
+                return NULL;
+            address.proto = type == GA_DNS_TYPE_A ? GA_PROTOCOL_INET : GA_PROTOCOL_INET6;
+            break;
+        case GA_DNS_TYPE_SRV:
+        case GA_DNS_TYPE_PTR:
+        case GA_DNS_TYPE_CNAME:
+            v = sd_json_variant_by_key(rr, "name");
+            if (!v || !sd_json_variant_is_string(v))
+                return NULL;
+            target = sd_json_variant_string(v);
+            break;
+        case GA_DNS_TYPE_TXT:
+            items = sd_json_variant_by_key(rr, "items");
+            if (items && !sd_json_variant_is_array(items))
+                return NULL;
+            for (size_t i = 0; items && i < sd_json_variant_elements(items); i++)
+                txt_size += RECORD_ALIGN(offsetof(GaStringList, text) +
+                                         txt_item_decode(sd_json_variant_by_index(items, i), NULL) + 1);
+            break;
+        default:
+            return NULL;
+    }
+
+    gsize name_len = strlen(name) + 1;
+    gsize target_len = target ? strlen(target) + 1 : 0;
+    RecordBlock *block = g_malloc0(RECORD_ALIGN(sizeof(RecordBlock)) + txt_size + name_len + target_len);
+    guint8 *p = (guint8 *)block + RECORD_ALIGN(sizeof(RecordBlock));
+    GaRecord *record = &block->record;
+
+    block->ref_count = 1;
+    record->interface = interface;
+    record->clazz = (guint16)clazz;
+    record->type = (guint16)type;
+    record->ttl = ttl;
+
+    if (items) {
+        GaStringList **tail = &record->data.txt;
+
+        for (size_t i = 0; i < sd_json_variant_elements(items); i++) {
+            GaStringList *node = (GaStringList *)p;
+
+            node->size = txt_item_decode(sd_json_variant_by_index(items, i), node->text);
+            node->text[node->size] = 0;
+            *tail = node;
+            tail = &node->next;
+            p += RECORD_ALIGN(offsetof(GaStringList, text) + node->size + 1);
         }
-        disconnect_from_resolved(browser);
-        return FALSE;
     }
 
-    r = sd_varlink_call(priv->link,
-                        "io.systemd.Resolve.ResolveRecord",
-                        params,
-                        &reply,
-                        &error_id);
-    sd_json_variant_unref(params);
+    record->name = memcpy(p, name, name_len);
+    p += name_len;
 
-    if (r < 0 || error_id) {
-        if (error) {
-            *error = g_error_new(GA_ERROR, GA_ERROR_NOT_FOUND,
-                                 "ResolveRecord failed: %s",
-                                 error_id ? error_id : g_strerror(-r));
+    if (type == GA_DNS_TYPE_A || type == GA_DNS_TYPE_AAAA) {
+        record->data.address = address;
+    } else if (type == GA_DNS_TYPE_SRV) {
+        v = sd_json_variant_by_key(rr, "priority");
+        record->data.srv.priority = v && sd_json_variant_is_unsigned(v) ? (guint16)sd_json_variant_unsigned(v) : 0;
+        v = sd_json_variant_by_key(rr, "weight");
+        record->data.srv.weight = v && sd_json_variant_is_unsigned(v) ? (guint16)sd_json_variant_unsigned(v) : 0;
+        v = sd_json_variant_by_key(rr, "port");
+        record->data.srv.port = v && sd_json_variant_is_unsigned(v) ? (guint16)sd_json_variant_unsigned(v) : 0;
+        record->data.srv.target = memcpy(p, target, target_len);
+    } else if (target) {
+        record->data.target = memcpy(p, target, target_len);
+    }
+
+    return record;
+}
+
+/* @entry and @ttl are only used for new records */
+static void emit_record(GaRecordBrowser *browser,
+                        guint signal_id,
+                        GaIfIndex interface,
+                        GBytes *rdata,
+                        sd_json_variant *entry,
+                        guint32 ttl) {
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+    gsize size;
+    gconstpointer data = g_bytes_get_data(rdata, &size);
+
+    if (signal_id == NEW_RECORD) {
+        g_signal_emit(browser, signals[NEW_RECORD_BYTES], 0,
+                      interface,
+                      priv->protocol,
+                      priv->name,
+                      (guint)priv->clazz,
+                      (guint)priv->type,
+                      rdata);
+        if (priv->dispose_has_run)
+            return;
+
+        /* Only decoded for those who listen */
+        if (entry && g_signal_has_handler_pending(browser, signals[NEW_RECORD_PARSED], 0, TRUE)) {
+            GaRecord *record = ga_record_decode(entry, interface, ttl);
+
+            if (record) {
+                g_signal_emit(browser, signals[NEW_RECORD_PARSED], 0, record);
+                ga_record_unref(record);
+                if (priv->dispose_has_run)
+                    return;
+            }
         }
-        disconnect_from_resolved(browser);
-        return FALSE;
     }
 
+    g_signal_emit(browser, signals[signal_id], 0,
+                  interface,
+                  priv->protocol,
+                  priv->name,
+                  (guint)priv->clazz,
+                  (guint)priv->type,
+                  data,
+                  (guint)size);
+}
+
+/*
+ * "raw" is the base64 wire form of the whole RR (RFC 1035 4.1.3). The
+ * rdata is handed out as a slice of the decoded buffer.
+ */
+static GBytes *rr_raw_rdata(const char *raw, guint32 *ttl) {
+    gsize len;
+    guchar *wire = g_base64_decode(raw, &len);
+    GBytes *buffer = g_bytes_new_take(wire, len);
+    GBytes *rdata = NULL;
+    gsize off = 0;
+
+    /* Owner name: labels up to the root, or a compression pointer */
+    while (off < len && wire[off] != 0) {
+        if ((wire[off] & 0xc0) == 0xc0) {
+            off++;
+            break;
+        }
+        off += 1 + wire[off];
+    }
+    off++;
+
+    /* TYPE, CLASS, TTL, RDLENGTH */
+    if (off + 10 <= len) {
+        guint16 rdlength = (guint16)(wire[off + 8] << 8 | wire[off + 9]);
+
+        *ttl = (guint32)wire[off + 4] << 24 | (guint32)wire[off + 5] << 16 |
+               (guint32)wire[off + 6] << 8 | (guint32)wire[off + 7];
+        *ttl = MIN(*ttl, RECORD_MAX_TTL);
+        off += 10;
+        if (off + rdlength <= len)
+            rdata = g_bytes_new_from_bytes(buffer, off, rdlength);
+    }
+
+    g_bytes_unref(buffer);
+    return rdata;
+}
+
+/* Pull interface, TTL and rdata out of one of the reply's "rrs" */
+GBytes *ga_record_rr_parse(sd_json_variant *entry,
+                           GaIfIndex default_interface,
+                           GaIfIndex *interface,
+                           guint32 *ttl) {
+    sd_json_variant *rr = sd_json_variant_by_key(entry, "rr");
+    sd_json_variant *v;
+
+    *interface = default_interface;
+    v = sd_json_variant_by_key(entry, "ifindex");
+    if (v && sd_json_variant_is_integer(v) && sd_json_variant_integer(v) > 0)
+        *interface = (GaIfIndex)sd_json_variant_integer(v);
+
+    *ttl = RECORD_DEFAULT_TTL;
+    v = rr && sd_json_variant_is_object(rr) ? sd_json_variant_by_key(rr, "ttl") : NULL;
+    if (!v)
+        v = sd_json_variant_by_key(entry, "ttl");
+    if (v && sd_json_variant_is_unsigned(v))
+        *ttl = (guint32)MIN(sd_json_variant_unsigned(v), RECORD_MAX_TTL);
+
+    v = sd_json_variant_by_key(entry, "raw");
+    if (v && sd_json_variant_is_string(v)) {
+        GBytes *rdata = rr_raw_rdata(sd_json_variant_string(v), ttl);
+        if (rdata)
+            return rdata;
+    }
+
+    /* Fall back to a plain byte array */
+    sd_json_variant *rdata_v = sd_json_variant_by_key(entry, "rdata");
+    if (!rdata_v || !sd_json_variant_is_array(rdata_v))
+        return NULL;
+
+    /* Convert rdata array to bytes */
+    size_t rdata_len = sd_json_variant_elements(rdata_v);
+    guint8 *rdata = g_malloc(rdata_len);
+    for (size_t j = 0; j < rdata_len; j++) {
+        sd_json_variant *b = sd_json_variant_by_index(rdata_v, j);
+        rdata[j] = (b && sd_json_variant_is_unsigned(b)) ? (guint8)sd_json_variant_unsigned(b) : 0;
+    }
+
+    return g_bytes_new_take(rdata, rdata_len);
+}
+
+static void record_expired_cb(gpointer user_data) {
+    StoredRecord *record = user_data;
+    GaRecordBrowser *browser = g_object_ref(record->browser);
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+    GaIfIndex interface = record->interface;
+    GBytes *rdata = g_bytes_ref(record->rdata);
+
+    g_debug("GaRecordBrowser: record of '%s' expired", priv->name);
+
+    record->expiry = NULL;
+    g_hash_table_remove(priv->records, record);
+    emit_record(browser, REMOVED_RECORD, interface, rdata, NULL, 0);
+
+    g_bytes_unref(rdata);
+    g_object_unref(browser);
+}
+
+static gboolean record_query(GaRecordBrowser *browser, GError **error);
+
+static void record_requery_cb(gpointer user_data) {
+    GaRecordBrowser *browser = GA_RECORD_BROWSER(user_data);
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+    GError *error = NULL;
+
+    priv->requery = NULL;
+
+    if (!record_query(browser, &error)) {
+        g_debug("GaRecordBrowser: re-query of '%s' failed: %s", priv->name, error->message);
+        g_error_free(error);
+        priv->requery = ga_timer_wheel_add(ga_client_get_timer_wheel(priv->client),
+                                           RECORD_RETRY_MS, record_requery_cb, browser);
+    }
+}
+
+/* Take in the records of a reply; returns the shortest TTL seen */
+static guint32 record_store_update(GaRecordBrowser *browser, sd_json_variant *rrs) {
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+    GaTimerWheel *wheel = ga_client_get_timer_wheel(priv->client);
+    guint32 min_ttl = RECORD_DEFAULT_TTL;
+    gboolean have_ttl = FALSE;
+    size_t n = sd_json_variant_elements(rrs);
+
+    priv->generation++;
+
+    for (size_t i = 0; i < n && !priv->dispose_has_run; i++) {
+        sd_json_variant *rr = sd_json_variant_by_index(rrs, i);
+        GaIfIndex interface;
+        guint32 ttl;
+        GBytes *rdata;
+
+        if (!rr || !sd_json_variant_is_object(rr))
+            continue;
+        if (!(rdata = ga_record_rr_parse(rr, priv->interface, &interface, &ttl)))
+            continue;
+
+        StoredRecord key = { .interface = interface, .rdata = rdata };
+        StoredRecord *record = g_hash_table_lookup(priv->records, &key);
+        gboolean added = !record;
+
+        if (added) {
+            record = g_new0(StoredRecord, 1);
+            record->browser = browser;
+            record->interface = interface;
+            record->rdata = g_bytes_ref(rdata);
+            g_hash_table_add(priv->records, record);
+        }
+
+        record->generation = priv->generation;
+        if (record->expiry)
+            ga_timer_wheel_remove(wheel, record->expiry);
+        record->expiry = ga_timer_wheel_add(wheel, MAX(ttl, 1) * 1000,
+                                            record_expired_cb, record);
+
+        min_ttl = have_ttl ? MIN(min_ttl, ttl) : ttl;
+        have_ttl = TRUE;
+
+        if (added)
+            emit_record(browser, NEW_RECORD, interface, rdata, rr, ttl);
+        g_bytes_unref(rdata);
+    }
+
+    /* Records the reply no longer carries are gone */
+    GPtrArray *gone = g_ptr_array_new_with_free_func((GDestroyNotify)stored_record_free);
+    GHashTableIter iter;
+    StoredRecord *record;
+
+    if (!priv->dispose_has_run) {
+        g_hash_table_iter_init(&iter, priv->records);
+        while (g_hash_table_iter_next(&iter, (gpointer *)&record, NULL)) {
+            if (record->generation == priv->generation)
+                continue;
+            g_hash_table_iter_steal(&iter);
+            ga_timer_wheel_remove(wheel, record->expiry);
+            record->expiry = NULL;
+            g_ptr_array_add(gone, record);
+        }
+    }
+
+    for (guint i = 0; i < gone->len && !priv->dispose_has_run; i++) {
+        record = g_ptr_array_index(gone, i);
+        emit_record(browser, REMOVED_RECORD, record->interface, record->rdata, NULL, 0);
+    }
+    g_ptr_array_unref(gone);
+
+    return min_ttl;
+}
+
+static void record_reply_cb(sd_json_variant *reply,
+                            const GError *error,
+                            gpointer user_data) {
+    GaRecordBrowser *browser = GA_RECORD_BROWSER(user_data);
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+    guint requery_ms = RECORD_RETRY_MS;
+
+    priv->call = NULL;
+
+    if (error && priv->continuous && priv->all_for_now_sent) {
+        /* Known records lapse on their own if resolved stays unhappy */
+        g_debug("GaRecordBrowser: re-query of '%s' failed: %s", priv->name, error->message);
+        priv->requery = ga_timer_wheel_add(ga_client_get_timer_wheel(priv->client),
+                                           requery_ms, record_requery_cb, browser);
+        return;
+    }
+
+    if (!priv->continuous || error)
+        record_stop(browser);
+
+    if (error) {
+        g_signal_emit(browser, signals[FAILURE], 0, error);
+        return;
+    }
+
+    /* Handlers may drop the last reference */
+    g_object_ref(browser);
+
     /* Parse and emit record results */
     sd_json_variant *rrs = sd_json_variant_by_key(reply, "rrs");
-    if (rrs && sd_json_variant_is_array(rrs)) {
+    if (priv->continuous) {
+        guint32 ttl = RECORD_DEFAULT_TTL;
+
+        if (rrs && sd_json_variant_is_array(rrs))
+            ttl = record_store_update(browser, rrs);
+        requery_ms = (guint)CLAMP((guint64)ttl * 10 * RECORD_REQUERY_PERCENT, 1000, G_MAXUINT);
+    } else if (rrs && sd_json_variant_is_array(rrs)) {
         size_t n = sd_json_variant_elements(rrs);
-        for (size_t i = 0; i < n; i++) {
+        for (size_t i = 0; i < n && !priv->dispose_has_run; i++) {
             sd_json_variant *rr = sd_json_variant_by_index(rrs, i);
+            GaIfIndex interface;
+            guint32 ttl;
+            GBytes *rdata;
+
             if (!rr || !sd_json_variant_is_object(rr))
                 continue;
-
-            sd_json_variant *rdata_v = sd_json_variant_by_key(rr, "rdata");
-            if (!rdata_v || !sd_json_variant_is_array(rdata_v))
+            if (!(rdata = ga_record_rr_parse(rr, priv->interface, &interface, &ttl)))
                 continue;
 
-            /* Convert rdata array to bytes */
-            size_t rdata_len = sd_json_variant_elements(rdata_v);
-            guint8 *rdata = g_malloc(rdata_len);
-            for (size_t j = 0; j < rdata_len; j++) {
-                sd_json_variant *b = sd_json_variant_by_index(rdata_v, j);
-                if (b && sd_json_variant_is_unsigned(b)) {
-                    rdata[j] = (guint8)sd_json_variant_unsigned(b);
-                }
-            }
+            emit_record(browser, NEW_RECORD, interface, rdata, rr, ttl);
+            g_bytes_unref(rdata);
+        }
+    }
 
-            g_signal_emit(browser, signals[NEW_RECORD], 0,
-                          ifindex,
-                          priv->protocol,
-                          priv->name,
-                          (guint)priv->clazz,
-                          (guint)priv->type,
-                          rdata,
-                          (guint)rdata_len);
+    if (!priv->dispose_has_run && priv->continuous)
+        priv->requery = ga_timer_wheel_add(ga_client_get_timer_wheel(priv->client),
+                                           requery_ms, record_requery_cb, browser);
 
-            g_free(rdata);
+    if (!priv->dispose_has_run && !priv->all_for_now_sent) {
+        priv->all_for_now_sent = TRUE;
+        g_signal_emit(browser, signals[ALL_FOR_NOW], 0);
+    }
+
+    g_object_unref(browser);
+}
+
+sd_json_variant *ga_record_build_params(GaIfIndex interface,
+                                        const gchar *name,
+                                        guint16 clazz,
+                                        guint16 type,
+                                        GaLookupFlags flags,
+                                        GError **error) {
+    sd_json_variant *params = NULL;
+    int r;
+
+    /* GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
+     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics). */
+    r = sd_json_buildo(&params,
+                       SD_JSON_BUILD_PAIR_INTEGER("ifindex", interface),
+                       SD_JSON_BUILD_PAIR_STRING("name", name),
+                       SD_JSON_BUILD_PAIR_INTEGER("class", clazz),
+                       SD_JSON_BUILD_PAIR_INTEGER("type", type),
+                       SD_JSON_BUILD_PAIR_UNSIGNED("flags",
+                                                   ga_varlink_lookup_flags(flags & GA_LOOKUP_CACHE_ONLY)));
+    if (r < 0) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to build params: %s",
+                                 g_strerror(-r));
         }
+        return NULL;
     }
 
-    g_signal_emit(browser, signals[ALL_FOR_NOW], 0);
+    return params;
+}
+
+static gboolean record_query(GaRecordBrowser *browser, GError **error) {
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+    sd_json_variant *params;
+
+    params = ga_record_build_params(priv->interface, priv->name, priv->clazz,
+                                    priv->type, priv->flags, error);
+    if (!params)
+        return FALSE;
+
+    /* Results arrive from the main loop; disposing the browser cancels
+     * the call and frees its connection */
+    priv->call = ga_client_call_full(priv->client, browser, priv->priority,
+                                     "io.systemd.Resolve.ResolveRecord", params,
+                                     priv->timeout_ms, record_reply_cb, browser, NULL);
+    sd_json_variant_unref(params);
+
+    return TRUE;
+}
+
+gboolean ga_record_browser_attach(GaRecordBrowser *browser,
+                                  GaClient *client,
+                                  GError **error) {
+    GaRecordBrowserPrivate *priv = GA_RECORD_BROWSER_GET_PRIVATE(browser);
+
+    g_return_val_if_fail(IS_GA_RECORD_BROWSER(browser), FALSE);
+    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+
+    g_object_ref(client);
+    priv->client = client;
+
+    if (priv->cancellable && g_cancellable_is_cancelled(priv->cancellable)) {
+        if (error)
+            *error = g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "Query for '%s' was cancelled", priv->name);
+        return FALSE;
+    }
+
+    if (priv->continuous && !priv->records)
+        priv->records = g_hash_table_new_full(stored_record_hash, stored_record_equal,
+                                              (GDestroyNotify)stored_record_free, NULL);
+
+    /* Use ResolveRecord for DNS record browsing. systemd-resolved has no
+     * streaming record browser like Avahi: without continuous set a single
+     * query is made and its results emitted. */
+    if (!record_query(browser, error))
+        return FALSE;
+
+    /* Cancellation is dispatched from the attaching thread's context */
+    if (priv->cancellable) {
+        priv->cancel_source = g_cancellable_source_new(priv->cancellable);
+        g_source_set_callback(priv->cancel_source,
+                              (GSourceFunc)(void (*)(void))record_cancelled_cb,
+                              browser, NULL);
+        g_source_attach(priv->cancel_source, g_main_context_get_thread_default());
+    }
 
-    disconnect_from_resolved(browser);
     return TRUE;
 }
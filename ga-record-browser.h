@@ -8,6 +8,7 @@
 #include <glib-object.h>
 #include "ga-client.h"
 #include "ga-enums.h"
+#include "ga-service-resolver.h"
 
 G_BEGIN_DECLS
 
@@ -40,6 +41,39 @@ GType ga_record_browser_get_type(void);
 #define GA_RECORD_BROWSER_GET_CLASS(obj) \
   (G_TYPE_INSTANCE_GET_CLASS ((obj), GA_TYPE_RECORD_BROWSER, GaRecordBrowserClass))
 
+/*
+ * A record decoded from resolved's structured form, as emitted by
+ * new-record-parsed. Records are immutable and refcounted; strings and
+ * the TXT list live in the same allocation as the record and must not
+ * be freed or kept beyond it.
+ */
+typedef struct {
+    GaIfIndex interface;
+    guint16 clazz;
+    guint16 type;
+    guint32 ttl;
+    const gchar *name;
+    union {
+        GaAddress address;      /* GA_DNS_TYPE_A, GA_DNS_TYPE_AAAA */
+        struct {
+            guint16 priority;
+            guint16 weight;
+            guint16 port;
+            const gchar *target;
+        } srv;                  /* GA_DNS_TYPE_SRV */
+        const gchar *target;    /* GA_DNS_TYPE_PTR, GA_DNS_TYPE_CNAME */
+        GaStringList *txt;      /* GA_DNS_TYPE_TXT, NULL if empty */
+    } data;
+} GaRecord;
+
+GType ga_record_get_type(void);
+
+#define GA_TYPE_RECORD (ga_record_get_type())
+
+GaRecord *ga_record_ref(GaRecord *record);
+
+void ga_record_unref(GaRecord *record);
+
 GaRecordBrowser *ga_record_browser_new(const gchar * name, guint16 type);
 
 GaRecordBrowser *ga_record_browser_new_full(GaIfIndex interface,
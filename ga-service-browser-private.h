@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * ga-service-browser-private.h - GaServiceBrowser internals shared with the
+ * other objects (not installed)
+ */
+
+#ifndef __GA_SERVICE_BROWSER_PRIVATE_H__
+#define __GA_SERVICE_BROWSER_PRIVATE_H__
+
+#include "ga-service-browser.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Restrict auto-resolve to the service called @name and resolve addresses
+ * of @aprotocol instead of the browse protocol. Call before attaching.
+ */
+void ga_service_browser_set_resolve_target(GaServiceBrowser *browser,
+                                           const gchar *name,
+                                           GaProtocol aprotocol);
+
+/*
+ * Last auto-resolve result of a service, as a ResolveService result
+ * dictionary (see ga-service-resolver-private.h), or NULL. The browser
+ * keeps ownership.
+ */
+GVariant *ga_service_browser_peek_resolve_result(GaServiceBrowser *browser,
+                                                 GaIfIndex interface,
+                                                 const gchar *name,
+                                                 const gchar *type,
+                                                 const gchar *domain);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_SERVICE_BROWSER_PRIVATE_H__ */
@@ -5,12 +5,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ifaddrs.h>
+#include <net/if.h>
 #include <systemd/sd-varlink.h>
 
 #include "ga-service-browser.h"
+#include "ga-service-browser-private.h"
+#include "ga-client-private.h"
+#include "ga-service-resolver-private.h"
 #include "ga-error.h"
 
-#define RESOLVED_VARLINK_ADDRESS "/run/systemd/resolve/io.systemd.Resolve"
+/* How long a fresh subscription gets to report the current snapshot */
+#define BROWSE_RESYNC_WINDOW_MS 1000
 
 /* signal enum */
 enum {
@@ -19,6 +25,7 @@ enum {
     CACHE_EXHAUSTED,
     ALL_FOR_NOW,
     FAILURE,
+    SERVICE_RESOLVED,
     LAST_SIGNAL
 };
 
@@ -30,19 +37,94 @@ enum {
     PROP_IFINDEX,
     PROP_TYPE,
     PROP_DOMAIN,
-    PROP_FLAGS
+    PROP_FLAGS,
+    PROP_HOLD_DOWN_MS,
+    PROP_SUPPRESSED_EVENTS,
+    PROP_AUTO_RESOLVE,
+    PROP_RESOLVE_CONCURRENCY
 };
 
+#define DEFAULT_RESOLVE_CONCURRENCY 4
+
+/* Flap damping: hold-down doubles per flap up to this factor, and the
+ * flap count is forgotten after a quiet period of the maximum hold-down */
+#define FLAP_MAX_SHIFT 6
+
+/* A service seen on one interface, tracked to suppress duplicates and to
+ * find services that disappeared while a subscription was stalled */
+typedef struct {
+    char *name;
+    char *type;
+    char *domain;
+    GaIfIndex interface;
+    guint generation;       /* Subscription generation that last saw it */
+} BrowseEntry;
+
+/* A service across all interfaces it is seen on */
+typedef struct {
+    BrowseEntry key;        /* interface is the first one it was seen on */
+    GArray *interfaces;     /* gint */
+} CollapsedService;
+
+/* Hold-down state of a service whose removal may still be a flap */
+typedef struct {
+    BrowseEntry entry;      /* Copy, as reported to the application */
+    GaServiceBrowser *browser;
+    GSource *timer;         /* Pending removed-service, NULL if none */
+    guint flaps;
+    gint64 last_flap;
+} FlapState;
+
+/* Internal resolve of a reported service (auto-resolve mode) */
+typedef struct {
+    BrowseEntry entry;      /* Copy, as reported in new-service */
+    GaServiceBrowser *browser;
+    GaVarlinkCall *call;
+    GVariant *result;       /* Last result reported, NULL before the first */
+    gboolean queued;
+    gboolean stale;         /* Service changed while the call was in flight */
+} ResolveJob;
+
+/* One BrowseServices subscription on its own varlink connection */
+typedef struct {
+    GaServiceBrowser *browser;
+    sd_varlink *link;
+    GSource *source;
+    int ifindex;
+    gint64 last_activity;   /* Last notification, or subscription start */
+    gboolean dead;          /* Rejected by resolved, reaped on idle */
+} BrowseSubscription;
+
 struct _GaServiceBrowserPrivate {
     GaClient *client;
-    sd_varlink *link;
-    int varlink_fd;
-    GSource *varlink_source;
+    GPtrArray *subscriptions; /* BrowseSubscription, one per link when fanning out */
+    gboolean fanout;
+    GHashTable *rejected_links; /* Links resolved refused to browse on */
     GaIfIndex interface;
     GaProtocol protocol;
     char *type;
     char *domain;
     GaLookupFlags flags;
+    GHashTable *services;   /* BrowseEntry set */
+    GHashTable *collapsed;  /* CollapsedService set, keyed on name/type/domain */
+    guint hold_down_ms;     /* 0 disables flap damping */
+    GHashTable *flaps;      /* FlapState set, created on attach */
+    guint64 suppressed_events;
+    gboolean auto_resolve;
+    guint resolve_concurrency;
+    char *resolve_name;     /* Only resolve this service, if set */
+    GaProtocol resolve_aprotocol;
+    GHashTable *resolves;   /* ResolveJob set, created on attach */
+    GQueue resolve_queue;
+    guint resolves_in_flight;
+    guint generation;
+    guint watchdog_id;
+    gboolean daemon_suspect; /* Last watchdog ping failed */
+    gint64 resubscribed_at; /* Non-zero until the new subscription replied */
+    GSource *resubscribe_source;
+    GSource *reap_source;
+    GSource *resync_source;
+    guint resync_changes;   /* Changes found while resyncing */
     gboolean dispose_has_run;
     gboolean initial_snapshot_done;
 };
@@ -52,26 +134,142 @@ struct _GaServiceBrowserPrivate {
 
 G_DEFINE_TYPE_WITH_PRIVATE(GaServiceBrowser, ga_service_browser, G_TYPE_OBJECT)
 
+static guint browse_entry_hash(gconstpointer key) {
+    const BrowseEntry *e = key;
+
+    return (e->name ? g_str_hash(e->name) : 0) ^
+           (e->type ? g_str_hash(e->type) : 0) * 31 ^
+           (e->domain ? g_str_hash(e->domain) : 0) * 17 ^
+           (guint)e->interface;
+}
+
+static gboolean browse_entry_equal(gconstpointer a, gconstpointer b) {
+    const BrowseEntry *ea = a, *eb = b;
+
+    return ea->interface == eb->interface &&
+           g_strcmp0(ea->name, eb->name) == 0 &&
+           g_strcmp0(ea->type, eb->type) == 0 &&
+           g_strcmp0(ea->domain, eb->domain) == 0;
+}
+
+static void browse_entry_free(gpointer data) {
+    BrowseEntry *e = data;
+
+    g_free(e->name);
+    g_free(e->type);
+    g_free(e->domain);
+    g_free(e);
+}
+
+static guint collapsed_service_hash(gconstpointer key) {
+    const BrowseEntry *e = key;
+
+    return (e->name ? g_str_hash(e->name) : 0) ^
+           (e->type ? g_str_hash(e->type) : 0) * 31 ^
+           (e->domain ? g_str_hash(e->domain) : 0) * 17;
+}
+
+static gboolean collapsed_service_equal(gconstpointer a, gconstpointer b) {
+    const BrowseEntry *ea = a, *eb = b;
+
+    return g_strcmp0(ea->name, eb->name) == 0 &&
+           g_strcmp0(ea->type, eb->type) == 0 &&
+           g_strcmp0(ea->domain, eb->domain) == 0;
+}
+
+static void collapsed_service_free(gpointer data) {
+    CollapsedService *c = data;
+
+    g_free(c->key.name);
+    g_free(c->key.type);
+    g_free(c->key.domain);
+    g_array_unref(c->interfaces);
+    g_free(c);
+}
+
+static void flap_state_free(gpointer data) {
+    FlapState *st = data;
+
+    if (st->timer) {
+        g_source_destroy(st->timer);
+        g_source_unref(st->timer);
+    }
+
+    g_free(st->entry.name);
+    g_free(st->entry.type);
+    g_free(st->entry.domain);
+    g_free(st);
+}
+
+static void resolve_job_free(gpointer data) {
+    ResolveJob *job = data;
+
+    if (job->call)
+        ga_varlink_call_cancel(job->call);
+    if (job->result)
+        g_variant_unref(job->result);
+
+    g_free(job->entry.name);
+    g_free(job->entry.type);
+    g_free(job->entry.domain);
+    g_free(job);
+}
+
+static void subscription_free(gpointer data) {
+    BrowseSubscription *sub = data;
+
+    if (sub->source) {
+        g_source_destroy(sub->source);
+        g_source_unref(sub->source);
+    }
+
+    if (sub->link) {
+        sd_varlink_bind_reply(sub->link, NULL);
+        sd_varlink_set_userdata(sub->link, NULL);
+        sd_varlink_close_unref(sub->link);
+    }
+
+    g_free(sub);
+}
+
 static void ga_service_browser_init(GaServiceBrowser *obj) {
     GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(obj);
 
     priv->client = NULL;
-    priv->link = NULL;
-    priv->varlink_fd = -1;
-    priv->varlink_source = NULL;
+    priv->subscriptions = g_ptr_array_new_with_free_func(subscription_free);
+    priv->fanout = FALSE;
+    priv->rejected_links = g_hash_table_new(NULL, NULL);
     priv->type = NULL;
     priv->domain = NULL;
     priv->interface = GA_IF_UNSPEC;
     priv->protocol = GA_PROTOCOL_UNSPEC;
+    priv->services = g_hash_table_new_full(browse_entry_hash, browse_entry_equal,
+                                           browse_entry_free, NULL);
+    priv->collapsed = g_hash_table_new_full(collapsed_service_hash, collapsed_service_equal,
+                                            collapsed_service_free, NULL);
+    priv->hold_down_ms = 0;
+    priv->flaps = NULL;
+    priv->suppressed_events = 0;
+    priv->auto_resolve = FALSE;
+    priv->resolve_concurrency = DEFAULT_RESOLVE_CONCURRENCY;
+    priv->resolves = NULL;
+    g_queue_init(&priv->resolve_queue);
+    priv->resolves_in_flight = 0;
+    priv->generation = 0;
+    priv->watchdog_id = 0;
+    priv->daemon_suspect = FALSE;
+    priv->resubscribed_at = 0;
+    priv->resubscribe_source = NULL;
+    priv->reap_source = NULL;
+    priv->resync_source = NULL;
+    priv->resync_changes = 0;
     priv->initial_snapshot_done = FALSE;
 }
 
 static void ga_service_browser_dispose(GObject *object);
 static void ga_service_browser_finalize(GObject *object);
 static void disconnect_from_resolved(GaServiceBrowser *browser);
-gboolean ga_service_browser_attach(GaServiceBrowser *browser,
-                                   GaClient *client,
-                                   GError **error);
+static void schedule_resubscribe(GaServiceBrowser *browser);
 
 static void ga_service_browser_set_property(GObject *object,
                                             guint property_id,
@@ -98,6 +296,15 @@ static void ga_service_browser_set_property(GObject *object,
         case PROP_FLAGS:
             priv->flags = g_value_get_flags(value);
             break;
+        case PROP_HOLD_DOWN_MS:
+            priv->hold_down_ms = g_value_get_uint(value);
+            break;
+        case PROP_AUTO_RESOLVE:
+            priv->auto_resolve = g_value_get_boolean(value);
+            break;
+        case PROP_RESOLVE_CONCURRENCY:
+            priv->resolve_concurrency = g_value_get_uint(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -127,6 +334,18 @@ static void ga_service_browser_get_property(GObject *object,
         case PROP_FLAGS:
             g_value_set_flags(value, priv->flags);
             break;
+        case PROP_HOLD_DOWN_MS:
+            g_value_set_uint(value, priv->hold_down_ms);
+            break;
+        case PROP_SUPPRESSED_EVENTS:
+            g_value_set_uint64(value, priv->suppressed_events);
+            break;
+        case PROP_AUTO_RESOLVE:
+            g_value_set_boolean(value, priv->auto_resolve);
+            break;
+        case PROP_RESOLVE_CONCURRENCY:
+            g_value_set_uint(value, priv->resolve_concurrency);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -172,6 +391,25 @@ static void ga_service_browser_class_init(GaServiceBrowserClass *klass) {
                      G_TYPE_STRING,
                      GA_TYPE_LOOKUP_RESULT_FLAGS);
 
+    signals[SERVICE_RESOLVED] =
+        g_signal_new("service-resolved",
+                     G_OBJECT_CLASS_TYPE(klass),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     NULL,
+                     G_TYPE_NONE, 10,
+                     G_TYPE_INT,            /* interface */
+                     GA_TYPE_PROTOCOL,      /* protocol */
+                     G_TYPE_STRING,         /* name */
+                     G_TYPE_STRING,         /* type */
+                     G_TYPE_STRING,         /* domain */
+                     G_TYPE_STRING,         /* host_name */
+                     G_TYPE_POINTER,        /* addresses (GArray of GaAddress) */
+                     G_TYPE_INT,            /* port */
+                     G_TYPE_POINTER,        /* txt (GaStringList*) */
+                     GA_TYPE_LOOKUP_RESULT_FLAGS);
+
     signals[ALL_FOR_NOW] =
         g_signal_new("all-for-now",
                      G_OBJECT_CLASS_TYPE(klass),
@@ -236,22 +474,53 @@ static void ga_service_browser_class_init(GaServiceBrowserClass *klass) {
                                     G_PARAM_READWRITE |
                                     G_PARAM_STATIC_STRINGS);
     g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
+
+    param_spec = g_param_spec_uint("hold-down-ms", "Hold-down time",
+                                   "Milliseconds a removed service is held back "
+                                   "in case it reappears, 0 to disable",
+                                   0, G_MAXUINT, 0,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_HOLD_DOWN_MS, param_spec);
+
+    param_spec = g_param_spec_uint64("suppressed-events", "Suppressed events",
+                                     "Number of new-service/removed-service "
+                                     "signals suppressed by flap damping",
+                                     0, G_MAXUINT64, 0,
+                                     G_PARAM_READABLE |
+                                     G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_SUPPRESSED_EVENTS, param_spec);
+
+    param_spec = g_param_spec_boolean("auto-resolve", "Auto resolve",
+                                      "Resolve discovered services and emit "
+                                      "service-resolved",
+                                      FALSE,
+                                      G_PARAM_READWRITE |
+                                      G_PARAM_CONSTRUCT_ONLY |
+                                      G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_AUTO_RESOLVE, param_spec);
+
+    param_spec = g_param_spec_uint("resolve-concurrency", "Resolve concurrency",
+                                   "Maximum number of resolves in flight",
+                                   1, G_MAXUINT,
+                                   DEFAULT_RESOLVE_CONCURRENCY,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_RESOLVE_CONCURRENCY, param_spec);
 }
 
 static void disconnect_from_resolved(GaServiceBrowser *browser) {
     GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
 
-    if (priv->varlink_source) {
-        g_source_destroy(priv->varlink_source);
-        priv->varlink_source = NULL;
-    }
+    g_ptr_array_set_size(priv->subscriptions, 0);
+}
 
-    if (priv->link) {
-        sd_varlink_unref(priv->link);
-        priv->link = NULL;
+static void clear_source(GSource **source) {
+    if (*source) {
+        g_source_destroy(*source);
+        g_source_unref(*source);
+        *source = NULL;
     }
-
-    priv->varlink_fd = -1;
 }
 
 void ga_service_browser_dispose(GObject *object) {
@@ -264,8 +533,23 @@ void ga_service_browser_dispose(GObject *object) {
     priv->dispose_has_run = TRUE;
 
     disconnect_from_resolved(self);
+    clear_source(&priv->resubscribe_source);
+    clear_source(&priv->reap_source);
+    clear_source(&priv->resync_source);
+
+    if (priv->flaps)
+        g_hash_table_remove_all(priv->flaps);
+
+    /* Cancels the calls, the client's pool must still be around */
+    g_queue_clear(&priv->resolve_queue);
+    if (priv->resolves)
+        g_hash_table_remove_all(priv->resolves);
+    priv->resolves_in_flight = 0;
 
     if (priv->client) {
+        if (priv->watchdog_id)
+            ga_client_remove_watchdog_watch(priv->client, priv->watchdog_id);
+        priv->watchdog_id = 0;
         g_object_unref(priv->client);
         priv->client = NULL;
     }
@@ -280,42 +564,501 @@ void ga_service_browser_finalize(GObject *object) {
 
     g_free(priv->type);
     g_free(priv->domain);
+    g_free(priv->resolve_name);
+    g_hash_table_destroy(priv->services);
+    g_hash_table_destroy(priv->collapsed);
+    if (priv->flaps)
+        g_hash_table_destroy(priv->flaps);
+    if (priv->resolves)
+        g_hash_table_destroy(priv->resolves);
+    g_ptr_array_free(priv->subscriptions, TRUE);
+    g_hash_table_destroy(priv->rejected_links);
 
     G_OBJECT_CLASS(ga_service_browser_parent_class)->finalize(object);
 }
 
+/*
+ * Auto-resolve.
+ *
+ * Instead of a GaServiceResolver per service, reported services are
+ * resolved over the client's pooled connections, at most
+ * resolve-concurrency at a time, and service-resolved is emitted whenever
+ * the result differs from the last one reported.
+ */
+
+static void resolve_pump(GaServiceBrowser *browser);
+
+static void emit_service_resolved(GaServiceBrowser *browser,
+                                  const ResolveJob *job,
+                                  GVariant *result) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    guint32 result_flags = GA_LOOKUP_RESULT_MULTICAST;
+    GArray *addresses = ga_service_resolve_result_get_addresses(result);
+    GaStringList *txt = ga_service_resolve_result_get_txt(result);
+    const gchar *host = NULL;
+    guint16 port = 0;
+
+    g_variant_lookup(result, "host", "&s", &host);
+    g_variant_lookup(result, "port", "q", &port);
+    g_variant_lookup(result, "flags", "u", &result_flags);
+
+    g_signal_emit(browser, signals[SERVICE_RESOLVED], 0,
+                  job->entry.interface,
+                  priv->protocol,
+                  job->entry.name,
+                  job->entry.type,
+                  job->entry.domain,
+                  host ? host : "",
+                  addresses,
+                  (gint)port,
+                  txt,
+                  (GaLookupResultFlags)result_flags);
+
+    ga_string_list_free(txt);
+    g_array_unref(addresses);
+}
+
+static void resolve_job_done_cb(GVariant *result,
+                                const GError *error,
+                                gpointer user_data) {
+    ResolveJob *job = user_data;
+    GaServiceBrowser *browser = job->browser;
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    BrowseEntry key = { 0 };
+
+    job->call = NULL;
+    priv->resolves_in_flight--;
+
+    g_object_ref(browser);
+
+    /* The handler may remove the service, and with it the job: keep a
+     * copy of the key to look the job up again afterwards */
+    key.name = g_strdup(job->entry.name);
+    key.type = g_strdup(job->entry.type);
+    key.domain = g_strdup(job->entry.domain);
+    key.interface = job->entry.interface;
+
+    if (error) {
+        g_debug("GaServiceBrowser: resolving '%s' failed: %s",
+                key.name ? key.name : "(null)", error->message);
+    } else if (!job->result || !ga_service_resolve_result_equal(job->result, result)) {
+        if (job->result)
+            g_variant_unref(job->result);
+        job->result = g_variant_ref(result);
+        emit_service_resolved(browser, job, result);
+    }
+
+    if (!priv->dispose_has_run && priv->resolves) {
+        ResolveJob *current = g_hash_table_lookup(priv->resolves, &key);
+        if (current && current->stale && !current->call && !current->queued) {
+            current->stale = FALSE;
+            current->queued = TRUE;
+            g_queue_push_tail(&priv->resolve_queue, current);
+        }
+    }
+    if (!priv->dispose_has_run)
+        resolve_pump(browser);
+
+    g_free(key.name);
+    g_free(key.type);
+    g_free(key.domain);
+    g_object_unref(browser);
+}
+
+static void resolve_pump(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    ResolveJob *job;
+
+    while (priv->resolves_in_flight < MAX(priv->resolve_concurrency, 1) &&
+           (job = g_queue_pop_head(&priv->resolve_queue))) {
+        job->queued = FALSE;
+        /* Bulk auto-resolves yield to interactive requests, except for
+         * the service a watching resolver follows */
+        job->call = ga_service_resolve_start(priv->client,
+                                             browser,
+                                             priv->resolve_name
+                                             ? GA_REQUEST_PRIORITY_INTERACTIVE
+                                             : GA_REQUEST_PRIORITY_BACKGROUND,
+                                             job->entry.interface,
+                                             job->entry.name,
+                                             job->entry.type,
+                                             job->entry.domain,
+                                             priv->resolve_name ? priv->resolve_aprotocol : priv->protocol,
+                                             priv->flags & (GA_LOOKUP_NO_TXT | GA_LOOKUP_NO_ADDRESS),
+                                             0,
+                                             resolve_job_done_cb,
+                                             job);
+        priv->resolves_in_flight++;
+    }
+}
+
+/* Resolve a reported service, or refresh the result of one that changed */
+static void resolve_request(GaServiceBrowser *browser, const BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    ResolveJob *job;
+
+    if (!priv->auto_resolve || !priv->resolves)
+        return;
+
+    if (priv->resolve_name && g_strcmp0(entry->name, priv->resolve_name) != 0)
+        return;
+
+    job = g_hash_table_lookup(priv->resolves, entry);
+    if (!job) {
+        job = g_new0(ResolveJob, 1);
+        job->entry.name = g_strdup(entry->name);
+        job->entry.type = g_strdup(entry->type);
+        job->entry.domain = g_strdup(entry->domain);
+        job->entry.interface = entry->interface;
+        job->browser = browser;
+        g_hash_table_add(priv->resolves, job);
+    }
+
+    if (job->call) {
+        job->stale = TRUE;
+    } else if (!job->queued) {
+        job->queued = TRUE;
+        g_queue_push_tail(&priv->resolve_queue, job);
+    }
+
+    resolve_pump(browser);
+}
+
+/* A known service was re-reported; find the job it was reported under */
+static void resolve_request_update(GaServiceBrowser *browser, const BrowseEntry *known) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    if (priv->resolves && g_hash_table_lookup(priv->resolves, known))
+        resolve_request(browser, known);
+}
+
+static void resolve_cancel(GaServiceBrowser *browser, const BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    ResolveJob *job = priv->resolves ? g_hash_table_lookup(priv->resolves, entry) : NULL;
+
+    if (!job)
+        return;
+
+    if (job->queued)
+        g_queue_remove(&priv->resolve_queue, job);
+    if (job->call)
+        priv->resolves_in_flight--;
+
+    g_hash_table_remove(priv->resolves, job);
+    resolve_pump(browser);
+}
+
+/* Refresh every result, e.g. after updates may have been missed */
+static void resolve_refresh_all(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GHashTableIter iter;
+    gpointer key;
+
+    if (!priv->resolves)
+        return;
+
+    g_hash_table_iter_init(&iter, priv->resolves);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        ResolveJob *job = key;
+
+        if (job->call) {
+            job->stale = TRUE;
+        } else if (!job->queued) {
+            job->queued = TRUE;
+            g_queue_push_tail(&priv->resolve_queue, job);
+        }
+    }
+
+    resolve_pump(browser);
+}
+
+static void emit_service_signal(GaServiceBrowser *browser,
+                                guint signal_id,
+                                const BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GaLookupResultFlags result_flags = GA_LOOKUP_RESULT_MULTICAST;
+
+    if (signal_id == NEW_SERVICE)
+        resolve_request(browser, entry);
+    else if (signal_id == REMOVED_SERVICE)
+        resolve_cancel(browser, entry);
+
+    g_signal_emit(browser, signals[signal_id], 0,
+                  entry->interface,
+                  priv->protocol,
+                  entry->name,
+                  entry->type,
+                  entry->domain,
+                  result_flags);
+}
+
+/*
+ * Flap damping.
+ *
+ * With a hold-down set, removed-service is delayed; if the service comes
+ * back in the meantime both events are dropped. Every such flap doubles
+ * the hold-down for that service, so a device bouncing several times a
+ * second quickly stops reaching the application at all.
+ */
+
+/* Quiet for the maximum hold-down: forgive earlier flaps */
+static void flap_state_decay(GaServiceBrowser *browser, FlapState *st) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    guint64 max = (guint64)priv->hold_down_ms << FLAP_MAX_SHIFT;
+
+    if (st->flaps > 0 &&
+        g_get_monotonic_time() - st->last_flap > (gint64)max * G_TIME_SPAN_MILLISECOND)
+        st->flaps = 0;
+}
+
+static guint hold_down_for(GaServiceBrowser *browser, FlapState *st) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    flap_state_decay(browser, st);
+
+    return (guint)MIN((guint64)priv->hold_down_ms << MIN(st->flaps, FLAP_MAX_SHIFT),
+                      (guint64)G_MAXUINT);
+}
+
+static gboolean hold_down_expired_cb(gpointer user_data) {
+    FlapState *st = user_data;
+    GaServiceBrowser *browser = st->browser;
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    g_hash_table_steal(priv->flaps, st);
+    g_source_unref(st->timer);
+    st->timer = NULL;
+
+    g_object_ref(browser);
+    emit_service_signal(browser, REMOVED_SERVICE, &st->entry);
+    g_object_unref(browser);
+
+    flap_state_free(st);
+    return G_SOURCE_REMOVE;
+}
+
+/* Returns FALSE if the event was swallowed as half of a flap */
+static gboolean emit_new(GaServiceBrowser *browser, BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    FlapState *st = priv->flaps ? g_hash_table_lookup(priv->flaps, entry) : NULL;
+
+    if (st && st->timer) {
+        g_source_destroy(st->timer);
+        g_source_unref(st->timer);
+        st->timer = NULL;
+
+        flap_state_decay(browser, st);
+        st->flaps++;
+        st->last_flap = g_get_monotonic_time();
+        priv->suppressed_events += 2;
+
+        /* Keep reporting it where the application already knows it */
+        entry->interface = st->entry.interface;
+
+        g_debug("GaServiceBrowser: '%s' flapped (%u), suppressed",
+                entry->name ? entry->name : "(null)", st->flaps);
+        g_object_notify(G_OBJECT(browser), "suppressed-events");
+        return FALSE;
+    }
+
+    emit_service_signal(browser, NEW_SERVICE, entry);
+    return TRUE;
+}
+
+static void emit_removed(GaServiceBrowser *browser, const BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    FlapState *st;
+
+    if (priv->hold_down_ms == 0 || !priv->flaps) {
+        emit_service_signal(browser, REMOVED_SERVICE, entry);
+        return;
+    }
+
+    st = g_hash_table_lookup(priv->flaps, entry);
+    if (!st) {
+        st = g_new0(FlapState, 1);
+        st->entry.name = g_strdup(entry->name);
+        st->entry.type = g_strdup(entry->type);
+        st->entry.domain = g_strdup(entry->domain);
+        st->entry.interface = entry->interface;
+        st->browser = browser;
+        g_hash_table_add(priv->flaps, st);
+    }
+
+    if (st->timer)
+        return;
+
+    st->timer = g_timeout_source_new(hold_down_for(browser, st));
+    g_source_set_callback(st->timer, hold_down_expired_cb, st, NULL);
+    g_source_attach(st->timer, NULL);
+}
+
+/*
+ * Every sighting is recorded per interface; with
+ * GA_LOOKUP_COLLAPSE_INTERFACES only the first sighting and the last
+ * removal of a (name, type, domain) reach the application, both reported
+ * on the interface the service was first seen on.
+ */
+static void service_added(GaServiceBrowser *browser, const BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    CollapsedService *c = g_hash_table_lookup(priv->collapsed, entry);
+    gint ifindex = entry->interface;
+
+    if (c) {
+        g_array_append_val(c->interfaces, ifindex);
+        if (priv->flags & GA_LOOKUP_COLLAPSE_INTERFACES)
+            return;
+    } else {
+        c = g_new0(CollapsedService, 1);
+        c->key.name = g_strdup(entry->name);
+        c->key.type = g_strdup(entry->type);
+        c->key.domain = g_strdup(entry->domain);
+        c->key.interface = entry->interface;
+        c->interfaces = g_array_new(FALSE, FALSE, sizeof(gint));
+        g_array_append_val(c->interfaces, ifindex);
+        g_hash_table_add(priv->collapsed, c);
+
+        if (priv->flags & GA_LOOKUP_COLLAPSE_INTERFACES) {
+            emit_new(browser, &c->key);
+            return;
+        }
+    }
+
+    BrowseEntry key = *entry;
+    emit_new(browser, &key);
+}
+
+static void service_removed(GaServiceBrowser *browser, const BrowseEntry *entry) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    CollapsedService *c = g_hash_table_lookup(priv->collapsed, entry);
+
+    if (c) {
+        for (guint i = 0; i < c->interfaces->len; i++) {
+            if (g_array_index(c->interfaces, gint, i) == entry->interface) {
+                g_array_remove_index(c->interfaces, i);
+                break;
+            }
+        }
+
+        if (c->interfaces->len > 0) {
+            if (priv->flags & GA_LOOKUP_COLLAPSE_INTERFACES)
+                return;
+        } else if (priv->flags & GA_LOOKUP_COLLAPSE_INTERFACES) {
+            g_hash_table_steal(priv->collapsed, c);
+            emit_removed(browser, &c->key);
+            collapsed_service_free(c);
+            return;
+        } else {
+            g_hash_table_remove(priv->collapsed, c);
+        }
+    }
+
+    emit_removed(browser, entry);
+}
+
+static void record_resubscribe_latency(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GaClientStatistics *stats = ga_client_peek_statistics(priv->client);
+    guint64 latency = (guint64)(g_get_monotonic_time() - priv->resubscribed_at);
+
+    priv->resubscribed_at = 0;
+
+    stats->resubscribe_count++;
+    stats->resubscribe_latency_last = latency;
+    stats->resubscribe_latency_max = MAX(stats->resubscribe_latency_max, latency);
+    stats->resubscribe_latency_total += latency;
+
+    g_debug("GaServiceBrowser: resubscribed in %" G_GUINT64_FORMAT " us", latency);
+}
+
+static void reap_dead_subscriptions(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    for (guint i = priv->subscriptions->len; i-- > 0;) {
+        BrowseSubscription *sub = g_ptr_array_index(priv->subscriptions, i);
+        if (sub->dead)
+            g_ptr_array_remove_index_fast(priv->subscriptions, i);
+    }
+}
+
+static gboolean reap_idle_cb(gpointer user_data) {
+    GaServiceBrowser *browser = GA_SERVICE_BROWSER(user_data);
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    g_source_unref(priv->reap_source);
+    priv->reap_source = NULL;
+
+    reap_dead_subscriptions(browser);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Drop a single per-link subscription once out of its callback */
+static void subscription_kill(BrowseSubscription *sub) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(sub->browser);
+
+    sub->dead = TRUE;
+
+    if (priv->reap_source)
+        return;
+
+    priv->reap_source = g_idle_source_new();
+    g_source_set_callback(priv->reap_source, reap_idle_cb, sub->browser, NULL);
+    g_source_attach(priv->reap_source, NULL);
+}
+
+static gboolean is_ifindex_rejection(const char *error_id, sd_json_variant *parameters) {
+    sd_json_variant *v;
+
+    if (g_strcmp0(error_id, "org.varlink.service.InvalidParameter") != 0)
+        return FALSE;
+
+    v = parameters ? sd_json_variant_by_key(parameters, "parameter") : NULL;
+    return v && sd_json_variant_is_string(v) &&
+           g_strcmp0(sd_json_variant_string(v), "ifindex") == 0;
+}
+
 /* Varlink notification callback */
 static int browse_notify_cb(G_GNUC_UNUSED sd_varlink *link,
                             sd_json_variant *parameters,
                             const char *error_id,
                             G_GNUC_UNUSED sd_varlink_reply_flags_t flags,
                             void *userdata) {
-    GaServiceBrowser *browser = GA_SERVICE_BROWSER(userdata);
+    BrowseSubscription *sub = userdata;
+    GaServiceBrowser *browser = sub->browser;
     GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
 
     g_debug("GaServiceBrowser: browse_notify_cb called, error_id=%s",
             error_id ? error_id : "(none)");
 
+    sub->last_activity = g_get_monotonic_time();
+
     if (error_id) {
-        /* If the subscription timed out or disconnected, try to reconnect.
-         * systemd-resolved BrowseServices has a default timeout. */
+        /* The subscription ended underneath us (resolved restarted or timed
+         * it out): resubscribe, the known-services table keeps this
+         * transparent to the application. */
         if (g_strcmp0(error_id, "io.systemd.TimedOut") == 0 ||
             g_strcmp0(error_id, "io.systemd.Disconnected") == 0) {
-            g_debug("GaServiceBrowser: Subscription ended (%s), attempting reconnect", error_id);
-            /* Disconnect and reconnect */
-            disconnect_from_resolved(browser);
-            GError *reconnect_error = NULL;
-            if (!ga_service_browser_attach(browser, priv->client, &reconnect_error)) {
-                g_warning("GaServiceBrowser: Failed to reconnect: %s",
-                          reconnect_error ? reconnect_error->message : "unknown");
-                GError *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
-                                            "Reconnection failed: %s", error_id);
-                g_signal_emit(browser, signals[FAILURE], 0, error);
-                g_error_free(error);
-                g_clear_error(&reconnect_error);
-            } else {
-                g_debug("GaServiceBrowser: Successfully reconnected after %s", error_id);
-            }
+            g_debug("GaServiceBrowser: Subscription ended (%s), resubscribing", error_id);
+            schedule_resubscribe(browser);
+            return 0;
+        }
+
+        /* Stock resolved only browses one link at a time: remember that
+         * for the whole client and fan out over the links instead. */
+        if (sub->ifindex <= 0 && is_ifindex_rejection(error_id, parameters)) {
+            g_debug("GaServiceBrowser: resolved cannot browse all links, fanning out");
+            ga_client_set_feature(priv->client, GA_CLIENT_FEATURE_BROWSE_ALL_INTERFACES, FALSE);
+            subscription_kill(sub);
+            schedule_resubscribe(browser);
+            return 0;
+        }
+
+        /* A link without mDNS only costs that link */
+        if (priv->fanout) {
+            g_debug("GaServiceBrowser: link %d not browsable: %s", sub->ifindex, error_id);
+            g_hash_table_add(priv->rejected_links, GINT_TO_POINTER(sub->ifindex));
+            subscription_kill(sub);
             return 0;
         }
 
@@ -326,6 +1069,9 @@ static int browse_notify_cb(G_GNUC_UNUSED sd_varlink *link,
         return 0;
     }
 
+    if (priv->resubscribed_at)
+        record_resubscribe_latency(browser);
+
     sd_json_variant *array = sd_json_variant_by_key(parameters, "browserServiceData");
     if (!array || !sd_json_variant_is_array(array)) {
         g_debug("GaServiceBrowser: No browserServiceData array in notification");
@@ -335,7 +1081,10 @@ static int browse_notify_cb(G_GNUC_UNUSED sd_varlink *link,
     size_t n = sd_json_variant_elements(array);
     g_debug("GaServiceBrowser: Processing %zu service entries", n);
 
-    for (size_t i = 0; i < n; i++) {
+    /* Signal handlers may drop the last reference */
+    g_object_ref(browser);
+
+    for (size_t i = 0; i < n && !priv->dispose_has_run; i++) {
         sd_json_variant *entry = sd_json_variant_by_index(array, i);
         if (!entry || !sd_json_variant_is_object(entry))
             continue;
@@ -368,68 +1117,464 @@ static int browse_notify_cb(G_GNUC_UNUSED sd_varlink *link,
             continue;
         }
 
-        GaLookupResultFlags result_flags = GA_LOOKUP_RESULT_MULTICAST;
+        BrowseEntry lookup = {
+            .name = (char *)name,
+            .type = (char *)type,
+            .domain = (char *)domain,
+            .interface = (GaIfIndex)ifindex,
+        };
+        BrowseEntry *known = g_hash_table_lookup(priv->services, &lookup);
 
         if (g_strcmp0(update_flag, "added") == 0) {
-            g_debug("GaServiceBrowser: Emitting new-service for '%s'", name ? name : "(null)");
             priv->initial_snapshot_done = TRUE;
-            g_signal_emit(browser, signals[NEW_SERVICE], 0,
-                          (gint)ifindex,
-                          priv->protocol,
-                          name,
-                          type,
-                          domain,
-                          result_flags);
+
+            if (known) {
+                known->generation = priv->generation;
+
+                /* Outside a resync, a repeated "added" means the service
+                 * was updated: keep the resolved data current. */
+                if (!priv->resync_source)
+                    resolve_request_update(browser, known);
+                continue;
+            }
+
+            BrowseEntry *e = g_new0(BrowseEntry, 1);
+            e->name = g_strdup(name);
+            e->type = g_strdup(type);
+            e->domain = g_strdup(domain);
+            e->interface = (GaIfIndex)ifindex;
+            e->generation = priv->generation;
+            g_hash_table_add(priv->services, e);
+
+            if (priv->resync_source)
+                priv->resync_changes++;
+
+            g_debug("GaServiceBrowser: Emitting new-service for '%s'", name ? name : "(null)");
+            service_added(browser, e);
         } else if (g_strcmp0(update_flag, "removed") == 0) {
+            if (!known)
+                continue;
+
+            g_hash_table_steal(priv->services, known);
+
             g_debug("GaServiceBrowser: Emitting removed-service for '%s'", name ? name : "(null)");
-            g_signal_emit(browser, signals[REMOVED_SERVICE], 0,
-                          (gint)ifindex,
-                          priv->protocol,
-                          name,
-                          type,
-                          domain,
-                          result_flags);
+            service_removed(browser, known);
+            browse_entry_free(known);
         } else {
             g_debug("GaServiceBrowser: Unknown update_flag '%s'", update_flag ? update_flag : "(null)");
         }
     }
 
+    g_object_unref(browser);
+
     return 0;
 }
 
 /* GLib IO callback for varlink */
-static gboolean varlink_io_cb(G_GNUC_UNUSED GIOChannel *source,
-                              GIOCondition condition,
+static gboolean varlink_io_cb(G_GNUC_UNUSED sd_varlink *link,
+                              int r,
                               gpointer user_data) {
-    GaServiceBrowser *browser = GA_SERVICE_BROWSER(user_data);
+    BrowseSubscription *sub = user_data;
+    GaServiceBrowser *browser = sub->browser;
+
+    if (r >= 0)
+        return G_SOURCE_CONTINUE;
+
+    /* Connection lost without a final reply, e.g. resolved was restarted */
+    g_debug("GaServiceBrowser: Connection lost: %s", g_strerror(-r));
+    schedule_resubscribe(browser);
+
+    return G_SOURCE_REMOVE;
+}
+
+static BrowseSubscription *subscription_new(GaServiceBrowser *browser,
+                                            int ifindex,
+                                            GError **error) {
     GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    BrowseSubscription *sub;
+    int r;
 
-    g_debug("GaServiceBrowser: varlink_io_cb triggered, condition=0x%x", condition);
+    sub = g_new0(BrowseSubscription, 1);
+    sub->browser = browser;
+    sub->ifindex = ifindex;
 
-    if (condition & (G_IO_HUP | G_IO_ERR)) {
-        g_debug("GaServiceBrowser: Connection lost (HUP or ERR)");
-        GError *error = g_error_new(GA_ERROR, GA_ERROR_DISCONNECTED,
-                                    "Connection to systemd-resolved lost");
-        g_signal_emit(browser, signals[FAILURE], 0, error);
-        g_error_free(error);
-        return G_SOURCE_REMOVE;
+    /* Connect to systemd-resolved */
+    r = sd_varlink_connect_address(&sub->link, RESOLVED_VARLINK_ADDRESS);
+    if (r < 0) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_NO_DAEMON,
+                                 "Failed to connect to systemd-resolved: %s",
+                                 g_strerror(-r));
+        }
+        subscription_free(sub);
+        return NULL;
     }
 
-    int r;
-    while ((r = sd_varlink_process(priv->link)) > 0)
-        ;
+    /* Set up GLib main loop integration */
+    sub->source = ga_varlink_source_new(sub->link);
+    if (!sub->source) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to get varlink fd");
+        }
+        subscription_free(sub);
+        return NULL;
+    }
+
+    g_source_set_callback(sub->source,
+                          G_SOURCE_FUNC(varlink_io_cb),
+                          sub,
+                          NULL);
 
+    sd_varlink_set_userdata(sub->link, sub);
+    sd_varlink_bind_reply(sub->link, browse_notify_cb);
+
+    /* Subscriptions are long-lived; stalls are caught by the client watchdog */
+    sd_varlink_set_relative_timeout(sub->link, UINT64_MAX);
+
+    const char *domain = priv->domain ? priv->domain : "local";
+
+    r = sd_varlink_observebo(sub->link,
+                             "io.systemd.Resolve.BrowseServices",
+                             SD_JSON_BUILD_PAIR_STRING("domain", domain),
+                             SD_JSON_BUILD_PAIR_STRING("type", priv->type),
+                             SD_JSON_BUILD_PAIR_INTEGER("ifindex", ifindex),
+                             SD_JSON_BUILD_PAIR_UNSIGNED("flags", 0));
     if (r < 0) {
-        g_debug("GaServiceBrowser: varlink processing error: %s", g_strerror(-r));
-        GError *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
-                                    "Varlink processing error: %s",
-                                    g_strerror(-r));
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to start browsing: %s",
+                                 g_strerror(-r));
+        }
+        subscription_free(sub);
+        return NULL;
+    }
+
+    sd_varlink_flush(sub->link);
+
+    sub->last_activity = g_get_monotonic_time();
+
+    return sub;
+}
+
+/* Links resolved can run mDNS on: up, multicast capable, not loopback */
+static GArray *get_multicast_links(void) {
+    GArray *links = g_array_new(FALSE, FALSE, sizeof(int));
+    struct ifaddrs *ifaddr, *ifa;
+
+    if (getifaddrs(&ifaddr) < 0)
+        return links;
+
+    for (ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (!(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_MULTICAST) ||
+            (ifa->ifa_flags & IFF_LOOPBACK))
+            continue;
+
+        int ifindex = (int)if_nametoindex(ifa->ifa_name);
+        if (ifindex <= 0)
+            continue;
+
+        gboolean seen = FALSE;
+        for (guint i = 0; i < links->len && !seen; i++)
+            seen = g_array_index(links, int, i) == ifindex;
+        if (!seen)
+            g_array_append_val(links, ifindex);
+    }
+
+    freeifaddrs(ifaddr);
+    return links;
+}
+
+static gboolean has_subscription_for(GaServiceBrowser *browser, int ifindex) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    for (guint i = 0; i < priv->subscriptions->len; i++) {
+        BrowseSubscription *sub = g_ptr_array_index(priv->subscriptions, i);
+        if (sub->ifindex == ifindex && !sub->dead)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Subscribe on links not covered yet; returns how many were added */
+static guint fanout_add_links(GaServiceBrowser *browser, GArray *links, GError **error) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    guint added = 0;
+
+    for (guint i = 0; i < links->len; i++) {
+        int ifindex = g_array_index(links, int, i);
+
+        if (has_subscription_for(browser, ifindex) ||
+            g_hash_table_contains(priv->rejected_links, GINT_TO_POINTER(ifindex)))
+            continue;
+
+        BrowseSubscription *sub = subscription_new(browser, ifindex, error);
+        if (!sub)
+            break;
+
+        g_source_attach(sub->source, NULL);
+        g_ptr_array_add(priv->subscriptions, sub);
+        added++;
+    }
+
+    return added;
+}
+
+/*
+ * Open the subscriptions the browser needs: one for the requested link, or
+ * for all links if resolved supports that, else one per multicast link.
+ * The GSources are left for the caller to attach.
+ */
+static gboolean subscribe(GaServiceBrowser *browser, GError **error) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    priv->fanout = priv->interface <= 0 &&
+                   !ga_client_has_feature(priv->client, GA_CLIENT_FEATURE_BROWSE_ALL_INTERFACES);
+
+    if (!priv->fanout) {
+        /* GA_IF_UNSPEC (-1) means "all interfaces" - we pass it directly to systemd-resolved
+         * which (with the ifindex<=0 patch) normalizes -1 to 0 and browses all mDNS interfaces.
+         * This provides full Avahi AVAHI_IF_UNSPEC semantics. */
+        BrowseSubscription *sub = subscription_new(browser, priv->interface, error);
+        if (!sub)
+            return FALSE;
+
+        g_ptr_array_add(priv->subscriptions, sub);
+        return TRUE;
+    }
+
+    GArray *links = get_multicast_links();
+    GError *local_error = NULL;
+
+    g_hash_table_remove_all(priv->rejected_links);
+
+    for (guint i = 0; i < links->len; i++) {
+        BrowseSubscription *sub = subscription_new(browser, g_array_index(links, int, i),
+                                                   &local_error);
+        if (!sub)
+            break;
+        g_ptr_array_add(priv->subscriptions, sub);
+    }
+
+    g_array_free(links, TRUE);
+
+    if (local_error) {
+        g_propagate_error(error, local_error);
+        disconnect_from_resolved(browser);
+        return FALSE;
+    }
+
+    if (priv->subscriptions->len == 0) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_NO_NETWORK,
+                                 "No multicast capable link to browse on");
+        }
+        return FALSE;
+    }
+
+    g_debug("GaServiceBrowser: browsing on %u links", priv->subscriptions->len);
+    return TRUE;
+}
+
+static void attach_sources(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    for (guint i = 0; i < priv->subscriptions->len; i++) {
+        BrowseSubscription *sub = g_ptr_array_index(priv->subscriptions, i);
+        if (!g_source_get_context(sub->source))
+            g_source_attach(sub->source, NULL);
+    }
+}
+
+/* Forget the services of links that went away */
+static void fanout_drop_links(GaServiceBrowser *browser, GArray *links) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GPtrArray *gone = g_ptr_array_new_with_free_func(browse_entry_free);
+    GHashTableIter iter;
+    gpointer key;
+
+    for (guint i = priv->subscriptions->len; i-- > 0;) {
+        BrowseSubscription *sub = g_ptr_array_index(priv->subscriptions, i);
+        gboolean present = FALSE;
+
+        for (guint j = 0; j < links->len && !present; j++)
+            present = g_array_index(links, int, j) == sub->ifindex;
+        if (!present)
+            g_ptr_array_remove_index_fast(priv->subscriptions, i);
+    }
+
+    g_hash_table_iter_init(&iter, priv->services);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        BrowseEntry *e = key;
+        gboolean present = FALSE;
+
+        for (guint j = 0; j < links->len && !present; j++)
+            present = g_array_index(links, int, j) == e->interface;
+        if (!present) {
+            g_hash_table_iter_steal(&iter);
+            g_ptr_array_add(gone, e);
+        }
+    }
+
+    g_object_ref(browser);
+    for (guint i = 0; i < gone->len && !priv->dispose_has_run; i++)
+        service_removed(browser, g_ptr_array_index(gone, i));
+    g_object_unref(browser);
+
+    g_ptr_array_free(gone, TRUE);
+}
+
+static void fanout_refresh_links(GaServiceBrowser *browser) {
+    GArray *links = get_multicast_links();
+    GError *error = NULL;
+
+    fanout_drop_links(browser, links);
+    fanout_add_links(browser, links, &error);
+
+    if (error) {
+        g_debug("GaServiceBrowser: failed to browse new link: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_array_free(links, TRUE);
+}
+
+/* Services not re-reported by the new subscription went away unnoticed */
+static gboolean resync_done_cb(gpointer user_data) {
+    GaServiceBrowser *browser = GA_SERVICE_BROWSER(user_data);
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GaClientStatistics *stats = ga_client_peek_statistics(priv->client);
+    GPtrArray *stale = g_ptr_array_new_with_free_func(browse_entry_free);
+    GHashTableIter iter;
+    gpointer key;
+
+    g_source_unref(priv->resync_source);
+    priv->resync_source = NULL;
+
+    if (priv->resubscribed_at)
+        record_resubscribe_latency(browser);
+
+    g_hash_table_iter_init(&iter, priv->services);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        BrowseEntry *e = key;
+        if (e->generation != priv->generation) {
+            g_hash_table_iter_steal(&iter);
+            g_ptr_array_add(stale, e);
+        }
+    }
+
+    priv->resync_changes += stale->len;
+    if (priv->resync_changes > 0) {
+        g_debug("GaServiceBrowser: subscription had stalled, %u missed changes",
+                priv->resync_changes);
+        stats->subscription_stalls++;
+
+        /* Updates may have been missed as well */
+        resolve_refresh_all(browser);
+    }
+    priv->resync_changes = 0;
+
+    g_object_ref(browser);
+    for (guint i = 0; i < stale->len && !priv->dispose_has_run; i++)
+        service_removed(browser, g_ptr_array_index(stale, i));
+    g_object_unref(browser);
+
+    g_ptr_array_free(stale, TRUE);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean resubscribe(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GError *error = NULL;
+
+    disconnect_from_resolved(browser);
+
+    if (!subscribe(browser, &error)) {
+        g_warning("GaServiceBrowser: Failed to resubscribe: %s", error->message);
         g_signal_emit(browser, signals[FAILURE], 0, error);
         g_error_free(error);
-        return G_SOURCE_REMOVE;
+        return FALSE;
+    }
+
+    priv->resubscribed_at = g_get_monotonic_time();
+    priv->generation++;
+    attach_sources(browser);
+
+    clear_source(&priv->resync_source);
+    priv->resync_source = g_timeout_source_new(BROWSE_RESYNC_WINDOW_MS);
+    g_source_set_callback(priv->resync_source, resync_done_cb, browser, NULL);
+    g_source_attach(priv->resync_source, NULL);
+
+    return TRUE;
+}
+
+static gboolean resubscribe_idle_cb(gpointer user_data) {
+    GaServiceBrowser *browser = GA_SERVICE_BROWSER(user_data);
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    g_source_unref(priv->resubscribe_source);
+    priv->resubscribe_source = NULL;
+
+    resubscribe(browser);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Defer, so a subscription is never torn down from its own callback */
+static void schedule_resubscribe(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    if (priv->resubscribe_source || priv->dispose_has_run)
+        return;
+
+    priv->resubscribe_source = g_idle_source_new();
+    g_source_set_callback(priv->resubscribe_source, resubscribe_idle_cb, browser, NULL);
+    g_source_attach(priv->resubscribe_source, NULL);
+}
+
+static gint64 get_last_activity(GaServiceBrowser *browser) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    gint64 oldest = G_MAXINT64;
+
+    for (guint i = 0; i < priv->subscriptions->len; i++) {
+        BrowseSubscription *sub = g_ptr_array_index(priv->subscriptions, i);
+        oldest = MIN(oldest, sub->last_activity);
     }
+    return oldest;
+}
 
-    return G_SOURCE_CONTINUE;
+static void watchdog_cb(GaClient *client, gboolean daemon_alive, gpointer user_data) {
+    GaServiceBrowser *browser = GA_SERVICE_BROWSER(user_data);
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+    GaClientStatistics *stats = ga_client_peek_statistics(client);
+
+    if (!daemon_alive) {
+        priv->daemon_suspect = TRUE;
+        return;
+    }
+
+    if (priv->resubscribe_source || priv->resync_source)
+        return;
+
+    if (priv->subscriptions->len == 0 || priv->daemon_suspect) {
+        /* Lost earlier, or resolved stopped answering for a while: the
+         * subscription cannot be trusted to have kept up. */
+        g_debug("GaServiceBrowser: resolved is back, resubscribing");
+        stats->subscription_stalls++;
+        priv->daemon_suspect = FALSE;
+        resubscribe(browser);
+    } else if (g_get_monotonic_time() - get_last_activity(browser) >
+               ga_client_get_stall_timeout(client)) {
+        /* Quiet for long: either nothing changed or the subscription
+         * stalled. A refresh tells the two apart at the cost of one
+         * snapshot; the resync counts it as a stall if anything was missed. */
+        g_debug("GaServiceBrowser: subscription idle, refreshing");
+        stats->subscription_refreshes++;
+        resubscribe(browser);
+    } else if (priv->fanout) {
+        fanout_refresh_links(browser);
+    }
 }
 
 GaServiceBrowser *ga_service_browser_new(const gchar *type) {
@@ -451,90 +1596,144 @@ GaServiceBrowser *ga_service_browser_new_full(GaIfIndex interface,
                         NULL);
 }
 
+/* Bounded wait for the initial snapshot, before the sources are attached */
+static void wait_for_snapshot(GaServiceBrowser *browser, gint64 deadline) {
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    while (!priv->initial_snapshot_done && !priv->resubscribe_source &&
+           g_get_monotonic_time() < deadline) {
+        guint n = priv->subscriptions->len;
+        if (n == 0)
+            break;
+
+        for (guint i = 0; i < n; i++) {
+            BrowseSubscription *sub = g_ptr_array_index(priv->subscriptions, i);
+            if (sub->dead)
+                continue;
+            sd_varlink_wait(sub->link, 100 * 1000 / n);  /* 100ms per round */
+            if (sd_varlink_process(sub->link) < 0)
+                sub->dead = TRUE;
+        }
+    }
+}
+
 gboolean ga_service_browser_attach(GaServiceBrowser *browser,
                                    GaClient *client,
                                    GError **error) {
     GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
-    int r;
 
     g_return_val_if_fail(IS_GA_SERVICE_BROWSER(browser), FALSE);
     g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
 
-    g_object_ref(client);
-    priv->client = client;
-
-    /* Connect to systemd-resolved */
-    r = sd_varlink_connect_address(&priv->link, RESOLVED_VARLINK_ADDRESS);
-    if (r < 0) {
+    if (!ga_client_has_feature(client, GA_CLIENT_FEATURE_BROWSE_SERVICES)) {
         if (error) {
-            *error = g_error_new(GA_ERROR, GA_ERROR_NO_DAEMON,
-                                 "Failed to connect to systemd-resolved: %s",
-                                 g_strerror(-r));
+            *error = g_error_new(GA_ERROR, GA_ERROR_NOT_SUPPORTED,
+                                 "systemd-resolved does not support BrowseServices");
         }
         return FALSE;
     }
 
-    priv->varlink_fd = sd_varlink_get_fd(priv->link);
-    if (priv->varlink_fd < 0) {
-        if (error) {
-            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
-                                 "Failed to get varlink fd");
-        }
-        sd_varlink_unref(priv->link);
-        priv->link = NULL;
-        return FALSE;
-    }
+    g_object_ref(client);
+    priv->client = client;
 
-    /* Set up GLib main loop integration */
-    GIOChannel *channel = g_io_channel_unix_new(priv->varlink_fd);
-    priv->varlink_source = g_io_create_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR);
-    g_io_channel_unref(channel);
+    /* Per reported service state; collapsed services are one service
+     * regardless of interface */
+    GHashFunc hash = browse_entry_hash;
+    GEqualFunc equal = browse_entry_equal;
+    if (priv->flags & GA_LOOKUP_COLLAPSE_INTERFACES) {
+        hash = collapsed_service_hash;
+        equal = collapsed_service_equal;
+    }
 
-    g_source_set_callback(priv->varlink_source,
-                          G_SOURCE_FUNC(varlink_io_cb),
-                          browser,
-                          NULL);
-    g_source_attach(priv->varlink_source, NULL);
+    priv->flaps = g_hash_table_new_full(hash, equal, flap_state_free, NULL);
+    if (priv->auto_resolve)
+        priv->resolves = g_hash_table_new_full(hash, equal, resolve_job_free, NULL);
 
-    sd_varlink_set_userdata(priv->link, browser);
-    sd_varlink_bind_reply(priv->link, browse_notify_cb);
+    if (!subscribe(browser, error))
+        return FALSE;
 
-    /* Start browsing.
-     * GA_IF_UNSPEC (-1) means "all interfaces" - we pass it directly to systemd-resolved
-     * which (with the ifindex<=0 patch) normalizes -1 to 0 and browses all mDNS interfaces.
-     * This provides full Avahi AVAHI_IF_UNSPEC semantics. */
-    const char *domain = priv->domain ? priv->domain : "local";
-    int ifindex = priv->interface;
+    /* Wait for initial snapshot (bounded, up to 1s) */
+    gint64 deadline = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
+    wait_for_snapshot(browser, deadline);
 
-    r = sd_varlink_observebo(priv->link,
-                             "io.systemd.Resolve.BrowseServices",
-                             SD_JSON_BUILD_PAIR_STRING("domain", domain),
-                             SD_JSON_BUILD_PAIR_STRING("type", priv->type),
-                             SD_JSON_BUILD_PAIR_INTEGER("ifindex", ifindex),
-                             SD_JSON_BUILD_PAIR_UNSIGNED("flags", 0));
-    if (r < 0) {
-        if (error) {
-            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
-                                 "Failed to start browsing: %s",
-                                 g_strerror(-r));
-        }
+    /* resolved rejected the all-links browse: fan out right away */
+    if (priv->resubscribe_source) {
+        clear_source(&priv->resubscribe_source);
         disconnect_from_resolved(browser);
-        return FALSE;
-    }
 
-    sd_varlink_flush(priv->link);
+        if (!subscribe(browser, error))
+            return FALSE;
 
-    /* Wait for initial snapshot (bounded, up to 1s) */
-    gint64 deadline = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
-    while (!priv->initial_snapshot_done && g_get_monotonic_time() < deadline) {
-        sd_varlink_wait(priv->link, 100 * 1000);  /* 100ms */
-        int pr = sd_varlink_process(priv->link);
-        if (pr < 0)
-            break;
+        wait_for_snapshot(browser, deadline);
     }
 
+    /* Set up GLib main loop integration */
+    attach_sources(browser);
+    clear_source(&priv->reap_source);
+    reap_dead_subscriptions(browser);
+
+    /* Lost while waiting: retry from the main loop like any other loss */
+    if (priv->subscriptions->len == 0)
+        schedule_resubscribe(browser);
+
+    priv->watchdog_id = ga_client_add_watchdog_watch(client, watchdog_cb, browser);
+
     /* Emit all-for-now to indicate initial results are ready */
     g_signal_emit(browser, signals[ALL_FOR_NOW], 0);
 
     return TRUE;
 }
+
+GArray *ga_service_browser_get_interfaces(GaServiceBrowser *browser,
+                                          const gchar *name,
+                                          const gchar *type,
+                                          const gchar *domain) {
+    g_return_val_if_fail(IS_GA_SERVICE_BROWSER(browser), NULL);
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    BrowseEntry lookup = {
+        .name = (char *)name,
+        .type = (char *)type,
+        .domain = (char *)domain,
+    };
+    CollapsedService *c = g_hash_table_lookup(priv->collapsed, &lookup);
+    if (!c)
+        return NULL;
+
+    GArray *interfaces = g_array_sized_new(FALSE, FALSE, sizeof(gint), c->interfaces->len);
+    g_array_append_vals(interfaces, c->interfaces->data, c->interfaces->len);
+    return interfaces;
+}
+
+void ga_service_browser_set_resolve_target(GaServiceBrowser *browser,
+                                           const gchar *name,
+                                           GaProtocol aprotocol) {
+    g_return_if_fail(IS_GA_SERVICE_BROWSER(browser));
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    g_free(priv->resolve_name);
+    priv->resolve_name = g_strdup(name);
+    priv->resolve_aprotocol = aprotocol;
+}
+
+GVariant *ga_service_browser_peek_resolve_result(GaServiceBrowser *browser,
+                                                 GaIfIndex interface,
+                                                 const gchar *name,
+                                                 const gchar *type,
+                                                 const gchar *domain) {
+    g_return_val_if_fail(IS_GA_SERVICE_BROWSER(browser), NULL);
+    GaServiceBrowserPrivate *priv = GA_SERVICE_BROWSER_GET_PRIVATE(browser);
+
+    if (!priv->resolves)
+        return NULL;
+
+    BrowseEntry lookup = {
+        .name = (char *)name,
+        .type = (char *)type,
+        .domain = (char *)domain,
+        .interface = interface,
+    };
+    ResolveJob *job = g_hash_table_lookup(priv->resolves, &lookup);
+
+    return job ? job->result : NULL;
+}
@@ -52,6 +52,16 @@ gboolean
 ga_service_browser_attach(GaServiceBrowser * browser,
                           GaClient * client, GError ** error);
 
+/*
+ * Interfaces a service is currently seen on, as a GArray of gint in order
+ * of first sighting, or NULL if the service is unknown. Free with
+ * g_array_unref().
+ */
+GArray *ga_service_browser_get_interfaces(GaServiceBrowser * browser,
+                                          const gchar * name,
+                                          const gchar * type,
+                                          const gchar * domain);
+
 G_END_DECLS
 
 #endif /* #ifndef __GA_SERVICE_BROWSER_H__ */
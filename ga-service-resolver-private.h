@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * ga-service-resolver-private.h - ResolveService helpers shared with the
+ * other objects (not installed)
+ */
+
+#ifndef __GA_SERVICE_RESOLVER_PRIVATE_H__
+#define __GA_SERVICE_RESOLVER_PRIVATE_H__
+
+#include "ga-service-resolver.h"
+#include "ga-varlink.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Resolve results are a{sv} dictionaries:
+ *   "host"      s        host name of the selected target
+ *   "port"      q
+ *   "proto"     i        protocol of "address"
+ *   "address"   ay       preferred address
+ *   "addresses" a(iay)   every address, as (proto, bytes), in target order
+ *   "targets"   a(sqqqa(iay))  SRV targets in RFC 2782 order, as
+ *                        (host, priority, weight, port, addresses)
+ *   "scopes"    a{si}    interface of each IPv6 link-local address,
+ *                        keyed by its string form
+ *   "txt"       as
+ *   "flags"     u        GaLookupResultFlags of the reply
+ */
+
+/* Turn a ResolveService reply into a result dictionary (floating) */
+GVariant *ga_service_resolve_parse_reply(sd_json_variant *reply,
+                                         GaProtocol aprotocol);
+
+/* Build the ResolveService parameters */
+sd_json_variant *ga_service_resolve_build_params(GaIfIndex interface,
+                                                 const gchar *name,
+                                                 const gchar *type,
+                                                 const gchar *domain,
+                                                 GaProtocol aprotocol,
+                                                 GaLookupFlags flags,
+                                                 GError **error);
+
+/* @result is NULL on error; it is only valid during the callback */
+typedef void (*GaServiceResolveFunc)(GVariant *result,
+                                     const GError *error,
+                                     gpointer user_data);
+
+/*
+ * Resolve a service over the client's pooled connections, scheduled as a
+ * request of @owner. Cancel with ga_varlink_call_cancel(); @func is not
+ * invoked afterwards.
+ */
+GaVarlinkCall *ga_service_resolve_start(GaClient *client,
+                                        gconstpointer owner,
+                                        GaRequestPriority priority,
+                                        GaIfIndex interface,
+                                        const gchar *name,
+                                        const gchar *type,
+                                        const gchar *domain,
+                                        GaProtocol aprotocol,
+                                        GaLookupFlags flags,
+                                        guint timeout_ms,
+                                        GaServiceResolveFunc func,
+                                        gpointer user_data);
+
+/* Parse one of resolved's {"family", "address"} objects */
+gboolean ga_address_from_json(sd_json_variant *v, GaAddress *address);
+
+/* Helpers to unpack result dictionaries */
+gboolean ga_service_resolve_result_get_address(GVariant *result, GaAddress *address);
+
+GArray *ga_service_resolve_result_get_addresses(GVariant *result);
+
+GaStringList *ga_service_resolve_result_get_txt(GVariant *result);
+
+/* GPtrArray of GaServiceTarget; empty if the result has none */
+GPtrArray *ga_service_resolve_result_get_targets(GVariant *result);
+
+/* Whether two results describe the same service, whatever their "flags" */
+gboolean ga_service_resolve_result_equal(GVariant *a, GVariant *b);
+
+/* Add the "scopes" of @result to @scopes (gchar* -> GINT_TO_POINTER ifindex) */
+void ga_service_resolve_result_get_scopes(GVariant *result, GHashTable *scopes);
+
+/*
+ * Take over @result as if resolved had answered, without a lookup: found
+ * is emitted and the resolver can connect. For the benchmarks.
+ */
+void ga_service_resolver_take_result(GaServiceResolver *resolver, GVariant *result);
+
+/* Whether @address is an IPv6 link-local (fe80::/10) address */
+gboolean ga_address_is_link_local(const GaAddress *address);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_SERVICE_RESOLVER_PRIVATE_H__ */
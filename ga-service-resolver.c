@@ -10,11 +10,11 @@
 #include <systemd/sd-varlink.h>
 
 #include "ga-service-resolver.h"
-#include "ga-entry-group.h"  /* For GaStringList */
+#include "ga-service-resolver-private.h"
+#include "ga-service-browser-private.h"
+#include "ga-client-private.h"
 #include "ga-error.h"
 
-#define RESOLVED_VARLINK_ADDRESS "/run/systemd/resolve/io.systemd.Resolve"
-
 /* signal enum */
 enum {
     FOUND,
@@ -32,9 +32,21 @@ enum {
     PROP_TYPE,
     PROP_DOMAIN,
     PROP_FLAGS,
-    PROP_APROTOCOL
+    PROP_APROTOCOL,
+    PROP_WATCH,
+    PROP_TIMEOUT_MS,
+    PROP_CANCELLABLE,
+    PROP_PARALLEL_FAMILIES,
+    PROP_PRIORITY
 };
 
+/* One of the per-family lookups of the parallel-families mode */
+typedef struct {
+    GaServiceResolver *resolver;
+    GaVarlinkCall *call;
+    GaProtocol aprotocol;
+} FamilyLookup;
+
 struct _GaServiceResolverPrivate {
     GaClient *client;
     GaIfIndex interface;
@@ -48,6 +60,25 @@ struct _GaServiceResolverPrivate {
     GaProtocol aprotocol;
     GaLookupFlags flags;
     GaStringList *txt;
+    guint timeout_ms;
+    GaRequestPriority priority;
+    GCancellable *cancellable;
+    GSource *cancel_source;
+    GaVarlinkCall *call;        /* One-shot ResolveService in flight */
+    gboolean parallel_families;
+    FamilyLookup families[2];   /* IPv4 and IPv6 lookups */
+    GError *family_error;       /* First family that failed */
+    GVariant *family_result;    /* Answers of the families so far, merged */
+    gboolean family_reported;   /* A family's answer was reported */
+    gboolean cached_reported;   /* The stale result was reported first */
+    gboolean watch;
+    GaServiceBrowser *browser;  /* Follows the service in watch mode */
+    gchar *digest;              /* Of the last result reported */
+    GPtrArray *targets;         /* GaServiceTarget, in the order to try */
+    GHashTable *scopes;         /* Link-local address string -> ifindex */
+    gchar *cache_key;           /* Of the result in the client cache */
+    GVariant *cached;           /* Stale result to report first */
+    GSource *cached_source;
     gboolean dispose_has_run;
     gboolean resolved;
 };
@@ -70,11 +101,20 @@ static void ga_service_resolver_init(GaServiceResolver *obj) {
     priv->interface = GA_IF_UNSPEC;
     priv->protocol = GA_PROTOCOL_UNSPEC;
     priv->aprotocol = GA_PROTOCOL_UNSPEC;
+    priv->scopes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     priv->resolved = FALSE;
 }
 
 static void ga_service_resolver_dispose(GObject *object);
 static void ga_service_resolver_finalize(GObject *object);
+static void resolve_stop(GaServiceResolver *resolver);
+static gchar *result_digest(const gchar *host,
+                            GArray *addresses,
+                            guint16 port,
+                            GaStringList *txt);
+
+/* How long a resolved service stays usable for stale-while-revalidate */
+#define SERVICE_CACHE_TTL_MS (10 * 60 * 1000)
 
 static void ga_service_resolver_set_property(GObject *object,
                                              guint property_id,
@@ -108,6 +148,23 @@ static void ga_service_resolver_set_property(GObject *object,
         case PROP_FLAGS:
             priv->flags = g_value_get_flags(value);
             break;
+        case PROP_WATCH:
+            priv->watch = g_value_get_boolean(value);
+            break;
+        case PROP_TIMEOUT_MS:
+            priv->timeout_ms = g_value_get_uint(value);
+            break;
+        case PROP_CANCELLABLE:
+            if (priv->cancellable)
+                g_object_unref(priv->cancellable);
+            priv->cancellable = g_value_dup_object(value);
+            break;
+        case PROP_PRIORITY:
+            priv->priority = g_value_get_enum(value);
+            break;
+        case PROP_PARALLEL_FAMILIES:
+            priv->parallel_families = g_value_get_boolean(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -143,6 +200,21 @@ static void ga_service_resolver_get_property(GObject *object,
         case PROP_FLAGS:
             g_value_set_flags(value, priv->flags);
             break;
+        case PROP_WATCH:
+            g_value_set_boolean(value, priv->watch);
+            break;
+        case PROP_TIMEOUT_MS:
+            g_value_set_uint(value, priv->timeout_ms);
+            break;
+        case PROP_CANCELLABLE:
+            g_value_set_object(value, priv->cancellable);
+            break;
+        case PROP_PRIORITY:
+            g_value_set_enum(value, priv->priority);
+            break;
+        case PROP_PARALLEL_FAMILIES:
+            g_value_set_boolean(value, priv->parallel_families);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -231,6 +303,43 @@ static void ga_service_resolver_class_init(GaServiceResolverClass *klass) {
                                     GA_LOOKUP_NO_FLAGS,
                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
     g_object_class_install_property(object_class, PROP_FLAGS, param_spec);
+
+    /* Keep following the service after the first result; found is emitted
+     * again whenever its host, addresses, port or TXT change */
+    param_spec = g_param_spec_boolean("watch", "Watch",
+                                      "Report changes of the service after it was resolved",
+                                      FALSE,
+                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_WATCH, param_spec);
+
+    param_spec = g_param_spec_uint("timeout-ms", "Timeout",
+                                   "Deadline of the resolve in milliseconds, 0 for the default",
+                                   0, G_MAXUINT,
+                                   0,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_TIMEOUT_MS, param_spec);
+
+    /* Cancelling stops the resolver without emitting any further signal */
+    param_spec = g_param_spec_object("cancellable", "Cancellable",
+                                     "Cancellable to abort the resolve with",
+                                     G_TYPE_CANCELLABLE,
+                                     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_CANCELLABLE, param_spec);
+
+    param_spec = g_param_spec_enum("priority", "Priority",
+                                   "Scheduling class of the resolver's requests",
+                                   GA_TYPE_REQUEST_PRIORITY,
+                                   GA_REQUEST_PRIORITY_INTERACTIVE,
+                                   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PRIORITY, param_spec);
+
+    /* With aprotocol unspec, look up IPv4 and IPv6 separately and emit
+     * found as soon as either has an address, then again for the other */
+    param_spec = g_param_spec_boolean("parallel-families", "Parallel families",
+                                      "Resolve each address family on its own",
+                                      FALSE,
+                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_PARALLEL_FAMILIES, param_spec);
 }
 
 static void free_txt_list(GaStringList *list) {
@@ -250,6 +359,13 @@ void ga_service_resolver_dispose(GObject *object) {
 
     priv->dispose_has_run = TRUE;
 
+    resolve_stop(self);
+
+    if (priv->cancellable) {
+        g_object_unref(priv->cancellable);
+        priv->cancellable = NULL;
+    }
+
     if (priv->client) {
         g_object_unref(priv->client);
         priv->client = NULL;
@@ -267,202 +383,382 @@ void ga_service_resolver_finalize(GObject *object) {
     g_free(priv->type);
     g_free(priv->domain);
     g_free(priv->host);
+    g_free(priv->digest);
+    if (priv->targets)
+        g_ptr_array_unref(priv->targets);
+    g_hash_table_unref(priv->scopes);
+    g_free(priv->cache_key);
+    if (priv->family_error)
+        g_error_free(priv->family_error);
+    if (priv->family_result)
+        g_variant_unref(priv->family_result);
     free_txt_list(priv->txt);
 
     G_OBJECT_CLASS(ga_service_resolver_parent_class)->finalize(object);
 }
 
-/* Parse IP address from services array in ResolveService response */
-static gboolean extract_address_from_services(sd_json_variant *services_array,
-                                              GaAddress *out_address,
-                                              uint16_t *out_port,
-                                              GaProtocol preferred_proto) {
-    if (!services_array || !sd_json_variant_is_array(services_array))
+sd_json_variant *ga_service_resolve_build_params(GaIfIndex interface,
+                                                 const gchar *name,
+                                                 const gchar *type,
+                                                 const gchar *domain,
+                                                 GaProtocol aprotocol,
+                                                 GaLookupFlags flags,
+                                                 GError **error) {
+    sd_json_variant *params = NULL;
+    int family = AF_UNSPEC;
+    int r;
+
+    if (aprotocol == GA_PROTOCOL_INET)
+        family = AF_INET;
+    else if (aprotocol == GA_PROTOCOL_INET6)
+        family = AF_INET6;
+
+    /* GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
+     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics). */
+    r = sd_json_buildo(&params,
+                       SD_JSON_BUILD_PAIR_STRING("name", name),
+                       SD_JSON_BUILD_PAIR_STRING("type", type),
+                       SD_JSON_BUILD_PAIR_STRING("domain", domain ? domain : "local"),
+                       SD_JSON_BUILD_PAIR_INTEGER("ifindex", interface),
+                       SD_JSON_BUILD_PAIR_INTEGER("family", family),
+                       SD_JSON_BUILD_PAIR_UNSIGNED("flags", ga_varlink_lookup_flags(flags)));
+    if (r < 0) {
+        if (error) {
+            *error = g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                                 "Failed to build params: %s",
+                                 g_strerror(-r));
+        }
+        return NULL;
+    }
+
+    return params;
+}
+
+gboolean ga_address_from_json(sd_json_variant *addr_entry, GaAddress *out) {
+    sd_json_variant *family_v = sd_json_variant_by_key(addr_entry, "family");
+    sd_json_variant *address_v = sd_json_variant_by_key(addr_entry, "address");
+    uint8_t *bytes;
+    size_t len;
+
+    if (!family_v || !sd_json_variant_is_integer(family_v))
+        return FALSE;
+    if (!address_v || !sd_json_variant_is_array(address_v))
         return FALSE;
 
-    GaAddress ipv4_addr = { .proto = GA_PROTOCOL_INET };
-    GaAddress ipv6_addr = { .proto = GA_PROTOCOL_INET6 };
-    gboolean have_ipv4 = FALSE;
-    gboolean have_ipv6 = FALSE;
-    uint16_t port = 0;
+    int64_t family = sd_json_variant_integer(family_v);
+    size_t bn = sd_json_variant_elements(address_v);
 
-    size_t sn = sd_json_variant_elements(services_array);
+    memset(out, 0, sizeof(*out));
 
-    for (size_t si = 0; si < sn; si++) {
-        sd_json_variant *srv_entry = sd_json_variant_by_index(services_array, si);
-        if (!srv_entry || !sd_json_variant_is_object(srv_entry))
-            continue;
+    if (family == AF_INET && bn == 4) {
+        out->proto = GA_PROTOCOL_INET;
+        bytes = (uint8_t *)&out->data.ipv4.address;
+        len = 4;
+    } else if (family == AF_INET6 && bn == 16) {
+        out->proto = GA_PROTOCOL_INET6;
+        bytes = out->data.ipv6.address;
+        len = 16;
+    } else {
+        return FALSE;
+    }
 
-        /* Get port from service entry */
-        sd_json_variant *port_v = sd_json_variant_by_key(srv_entry, "port");
-        if (port_v && sd_json_variant_is_unsigned(port_v)) {
-            port = (uint16_t)sd_json_variant_unsigned(port_v);
-        }
+    for (size_t bi = 0; bi < len; bi++) {
+        sd_json_variant *b = sd_json_variant_by_index(address_v, bi);
+        if (b && sd_json_variant_is_unsigned(b))
+            bytes[bi] = (uint8_t)sd_json_variant_unsigned(b);
+    }
 
-        sd_json_variant *addr_array = sd_json_variant_by_key(srv_entry, "addresses");
-        if (!addr_array || !sd_json_variant_is_array(addr_array))
-            continue;
+    return TRUE;
+}
 
-        size_t an = sd_json_variant_elements(addr_array);
+static GVariant *address_to_variant(const GaAddress *address) {
+    return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                     address->data.data,
+                                     address->proto == GA_PROTOCOL_INET ? 4 : 16,
+                                     1);
+}
 
-        for (size_t ai = 0; ai < an; ai++) {
-            sd_json_variant *addr_entry = sd_json_variant_by_index(addr_array, ai);
-            if (!addr_entry || !sd_json_variant_is_object(addr_entry))
-                continue;
+/*
+ * SRV targets.
+ *
+ * Targets are ordered as RFC 2782 asks: by priority, and within a priority
+ * by weighted random selection. The random choices are seeded from the
+ * target set and a per-process seed, so a process keeps the same order for
+ * an unchanged record set (re-resolves do not look like changes) while
+ * different processes still spread over the targets.
+ */
 
-            sd_json_variant *family_v = sd_json_variant_by_key(addr_entry, "family");
-            sd_json_variant *address_v = sd_json_variant_by_key(addr_entry, "address");
+typedef struct {
+    const char *host;
+    guint16 priority;
+    guint16 weight;
+    guint16 port;
+    guint index;        /* Position in the reply, for a stable sort */
+    GArray *addresses;  /* GaAddress */
+} SrvTarget;
+
+static gint srv_target_compare(gconstpointer a, gconstpointer b) {
+    const SrvTarget *x = a;
+    const SrvTarget *y = b;
+
+    if (x->priority != y->priority)
+        return x->priority < y->priority ? -1 : 1;
+    /* Zero weight entries go first, RFC 2782 */
+    if ((x->weight == 0) != (y->weight == 0))
+        return x->weight == 0 ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
 
-            if (!family_v || !sd_json_variant_is_integer(family_v))
-                continue;
-            if (!address_v || !sd_json_variant_is_array(address_v))
-                continue;
+static guint32 srv_order_seed(GArray *targets) {
+    static gsize process_seed = 0;
+    guint32 seed;
 
-            int64_t family = sd_json_variant_integer(family_v);
-            size_t bn = sd_json_variant_elements(address_v);
+    if (g_once_init_enter(&process_seed))
+        g_once_init_leave(&process_seed, (gsize)g_random_int() | 1);
 
-            if (family == AF_INET && bn == 4) {
-                uint8_t *addr_bytes = (uint8_t *)&ipv4_addr.data.ipv4.address;
-                for (size_t bi = 0; bi < 4; bi++) {
-                    sd_json_variant *b = sd_json_variant_by_index(address_v, bi);
-                    if (b && sd_json_variant_is_unsigned(b)) {
-                        addr_bytes[bi] = (uint8_t)sd_json_variant_unsigned(b);
-                    }
-                }
-                have_ipv4 = TRUE;
-            } else if (family == AF_INET6 && bn == 16) {
-                for (size_t bi = 0; bi < 16; bi++) {
-                    sd_json_variant *b = sd_json_variant_by_index(address_v, bi);
-                    if (b && sd_json_variant_is_unsigned(b)) {
-                        ipv6_addr.data.ipv6.address[bi] = (uint8_t)sd_json_variant_unsigned(b);
-                    }
+    seed = (guint32)process_seed;
+    for (guint i = 0; i < targets->len; i++) {
+        const SrvTarget *t = &g_array_index(targets, SrvTarget, i);
+        seed = seed * 31 + (t->host ? g_str_hash(t->host) : 0);
+        seed = seed * 31 + ((guint32)t->priority << 16 | t->weight);
+        seed = seed * 31 + t->port;
+    }
+
+    return seed;
+}
+
+static void srv_targets_order(GArray *targets) {
+    GRand *rand;
+    guint start = 0;
+
+    if (targets->len < 2)
+        return;
+
+    g_array_sort(targets, srv_target_compare);
+    rand = g_rand_new_with_seed(srv_order_seed(targets));
+
+    while (start < targets->len) {
+        guint16 priority = g_array_index(targets, SrvTarget, start).priority;
+        guint end = start;
+
+        while (end < targets->len && g_array_index(targets, SrvTarget, end).priority == priority)
+            end++;
+
+        /* Pick each position of the group by weight among the rest */
+        for (guint i = start; i + 1 < end; i++) {
+            guint32 sum = 0;
+            guint32 running = 0;
+            guint pick = i;
+
+            for (guint k = i; k < end; k++)
+                sum += g_array_index(targets, SrvTarget, k).weight;
+            if (sum == 0)
+                break;
+
+            guint32 r = (guint32)g_rand_int_range(rand, 0, (gint32)sum + 1);
+            for (guint k = i; k < end; k++) {
+                running += g_array_index(targets, SrvTarget, k).weight;
+                if (running >= r) {
+                    pick = k;
+                    break;
                 }
-                have_ipv6 = TRUE;
+            }
+
+            /* Take the pick out and keep the rest in order (RFC 2782):
+             * zero-weight targets sorted first stay ahead of the others */
+            if (pick != i) {
+                SrvTarget picked = g_array_index(targets, SrvTarget, pick);
+                memmove(&g_array_index(targets, SrvTarget, i + 1),
+                        &g_array_index(targets, SrvTarget, i),
+                        (pick - i) * sizeof(SrvTarget));
+                g_array_index(targets, SrvTarget, i) = picked;
             }
         }
+
+        start = end;
     }
 
-    /* Select address based on preference */
-    if (preferred_proto == GA_PROTOCOL_INET && have_ipv4) {
-        *out_address = ipv4_addr;
-        *out_port = port;
-        return TRUE;
-    } else if (preferred_proto == GA_PROTOCOL_INET6 && have_ipv6) {
-        *out_address = ipv6_addr;
-        *out_port = port;
-        return TRUE;
-    } else if (have_ipv4) {
-        *out_address = ipv4_addr;
-        *out_port = port;
-        return TRUE;
-    } else if (have_ipv6) {
-        *out_address = ipv6_addr;
-        *out_port = port;
-        return TRUE;
+    g_rand_free(rand);
+}
+
+/* First address of a target in @proto, NULL if it has none */
+static const GaAddress *srv_target_find_address(const SrvTarget *t, GaProtocol proto) {
+    for (guint i = 0; i < t->addresses->len; i++) {
+        const GaAddress *a = &g_array_index(t->addresses, GaAddress, i);
+        if (a->proto == proto)
+            return a;
     }
 
-    return FALSE;
+    return NULL;
 }
 
-/* Resolve task data */
-typedef struct {
-    GaServiceResolver *resolver;
-    char *name;
-    char *type;
-    char *domain;
-    int ifindex;
-    GaProtocol aprotocol;
-} ResolveTaskData;
+/*
+ * Preferred address of a target: of @aprotocol if it has one, else IPv4,
+ * else its first. IPv4 wins for GA_PROTOCOL_UNSPEC as it always has: the
+ * single address reported carries no scope, which a link-local IPv6 one
+ * needs. All addresses are available through "targets" and "addresses".
+ */
+static const GaAddress *srv_target_address(const SrvTarget *t, GaProtocol aprotocol) {
+    const GaAddress *a = NULL;
 
-static void resolve_task_data_free(ResolveTaskData *data) {
-    g_free(data->name);
-    g_free(data->type);
-    g_free(data->domain);
-    g_free(data);
+    if (t->addresses->len == 0)
+        return NULL;
+
+    if (aprotocol != GA_PROTOCOL_UNSPEC)
+        a = srv_target_find_address(t, aprotocol);
+    if (!a)
+        a = srv_target_find_address(t, GA_PROTOCOL_INET);
+
+    return a ? a : &g_array_index(t->addresses, GaAddress, 0);
 }
 
-static void resolve_task_thread(GTask *task,
-                                G_GNUC_UNUSED gpointer source_object,
-                                gpointer task_data,
-                                G_GNUC_UNUSED GCancellable *cancellable) {
-    ResolveTaskData *data = task_data;
-    sd_varlink *vl = NULL;
-    sd_json_variant *params = NULL;
-    sd_json_variant *reply = NULL;
-    const char *error_id = NULL;
-    int r;
+GVariant *ga_service_resolve_parse_reply(sd_json_variant *reply,
+                                         GaProtocol aprotocol) {
+    GVariantBuilder builder;
+    GVariantBuilder addresses;
+    GVariantBuilder targets_builder;
+    GVariantBuilder scopes;
+    GArray *targets = g_array_new(FALSE, TRUE, sizeof(SrvTarget));
+    const SrvTarget *selected = NULL;
+    gboolean have_any = FALSE;
+    gboolean have_scopes = FALSE;
 
-    r = sd_varlink_connect_address(&vl, RESOLVED_VARLINK_ADDRESS);
-    if (r < 0) {
-        g_task_return_new_error(task, GA_ERROR, GA_ERROR_NO_DAEMON,
-                                "Failed to connect to systemd-resolved: %s",
-                                g_strerror(-r));
-        goto out;
-    }
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_init(&addresses, G_VARIANT_TYPE("a(iay)"));
+    g_variant_builder_init(&targets_builder, G_VARIANT_TYPE("a(sqqqa(iay))"));
+    g_variant_builder_init(&scopes, G_VARIANT_TYPE("a{si}"));
 
-    int family = AF_UNSPEC;
-    if (data->aprotocol == GA_PROTOCOL_INET)
-        family = AF_INET;
-    else if (data->aprotocol == GA_PROTOCOL_INET6)
-        family = AF_INET6;
+    sd_json_variant *services = sd_json_variant_by_key(reply, "services");
+    sd_json_variant *txt = sd_json_variant_by_key(reply, "txt");
+    sd_json_variant *flags = sd_json_variant_by_key(reply, "flags");
 
-    r = sd_json_buildo(&params,
-                       SD_JSON_BUILD_PAIR_STRING("name", data->name),
-                       SD_JSON_BUILD_PAIR_STRING("type", data->type),
-                       SD_JSON_BUILD_PAIR_STRING("domain", data->domain),
-                       SD_JSON_BUILD_PAIR_INTEGER("ifindex", data->ifindex),
-                       SD_JSON_BUILD_PAIR_INTEGER("family", family),
-                       SD_JSON_BUILD_PAIR_UNSIGNED("flags", 0));
-    if (r < 0) {
-        g_task_return_new_error(task, GA_ERROR, GA_ERROR_FAILURE,
-                                "Failed to build params: %s",
-                                g_strerror(-r));
-        goto out;
-    }
+    size_t sn = (services && sd_json_variant_is_array(services))
+                ? sd_json_variant_elements(services) : 0;
 
-    r = sd_varlink_call(vl,
-                        "io.systemd.Resolve.ResolveService",
-                        params,
-                        &reply,
-                        &error_id);
-    if (r < 0) {
-        g_task_return_new_error(task, GA_ERROR, GA_ERROR_FAILURE,
-                                "ResolveService call failed: %s",
-                                g_strerror(-r));
-        goto out;
+    for (size_t si = 0; si < sn; si++) {
+        sd_json_variant *srv_entry = sd_json_variant_by_index(services, si);
+        SrvTarget target = { .index = (guint)si };
+
+        if (!srv_entry || !sd_json_variant_is_object(srv_entry))
+            continue;
+
+        sd_json_variant *v = sd_json_variant_by_key(srv_entry, "priority");
+        if (v && sd_json_variant_is_unsigned(v))
+            target.priority = (guint16)sd_json_variant_unsigned(v);
+        v = sd_json_variant_by_key(srv_entry, "weight");
+        if (v && sd_json_variant_is_unsigned(v))
+            target.weight = (guint16)sd_json_variant_unsigned(v);
+        v = sd_json_variant_by_key(srv_entry, "port");
+        if (v && sd_json_variant_is_unsigned(v))
+            target.port = (guint16)sd_json_variant_unsigned(v);
+        v = sd_json_variant_by_key(srv_entry, "hostname");
+        if (v && sd_json_variant_is_string(v))
+            target.host = sd_json_variant_string(v);
+
+        target.addresses = g_array_new(FALSE, TRUE, sizeof(GaAddress));
+
+        sd_json_variant *addr_array = sd_json_variant_by_key(srv_entry, "addresses");
+        size_t an = (addr_array && sd_json_variant_is_array(addr_array))
+                    ? sd_json_variant_elements(addr_array) : 0;
+
+        for (size_t ai = 0; ai < an; ai++) {
+            sd_json_variant *addr_entry = sd_json_variant_by_index(addr_array, ai);
+            GaAddress address;
+
+            if (!addr_entry || !sd_json_variant_is_object(addr_entry))
+                continue;
+            if (!ga_address_from_json(addr_entry, &address))
+                continue;
+
+            /* Link-local IPv6 addresses are useless without their interface */
+            sd_json_variant *ifindex_v = sd_json_variant_by_key(addr_entry, "ifindex");
+            if (ga_address_is_link_local(&address) && ifindex_v &&
+                sd_json_variant_is_integer(ifindex_v) && sd_json_variant_integer(ifindex_v) > 0) {
+                gchar buf[INET6_ADDRSTRLEN];
+
+                if (ga_address_snprint(buf, sizeof(buf), &address)) {
+                    g_variant_builder_add(&scopes, "{si}", buf,
+                                          (gint32)sd_json_variant_integer(ifindex_v));
+                    have_scopes = TRUE;
+                }
+            }
+
+            g_array_append_val(target.addresses, address);
+        }
+
+        g_array_append_val(targets, target);
     }
 
-    if (error_id) {
-        g_task_return_new_error(task, GA_ERROR, GA_ERROR_NOT_FOUND,
-                                "ResolveService error: %s", error_id);
-        goto out;
+    srv_targets_order(targets);
+
+    for (guint i = 0; i < targets->len; i++) {
+        const SrvTarget *t = &g_array_index(targets, SrvTarget, i);
+        GVariantBuilder target_addresses;
+
+        g_variant_builder_init(&target_addresses, G_VARIANT_TYPE("a(iay)"));
+        for (guint ai = 0; ai < t->addresses->len; ai++) {
+            const GaAddress *a = &g_array_index(t->addresses, GaAddress, ai);
+            g_variant_builder_add(&target_addresses, "(i@ay)", a->proto, address_to_variant(a));
+            g_variant_builder_add(&addresses, "(i@ay)", a->proto, address_to_variant(a));
+            have_any = TRUE;
+        }
+
+        g_variant_builder_add(&targets_builder, "(sqqq@a(iay))",
+                              t->host ? t->host : "",
+                              t->priority, t->weight, t->port,
+                              g_variant_builder_end(&target_addresses));
+
+        /* The first target that has an address is used */
+        if (!selected && t->addresses->len > 0)
+            selected = t;
     }
 
-    /* Parse the response */
-    GVariantBuilder builder;
-    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    if (!selected && targets->len > 0)
+        selected = &g_array_index(targets, SrvTarget, 0);
 
-    sd_json_variant *services = sd_json_variant_by_key(reply, "services");
-    sd_json_variant *txt = sd_json_variant_by_key(reply, "txt");
+    if (selected) {
+        const GaAddress *preferred = srv_target_address(selected, aprotocol);
 
-    GaAddress address = {0};
-    uint16_t port = 0;
-    if (extract_address_from_services(services, &address, &port, data->aprotocol)) {
-        g_variant_builder_add(&builder, "{sv}", "port",
-                              g_variant_new_uint16(port));
-        g_variant_builder_add(&builder, "{sv}", "proto",
-                              g_variant_new_int32(address.proto));
-        if (address.proto == GA_PROTOCOL_INET) {
-            g_variant_builder_add(&builder, "{sv}", "address",
-                                  g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
-                                                            &address.data.ipv4.address, 4, 1));
-        } else {
+        if (selected->host)
+            g_variant_builder_add(&builder, "{sv}", "host",
+                                  g_variant_new_string(selected->host));
+        if (preferred) {
+            g_variant_builder_add(&builder, "{sv}", "port",
+                                  g_variant_new_uint16(selected->port));
+            g_variant_builder_add(&builder, "{sv}", "proto",
+                                  g_variant_new_int32(preferred->proto));
             g_variant_builder_add(&builder, "{sv}", "address",
-                                  g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
-                                                            address.data.ipv6.address, 16, 1));
+                                  address_to_variant(preferred));
         }
     }
 
+    if (have_any)
+        g_variant_builder_add(&builder, "{sv}", "addresses",
+                              g_variant_builder_end(&addresses));
+    else
+        g_variant_builder_clear(&addresses);
+
+    if (targets->len > 0)
+        g_variant_builder_add(&builder, "{sv}", "targets",
+                              g_variant_builder_end(&targets_builder));
+    else
+        g_variant_builder_clear(&targets_builder);
+
+    if (have_scopes)
+        g_variant_builder_add(&builder, "{sv}", "scopes",
+                              g_variant_builder_end(&scopes));
+    else
+        g_variant_builder_clear(&scopes);
+
+    g_variant_builder_add(&builder, "{sv}", "flags",
+                          g_variant_new_uint32(ga_varlink_result_flags(
+                              flags && sd_json_variant_is_unsigned(flags)
+                              ? sd_json_variant_unsigned(flags) : 0)));
+
+    for (guint i = 0; i < targets->len; i++)
+        g_array_unref(g_array_index(targets, SrvTarget, i).addresses);
+    g_array_unref(targets);
+
     /* TXT records as string array */
     if (txt && sd_json_variant_is_array(txt)) {
         GVariantBuilder txt_builder;
@@ -479,161 +775,1455 @@ static void resolve_task_thread(GTask *task,
                               g_variant_builder_end(&txt_builder));
     }
 
-    g_task_return_pointer(task, g_variant_ref_sink(g_variant_builder_end(&builder)),
-                          (GDestroyNotify)g_variant_unref);
-
-out:
-    if (params)
-        sd_json_variant_unref(params);
-    if (vl)
-        sd_varlink_unref(vl);
+    return g_variant_builder_end(&builder);
 }
 
-static void resolve_complete_cb(GObject *source,
-                                GAsyncResult *result,
-                                G_GNUC_UNUSED gpointer user_data) {
-    GaServiceResolver *resolver = GA_SERVICE_RESOLVER(source);
-    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
-    GError *error = NULL;
-
-    GVariant *response = g_task_propagate_pointer(G_TASK(result), &error);
-    if (!response) {
-        g_signal_emit(resolver, signals[FAILURE], 0, error);
-        g_error_free(error);
-        return;
-    }
+gboolean ga_service_resolve_result_get_address(GVariant *result, GaAddress *address) {
+    GVariant *proto_v = g_variant_lookup_value(result, "proto", G_VARIANT_TYPE_INT32);
+    GVariant *addr_v = g_variant_lookup_value(result, "address", G_VARIANT_TYPE_BYTESTRING);
+    gboolean ok = FALSE;
 
-    /* Extract data from response */
-    GVariant *port_v = g_variant_lookup_value(response, "port", G_VARIANT_TYPE_UINT16);
-    GVariant *proto_v = g_variant_lookup_value(response, "proto", G_VARIANT_TYPE_INT32);
-    GVariant *addr_v = g_variant_lookup_value(response, "address", G_VARIANT_TYPE_BYTESTRING);
-    GVariant *txt_v = g_variant_lookup_value(response, "txt", G_VARIANT_TYPE_STRING_ARRAY);
+    if (proto_v && addr_v) {
+        gsize n_elements;
+        const guint8 *data = g_variant_get_fixed_array(addr_v, &n_elements, 1);
 
-    if (port_v) {
-        priv->port = g_variant_get_uint16(port_v);
-        g_variant_unref(port_v);
+        memset(address, 0, sizeof(*address));
+        address->proto = g_variant_get_int32(proto_v);
+        if (address->proto == GA_PROTOCOL_INET && n_elements >= 4) {
+            memcpy(&address->data.ipv4.address, data, 4);
+            ok = TRUE;
+        } else if (address->proto == GA_PROTOCOL_INET6 && n_elements >= 16) {
+            memcpy(address->data.ipv6.address, data, 16);
+            ok = TRUE;
+        }
     }
 
-    if (proto_v) {
-        priv->address.proto = g_variant_get_int32(proto_v);
+    if (proto_v)
         g_variant_unref(proto_v);
+    if (addr_v)
+        g_variant_unref(addr_v);
+
+    return ok;
+}
+
+GArray *ga_service_resolve_result_get_addresses(GVariant *result) {
+    GArray *array = g_array_new(FALSE, TRUE, sizeof(GaAddress));
+    GVariant *addresses = g_variant_lookup_value(result, "addresses", G_VARIANT_TYPE("a(iay)"));
+    GVariantIter iter;
+    GVariant *bytes;
+    gint32 proto;
+
+    if (!addresses)
+        return array;
+
+    g_variant_iter_init(&iter, addresses);
+    while (g_variant_iter_next(&iter, "(i@ay)", &proto, &bytes)) {
+        GaAddress address = { .proto = proto };
+        gsize n;
+        const guint8 *data = g_variant_get_fixed_array(bytes, &n, 1);
+
+        if (n <= sizeof(address.data.data)) {
+            memcpy(address.data.data, data, n);
+            g_array_append_val(array, address);
+        }
+        g_variant_unref(bytes);
     }
 
-    if (addr_v) {
-        gsize n_elements;
-        const guint8 *data = g_variant_get_fixed_array(addr_v, &n_elements, 1);
-        if (priv->address.proto == GA_PROTOCOL_INET && n_elements >= 4) {
-            memcpy(&priv->address.data.ipv4.address, data, 4);
-        } else if (priv->address.proto == GA_PROTOCOL_INET6 && n_elements >= 16) {
-            memcpy(priv->address.data.ipv6.address, data, 16);
+    g_variant_unref(addresses);
+    return array;
+}
+
+GaStringList *ga_service_resolve_result_get_txt(GVariant *result) {
+    GVariant *txt_v = g_variant_lookup_value(result, "txt", G_VARIANT_TYPE_STRING_ARRAY);
+    GaStringList *head = NULL;
+    GaStringList *tail = NULL;
+
+    if (!txt_v)
+        return NULL;
+
+    gsize n;
+    const gchar **txt_array = g_variant_get_strv(txt_v, &n);
+
+    for (gsize i = 0; i < n; i++) {
+        size_t len = strlen(txt_array[i]);
+        GaStringList *node = g_malloc(sizeof(GaStringList) + len);
+        node->next = NULL;
+        node->size = len;
+        memcpy(node->text, txt_array[i], len + 1);
+
+        if (tail) {
+            tail->next = node;
+            tail = node;
+        } else {
+            head = tail = node;
         }
-        g_variant_unref(addr_v);
     }
 
-    /* Build TXT list */
-    if (txt_v) {
-        gsize n;
-        const gchar **txt_array = g_variant_get_strv(txt_v, &n);
-        GaStringList *head = NULL;
-        GaStringList *tail = NULL;
-
-        for (gsize i = 0; i < n; i++) {
-            size_t len = strlen(txt_array[i]);
-            GaStringList *node = g_malloc(sizeof(GaStringList) + len);
-            node->next = NULL;
-            node->size = len;
-            memcpy(node->text, txt_array[i], len + 1);
-
-            if (tail) {
-                tail->next = node;
-                tail = node;
-            } else {
-                head = tail = node;
+    g_free(txt_array);
+    g_variant_unref(txt_v);
+
+    return head;
+}
+
+void ga_service_target_free(GaServiceTarget *target) {
+    if (!target)
+        return;
+
+    g_free(target->host);
+    if (target->addresses)
+        g_array_unref(target->addresses);
+    g_free(target);
+}
+
+GPtrArray *ga_service_resolve_result_get_targets(GVariant *result) {
+    GPtrArray *array = g_ptr_array_new_with_free_func((GDestroyNotify)ga_service_target_free);
+    GVariant *targets = g_variant_lookup_value(result, "targets", G_VARIANT_TYPE("a(sqqqa(iay))"));
+    GVariantIter iter;
+    GVariantIter *addresses;
+    const gchar *host;
+    guint16 priority, weight, port;
+
+    if (!targets)
+        return array;
+
+    g_variant_iter_init(&iter, targets);
+    while (g_variant_iter_next(&iter, "(&sqqqa(iay))", &host, &priority, &weight, &port, &addresses)) {
+        GaServiceTarget *target = g_new0(GaServiceTarget, 1);
+        GVariant *bytes;
+        gint32 proto;
+
+        target->host = g_strdup(host);
+        target->priority = priority;
+        target->weight = weight;
+        target->port = port;
+        target->addresses = g_array_new(FALSE, TRUE, sizeof(GaAddress));
+
+        while (g_variant_iter_next(addresses, "(i@ay)", &proto, &bytes)) {
+            GaAddress address = { .proto = proto };
+            gsize n;
+            const guint8 *data = g_variant_get_fixed_array(bytes, &n, 1);
+
+            if (n <= sizeof(address.data.data)) {
+                memcpy(address.data.data, data, n);
+                g_array_append_val(target->addresses, address);
             }
+            g_variant_unref(bytes);
         }
-        priv->txt = head;
-        g_free(txt_array);
-        g_variant_unref(txt_v);
+
+        g_variant_iter_free(addresses);
+        g_ptr_array_add(array, target);
     }
 
-    priv->resolved = TRUE;
+    g_variant_unref(targets);
+    return array;
+}
 
-    /* Emit found signal */
-    GaLookupResultFlags result_flags = GA_LOOKUP_RESULT_MULTICAST;
-    g_signal_emit(resolver, signals[FOUND], 0,
-                  priv->interface,
-                  priv->protocol,
-                  priv->name,
-                  priv->type,
-                  priv->domain,
-                  priv->host ? priv->host : "",
-                  &priv->address,
-                  (gint)priv->port,
-                  priv->txt,
-                  result_flags);
+gboolean ga_service_resolve_result_equal(GVariant *a, GVariant *b) {
+    GVariantIter iter;
+    const gchar *key;
+    GVariant *value;
+    gsize n = 0;
+
+    g_variant_iter_init(&iter, a);
+    while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+        gboolean equal = TRUE;
+
+        if (strcmp(key, "flags") != 0) {
+            GVariant *other = g_variant_lookup_value(b, key, NULL);
+
+            equal = other && g_variant_equal(value, other);
+            if (other)
+                g_variant_unref(other);
+            n++;
+        }
+
+        g_variant_unref(value);
+        if (!equal)
+            return FALSE;
+    }
+
+    /* Nothing in @b that @a lacks */
+    gsize m = g_variant_n_children(b);
+    guint32 flags;
+    if (g_variant_lookup(b, "flags", "u", &flags))
+        m--;
 
-    g_variant_unref(response);
+    return m == n;
 }
 
-GaServiceResolver *ga_service_resolver_new(GaIfIndex interface,
-                                           GaProtocol protocol,
-                                           const gchar *name,
-                                           const gchar *type,
-                                           const gchar *domain,
-                                           GaProtocol address_protocol,
-                                           GaLookupFlags flags) {
-    return g_object_new(GA_TYPE_SERVICE_RESOLVER,
-                        "interface", interface,
-                        "protocol", protocol,
-                        "name", name,
-                        "type", type,
-                        "domain", domain,
-                        "aprotocol", address_protocol,
-                        "flags", flags,
-                        NULL);
+gboolean ga_address_is_link_local(const GaAddress *address) {
+    return address->proto == GA_PROTOCOL_INET6 &&
+           address->data.ipv6.address[0] == 0xfe &&
+           (address->data.ipv6.address[1] & 0xc0) == 0x80;
 }
 
-gboolean ga_service_resolver_attach(GaServiceResolver *resolver,
-                                    GaClient *client,
-                                    G_GNUC_UNUSED GError **error) {
-    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+void ga_service_resolve_result_get_scopes(GVariant *result, GHashTable *scopes) {
+    GVariant *scopes_v = g_variant_lookup_value(result, "scopes", G_VARIANT_TYPE("a{si}"));
+    GVariantIter iter;
+    const gchar *address;
+    gint32 ifindex;
 
-    g_return_val_if_fail(IS_GA_SERVICE_RESOLVER(resolver), FALSE);
-    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+    if (!scopes_v)
+        return;
 
-    g_object_ref(client);
-    priv->client = client;
+    g_variant_iter_init(&iter, scopes_v);
+    while (g_variant_iter_next(&iter, "{&si}", &address, &ifindex))
+        g_hash_table_replace(scopes, g_strdup(address), GINT_TO_POINTER(ifindex));
 
-    /* Start async resolution.
-     * GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
-     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics). */
-    ResolveTaskData *data = g_new0(ResolveTaskData, 1);
-    data->resolver = resolver;
-    data->name = g_strdup(priv->name);
-    data->type = g_strdup(priv->type);
-    data->domain = g_strdup(priv->domain ? priv->domain : "local");
-    data->ifindex = priv->interface;
-    data->aprotocol = priv->aprotocol;
-
-    GTask *task = g_task_new(resolver, NULL, resolve_complete_cb, NULL);
-    g_task_set_task_data(task, data, (GDestroyNotify)resolve_task_data_free);
-    g_task_run_in_thread(task, resolve_task_thread);
-    g_object_unref(task);
+    g_variant_unref(scopes_v);
+}
 
-    return TRUE;
+typedef struct {
+    GaProtocol aprotocol;
+    GaServiceResolveFunc func;
+    gpointer user_data;
+} ResolveCallData;
+
+static void resolve_call_reply_cb(sd_json_variant *reply,
+                                  const GError *error,
+                                  gpointer user_data) {
+    ResolveCallData *data = user_data;
+
+    if (error) {
+        data->func(NULL, error, data->user_data);
+    } else {
+        GVariant *result = g_variant_ref_sink(ga_service_resolve_parse_reply(reply, data->aprotocol));
+        data->func(result, NULL, data->user_data);
+        g_variant_unref(result);
+    }
 }
 
-gboolean ga_service_resolver_get_address(GaServiceResolver *resolver,
-                                         GaAddress *address,
-                                         uint16_t *port) {
-    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+GaVarlinkCall *ga_service_resolve_start(GaClient *client,
+                                        gconstpointer owner,
+                                        GaRequestPriority priority,
+                                        GaIfIndex interface,
+                                        const gchar *name,
+                                        const gchar *type,
+                                        const gchar *domain,
+                                        GaProtocol aprotocol,
+                                        GaLookupFlags flags,
+                                        guint timeout_ms,
+                                        GaServiceResolveFunc func,
+                                        gpointer user_data) {
+    sd_json_variant *params;
+    GaVarlinkCall *call;
+
+    /* Only fails on allocation errors; resolved then rejects the call and
+     * the error reaches @func like any other */
+    params = ga_service_resolve_build_params(interface, name, type, domain,
+                                             aprotocol, flags, NULL);
+
+    ResolveCallData *data = g_new0(ResolveCallData, 1);
+    data->aprotocol = aprotocol;
+    data->func = func;
+    data->user_data = user_data;
+
+    call = ga_client_call_full(client, owner, priority,
+                               "io.systemd.Resolve.ResolveService", params,
+                               timeout_ms, resolve_call_reply_cb, data, g_free);
 
-    if (!priv->resolved || priv->port == 0)
-        return FALSE;
+    if (params)
+        sd_json_variant_unref(params);
 
-    *address = priv->address;
-    *port = priv->port;
-    return TRUE;
+    return call;
+}
+
+/*
+ * Batch resolution.
+ *
+ * Every request is one ResolveService call on the client's pool; at most
+ * max_concurrent of them are handed to the pool at a time, so a large
+ * batch does not crowd out the client's other calls.
+ */
+
+typedef struct _ResolveBatch ResolveBatch;
+
+typedef struct {
+    ResolveBatch *batch;
+    guint index;
+    GaVarlinkCall *call;
+} ResolveBatchItem;
+
+struct _ResolveBatch {
+    GTask *task;
+    GaClient *client;
+    GaServiceResolveRequest *requests;
+    ResolveBatchItem *items;
+    guint n_requests;
+    guint next;
+    guint in_flight;
+    guint completed;
+    guint max_concurrent;
+    GPtrArray *results;
+    GaServiceResolveProgressFunc progress;
+    gpointer progress_data;
+    GSource *cancel_source;
+};
+
+void ga_service_resolve_result_free(GaServiceResolveResult *result) {
+    if (!result)
+        return;
+
+    g_free(result->host);
+    free_txt_list(result->txt);
+    if (result->error)
+        g_error_free(result->error);
+    g_free(result);
+}
+
+/* Stop everything that could still touch the batch once it returned */
+static void resolve_batch_stop(ResolveBatch *batch) {
+    for (guint i = 0; i < batch->n_requests; i++) {
+        if (batch->items[i].call) {
+            ga_varlink_call_cancel(batch->items[i].call);
+            batch->items[i].call = NULL;
+        }
+    }
+    batch->next = batch->n_requests;
+
+    if (batch->cancel_source) {
+        g_source_destroy(batch->cancel_source);
+        g_source_unref(batch->cancel_source);
+        batch->cancel_source = NULL;
+    }
+}
+
+static void resolve_batch_free(ResolveBatch *batch) {
+    resolve_batch_stop(batch);
+
+    for (guint i = 0; i < batch->n_requests; i++) {
+        g_free((gchar *)batch->requests[i].name);
+        g_free((gchar *)batch->requests[i].type);
+        g_free((gchar *)batch->requests[i].domain);
+    }
+
+    g_ptr_array_unref(batch->results);
+    g_free(batch->requests);
+    g_free(batch->items);
+    g_object_unref(batch->client);
+    g_free(batch);
+}
+
+static void resolve_batch_reply_cb(GVariant *result,
+                                   const GError *error,
+                                   gpointer user_data);
+
+static void resolve_batch_pump(ResolveBatch *batch) {
+    while (batch->next < batch->n_requests &&
+           batch->in_flight < batch->max_concurrent) {
+        ResolveBatchItem *item = &batch->items[batch->next];
+        const GaServiceResolveRequest *request = &batch->requests[batch->next];
+
+        batch->next++;
+        batch->in_flight++;
+        item->call = ga_service_resolve_start(batch->client,
+                                              batch,
+                                              GA_REQUEST_PRIORITY_INTERACTIVE,
+                                              request->interface,
+                                              request->name,
+                                              request->type,
+                                              request->domain,
+                                              request->aprotocol,
+                                              request->flags,
+                                              0,
+                                              resolve_batch_reply_cb,
+                                              item);
+    }
+}
+
+static void resolve_batch_reply_cb(GVariant *result,
+                                   const GError *error,
+                                   gpointer user_data) {
+    ResolveBatchItem *item = user_data;
+    ResolveBatch *batch = item->batch;
+    GaServiceResolveResult *res = g_new0(GaServiceResolveResult, 1);
+
+    item->call = NULL;
+    batch->in_flight--;
+    batch->completed++;
+
+    if (error) {
+        res->error = g_error_copy(error);
+    } else {
+        GVariant *port_v = g_variant_lookup_value(result, "port", G_VARIANT_TYPE_UINT16);
+        if (port_v) {
+            res->port = g_variant_get_uint16(port_v);
+            g_variant_unref(port_v);
+        }
+        g_variant_lookup(result, "host", "s", &res->host);
+        ga_service_resolve_result_get_address(result, &res->address);
+        res->txt = ga_service_resolve_result_get_txt(result);
+    }
+
+    g_ptr_array_index(batch->results, item->index) = res;
+
+    if (batch->progress)
+        batch->progress(item->index, res, batch->progress_data);
+
+    if (batch->completed < batch->n_requests) {
+        resolve_batch_pump(batch);
+        return;
+    }
+
+    GTask *task = batch->task;
+    resolve_batch_stop(batch);
+    g_task_return_pointer(task, g_ptr_array_ref(batch->results),
+                          (GDestroyNotify)g_ptr_array_unref);
+    g_object_unref(task);
+}
+
+static gboolean resolve_batch_cancelled_cb(G_GNUC_UNUSED GCancellable *cancellable,
+                                           gpointer user_data) {
+    ResolveBatch *batch = user_data;
+    GTask *task = batch->task;
+
+    g_debug("GaServiceResolver: Batch cancelled after %u of %u requests",
+            batch->completed, batch->n_requests);
+
+    resolve_batch_stop(batch);
+    g_task_return_error_if_cancelled(task);
+    g_object_unref(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+void ga_client_resolve_services_async(GaClient *client,
+                                      const GaServiceResolveRequest *requests,
+                                      guint n_requests,
+                                      guint max_concurrent,
+                                      GaServiceResolveProgressFunc progress,
+                                      gpointer progress_data,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data) {
+    g_return_if_fail(IS_GA_CLIENT(client));
+    g_return_if_fail(requests != NULL || n_requests == 0);
+
+    GTask *task = g_task_new(client, cancellable, callback, user_data);
+    g_task_set_source_tag(task, ga_client_resolve_services_async);
+
+    if (!ga_client_has_feature(client, GA_CLIENT_FEATURE_RESOLVE_SERVICE)) {
+        g_task_return_new_error(task, GA_ERROR, GA_ERROR_NOT_SUPPORTED,
+                                "systemd-resolved does not support ResolveService");
+        g_object_unref(task);
+        return;
+    }
+
+    ResolveBatch *batch = g_new0(ResolveBatch, 1);
+    batch->task = task;
+    batch->client = g_object_ref(client);
+    batch->n_requests = n_requests;
+    batch->max_concurrent = max_concurrent > 0 ? max_concurrent : GA_VARLINK_POOL_DEFAULT_SIZE;
+    batch->progress = progress;
+    batch->progress_data = progress_data;
+    batch->requests = g_new0(GaServiceResolveRequest, n_requests);
+    batch->items = g_new0(ResolveBatchItem, n_requests);
+    batch->results = g_ptr_array_new_full(n_requests,
+                                          (GDestroyNotify)ga_service_resolve_result_free);
+    g_ptr_array_set_size(batch->results, n_requests);
+
+    for (guint i = 0; i < n_requests; i++) {
+        batch->requests[i] = requests[i];
+        batch->requests[i].name = g_strdup(requests[i].name);
+        batch->requests[i].type = g_strdup(requests[i].type);
+        batch->requests[i].domain = g_strdup(requests[i].domain ? requests[i].domain : "local");
+        batch->items[i].batch = batch;
+        batch->items[i].index = i;
+    }
+
+    g_task_set_task_data(task, batch, (GDestroyNotify)resolve_batch_free);
+
+    if (n_requests == 0) {
+        g_task_return_pointer(task, g_ptr_array_ref(batch->results),
+                              (GDestroyNotify)g_ptr_array_unref);
+        g_object_unref(task);
+        return;
+    }
+
+    if (cancellable) {
+        batch->cancel_source = g_cancellable_source_new(cancellable);
+        g_source_set_callback(batch->cancel_source,
+                              (GSourceFunc)(void (*)(void))resolve_batch_cancelled_cb,
+                              batch, NULL);
+        g_source_attach(batch->cancel_source, g_task_get_context(task));
+    }
+
+    resolve_batch_pump(batch);
+}
+
+GPtrArray *ga_client_resolve_services_finish(GaClient *client,
+                                             GAsyncResult *result,
+                                             GError **error) {
+    g_return_val_if_fail(g_task_is_valid(result, client), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/* Stop all pending work; no signal is emitted afterwards */
+static void cached_stop(GaServiceResolverPrivate *priv) {
+    if (priv->cached_source) {
+        g_source_destroy(priv->cached_source);
+        g_source_unref(priv->cached_source);
+        priv->cached_source = NULL;
+    }
+
+    if (priv->cached) {
+        g_variant_unref(priv->cached);
+        priv->cached = NULL;
+    }
+}
+
+static void resolve_stop(GaServiceResolver *resolver) {
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+
+    if (priv->call) {
+        ga_varlink_call_cancel(priv->call);
+        priv->call = NULL;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(priv->families); i++) {
+        if (priv->families[i].call) {
+            ga_varlink_call_cancel(priv->families[i].call);
+            priv->families[i].call = NULL;
+        }
+    }
+
+    cached_stop(priv);
+
+    if (priv->cancel_source) {
+        g_source_destroy(priv->cancel_source);
+        g_source_unref(priv->cancel_source);
+        priv->cancel_source = NULL;
+    }
+
+    if (priv->browser) {
+        g_signal_handlers_disconnect_by_data(priv->browser, resolver);
+        g_object_unref(priv->browser);
+        priv->browser = NULL;
+    }
+}
+
+static gboolean resolve_cancelled_cb(G_GNUC_UNUSED GCancellable *cancellable,
+                                     gpointer user_data) {
+    GaServiceResolver *resolver = GA_SERVICE_RESOLVER(user_data);
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+
+    g_debug("GaServiceResolver: Resolving '%s' cancelled", priv->name);
+
+    resolve_stop(resolver);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Add the targets of @from to @into, joining the addresses of equal ones */
+static void merge_targets(GPtrArray *into, GPtrArray *from) {
+    for (guint i = 0; i < from->len; i++) {
+        GaServiceTarget *t = g_ptr_array_index(from, i);
+        gboolean merged = FALSE;
+
+        for (guint k = 0; k < into->len && !merged; k++) {
+            GaServiceTarget *u = g_ptr_array_index(into, k);
+            if (u->port == t->port && g_strcmp0(u->host, t->host) == 0) {
+                g_array_append_vals(u->addresses, t->addresses->data, t->addresses->len);
+                merged = TRUE;
+            }
+        }
+
+        if (!merged) {
+            g_ptr_array_add(into, t);
+            g_ptr_array_index(from, i) = NULL;
+        }
+    }
+
+    g_ptr_array_unref(from);
+}
+
+/*
+ * The result dictionary of both families' answers: the targets and
+ * addresses of both, and host, port and address of the one with an IPv4
+ * address, as srv_target_address() prefers. Floating.
+ */
+static GVariant *results_merge(GVariant *a, GVariant *b) {
+    GaAddress address;
+    gboolean b_first = !ga_service_resolve_result_get_address(a, &address) ||
+                       (address.proto != GA_PROTOCOL_INET &&
+                        ga_service_resolve_result_get_address(b, &address) &&
+                        address.proto == GA_PROTOCOL_INET);
+    GVariant *first = b_first ? b : a;
+    GVariant *second = b_first ? a : b;
+    GPtrArray *targets = ga_service_resolve_result_get_targets(first);
+    GHashTable *scopes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GVariantBuilder targets_builder, addresses, scopes_builder;
+    GVariantDict dict;
+    GHashTableIter iter;
+    gpointer key, value;
+    guint32 flags_a = 0, flags_b = 0;
+
+    merge_targets(targets, ga_service_resolve_result_get_targets(second));
+
+    g_variant_builder_init(&targets_builder, G_VARIANT_TYPE("a(sqqqa(iay))"));
+    g_variant_builder_init(&addresses, G_VARIANT_TYPE("a(iay)"));
+    for (guint i = 0; i < targets->len; i++) {
+        GaServiceTarget *t = g_ptr_array_index(targets, i);
+        GVariantBuilder target_addresses;
+
+        g_variant_builder_init(&target_addresses, G_VARIANT_TYPE("a(iay)"));
+        for (guint ai = 0; ai < t->addresses->len; ai++) {
+            const GaAddress *addr = &g_array_index(t->addresses, GaAddress, ai);
+            g_variant_builder_add(&target_addresses, "(i@ay)", addr->proto, address_to_variant(addr));
+            g_variant_builder_add(&addresses, "(i@ay)", addr->proto, address_to_variant(addr));
+        }
+        g_variant_builder_add(&targets_builder, "(sqqq@a(iay))",
+                              t->host ? t->host : "",
+                              t->priority, t->weight, t->port,
+                              g_variant_builder_end(&target_addresses));
+    }
+    g_ptr_array_unref(targets);
+
+    ga_service_resolve_result_get_scopes(second, scopes);
+    ga_service_resolve_result_get_scopes(first, scopes);
+    g_variant_builder_init(&scopes_builder, G_VARIANT_TYPE("a{si}"));
+    g_hash_table_iter_init(&iter, scopes);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        g_variant_builder_add(&scopes_builder, "{si}", (const gchar *)key, GPOINTER_TO_INT(value));
+    g_hash_table_unref(scopes);
+
+    g_variant_lookup(a, "flags", "u", &flags_a);
+    g_variant_lookup(b, "flags", "u", &flags_b);
+
+    g_variant_dict_init(&dict, first);
+    g_variant_dict_insert_value(&dict, "targets", g_variant_builder_end(&targets_builder));
+    g_variant_dict_insert_value(&dict, "addresses", g_variant_builder_end(&addresses));
+    g_variant_dict_insert_value(&dict, "scopes", g_variant_builder_end(&scopes_builder));
+    g_variant_dict_insert_value(&dict, "flags", g_variant_new_uint32(flags_a | flags_b));
+
+    return g_variant_dict_end(&dict);
+}
+
+/* Every address of @targets, in target order */
+static GArray *targets_addresses(GPtrArray *targets) {
+    GArray *addresses = g_array_new(FALSE, FALSE, sizeof(GaAddress));
+
+    for (guint i = 0; targets && i < targets->len; i++) {
+        GaServiceTarget *t = g_ptr_array_index(targets, i);
+        g_array_append_vals(addresses, t->addresses->data, t->addresses->len);
+    }
+
+    return addresses;
+}
+
+/* Take over a ResolveService result and report it */
+static void resolve_update(GaServiceResolver *resolver,
+                           GVariant *response,
+                           gboolean merge,
+                           GaLookupResultFlags extra_flags) {
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    guint32 result_flags = GA_LOOKUP_RESULT_MULTICAST;
+
+    /* Extract data from response */
+    GVariant *port_v = g_variant_lookup_value(response, "port", G_VARIANT_TYPE_UINT16);
+    if (port_v) {
+        priv->port = g_variant_get_uint16(port_v);
+        g_variant_unref(port_v);
+    }
+
+    ga_service_resolve_result_get_address(response, &priv->address);
+
+    g_free(priv->host);
+    priv->host = NULL;
+    g_variant_lookup(response, "host", "s", &priv->host);
+
+    if (!merge)
+        g_hash_table_remove_all(priv->scopes);
+    ga_service_resolve_result_get_scopes(response, priv->scopes);
+
+    free_txt_list(priv->txt);
+    priv->txt = ga_service_resolve_result_get_txt(response);
+
+    if (merge && priv->targets) {
+        merge_targets(priv->targets, ga_service_resolve_result_get_targets(response));
+    } else {
+        if (priv->targets)
+            g_ptr_array_unref(priv->targets);
+        priv->targets = ga_service_resolve_result_get_targets(response);
+    }
+
+    priv->resolved = TRUE;
+
+    /* A revalidated result is only reported if it changed; the digest
+     * covers what is reported, both families when merged */
+    GArray *addresses = targets_addresses(priv->targets);
+    gchar *digest = result_digest(priv->host, addresses, priv->port, priv->txt);
+    g_array_unref(addresses);
+
+    if (!merge && g_strcmp0(digest, priv->digest) == 0) {
+        g_debug("GaServiceResolver: '%s' revalidated without changes", priv->name);
+        g_free(digest);
+        return;
+    }
+
+    g_free(priv->digest);
+    priv->digest = digest;
+
+    g_variant_lookup(response, "flags", "u", &result_flags);
+    result_flags |= extra_flags;
+
+    /* Emit found signal */
+    g_signal_emit(resolver, signals[FOUND], 0,
+                  priv->interface,
+                  priv->protocol,
+                  priv->name,
+                  priv->type,
+                  priv->domain,
+                  priv->host ? priv->host : "",
+                  &priv->address,
+                  (gint)priv->port,
+                  priv->txt,
+                  (GaLookupResultFlags)result_flags);
+}
+
+void ga_service_resolver_take_result(GaServiceResolver *resolver, GVariant *result) {
+    g_return_if_fail(IS_GA_SERVICE_RESOLVER(resolver));
+
+    resolve_update(resolver, result, FALSE, 0);
+}
+
+static void resolve_reply_cb(GVariant *response,
+                             const GError *error,
+                             gpointer user_data) {
+    GaServiceResolver *resolver = GA_SERVICE_RESOLVER(user_data);
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+
+    priv->call = NULL;
+    if (priv->cancel_source) {
+        g_source_destroy(priv->cancel_source);
+        g_source_unref(priv->cancel_source);
+        priv->cancel_source = NULL;
+    }
+
+    /* Too late for the stale result */
+    cached_stop(priv);
+
+    if (error) {
+        g_signal_emit(resolver, signals[FAILURE], 0, error);
+        return;
+    }
+
+    ga_client_cache_insert(priv->client, priv->cache_key, response, SERVICE_CACHE_TTL_MS);
+
+    resolve_update(resolver, response, FALSE, 0);
+}
+
+static gboolean cached_result_cb(gpointer user_data) {
+    GaServiceResolver *resolver = GA_SERVICE_RESOLVER(user_data);
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    GVariant *cached = priv->cached;
+
+    g_debug("GaServiceResolver: Reporting cached result of '%s'", priv->name);
+
+    g_source_unref(priv->cached_source);
+    priv->cached_source = NULL;
+    priv->cached = NULL;
+    priv->cached_reported = TRUE;
+
+    resolve_update(resolver, cached, FALSE, GA_LOOKUP_RESULT_CACHED);
+    g_variant_unref(cached);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Parallel families.
+ *
+ * A family that has no address (or fails) does not hold back the other;
+ * failure is only reported when neither produced a result.
+ */
+
+static void family_reply_cb(GVariant *response,
+                            const GError *error,
+                            gpointer user_data) {
+    FamilyLookup *lookup = user_data;
+    GaServiceResolver *resolver = lookup->resolver;
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    gboolean last = TRUE;
+    gboolean has_address = FALSE;
+
+    lookup->call = NULL;
+    cached_stop(priv);
+    for (guint i = 0; i < G_N_ELEMENTS(priv->families); i++)
+        if (priv->families[i].call)
+            last = FALSE;
+
+    if (last && priv->cancel_source) {
+        g_source_destroy(priv->cancel_source);
+        g_source_unref(priv->cancel_source);
+        priv->cancel_source = NULL;
+    }
+
+    if (response) {
+        GVariant *address_v = g_variant_lookup_value(response, "address", G_VARIANT_TYPE_BYTESTRING);
+        has_address = address_v != NULL;
+        if (address_v)
+            g_variant_unref(address_v);
+    }
+
+    g_debug("GaServiceResolver: %s lookup of '%s' done: %s",
+            lookup->aprotocol == GA_PROTOCOL_INET ? "IPv4" : "IPv6", priv->name,
+            error ? error->message : has_address ? "found" : "no address");
+
+    if (error) {
+        if (!priv->family_error)
+            priv->family_error = g_error_copy(error);
+    } else {
+        GVariant *merged = priv->family_result ? results_merge(priv->family_result, response)
+                                               : g_variant_ref(response);
+
+        if (priv->family_result)
+            g_variant_unref(priv->family_result);
+        priv->family_result = g_variant_ref_sink(merged);
+    }
+
+    /* The merged answer is cached once both families are in. After a
+     * stale result it is reported as a whole, and only if it changed */
+    if (last && priv->family_result) {
+        GVariant *result = g_steal_pointer(&priv->family_result);
+
+        ga_client_cache_insert(priv->client, priv->cache_key, result, SERVICE_CACHE_TTL_MS);
+        if (priv->cached_reported) {
+            resolve_update(resolver, result, FALSE, 0);
+            g_variant_unref(result);
+            return;
+        }
+        g_variant_unref(result);
+    }
+
+    if (!error && !priv->cached_reported && (has_address || (last && !priv->family_reported))) {
+        /* The first family reports at once, the second one as an update */
+        gboolean merge = priv->family_reported;
+
+        priv->family_reported = TRUE;
+        resolve_update(resolver, response, merge, 0);
+        return;
+    }
+
+    if (last && !priv->resolved && priv->family_error)
+        g_signal_emit(resolver, signals[FAILURE], 0, priv->family_error);
+}
+
+static void families_start(GaServiceResolver *resolver) {
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    static const GaProtocol protocols[] = { GA_PROTOCOL_INET6, GA_PROTOCOL_INET };
+
+    for (guint i = 0; i < G_N_ELEMENTS(priv->families); i++) {
+        FamilyLookup *lookup = &priv->families[i];
+
+        lookup->resolver = resolver;
+        lookup->aprotocol = protocols[i];
+        lookup->call = ga_service_resolve_start(priv->client,
+                                                resolver,
+                                                priv->priority,
+                                                priv->interface,
+                                                priv->name,
+                                                priv->type,
+                                                priv->domain ? priv->domain : "local",
+                                                lookup->aprotocol,
+                                                priv->flags,
+                                                priv->timeout_ms,
+                                                family_reply_cb,
+                                                lookup);
+    }
+}
+
+/*
+ * Watch mode.
+ *
+ * An internal browser for the service's type follows the service and
+ * re-resolves it whenever resolved reports it again; results are hashed
+ * and found is only emitted when the digest changes.
+ */
+
+static gint address_compare(gconstpointer a, gconstpointer b) {
+    const GaAddress *x = a;
+    const GaAddress *y = b;
+
+    if (x->proto != y->proto)
+        return x->proto < y->proto ? -1 : 1;
+    return memcmp(x->data.data, y->data.data, sizeof(x->data.data));
+}
+
+/* Addresses are hashed in sorted order, resolved does not keep it stable */
+static gchar *result_digest(const gchar *host,
+                            GArray *addresses,
+                            guint16 port,
+                            GaStringList *txt) {
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    GArray *sorted = g_array_sized_new(FALSE, FALSE, sizeof(GaAddress), addresses->len);
+    guint8 port_be[2] = { port >> 8, port & 0xff };
+    gchar *digest;
+
+    g_array_append_vals(sorted, addresses->data, addresses->len);
+    g_array_sort(sorted, address_compare);
+
+    g_checksum_update(checksum, (const guchar *)(host ? host : ""), strlen(host ? host : "") + 1);
+    g_checksum_update(checksum, port_be, sizeof(port_be));
+    for (guint i = 0; i < sorted->len; i++) {
+        const GaAddress *a = &g_array_index(sorted, GaAddress, i);
+        g_checksum_update(checksum, (const guchar *)&a->proto, sizeof(a->proto));
+        g_checksum_update(checksum, a->data.data, sizeof(a->data.data));
+    }
+    for (GaStringList *l = txt; l; l = l->next) {
+        guint32 size = l->size;
+        g_checksum_update(checksum, (const guchar *)&size, sizeof(size));
+        g_checksum_update(checksum, l->text, l->size);
+    }
+
+    digest = g_strdup(g_checksum_get_string(checksum));
+    g_array_unref(sorted);
+    g_checksum_free(checksum);
+    return digest;
+}
+
+static GaStringList *copy_txt_list(GaStringList *list) {
+    GaStringList *head = NULL;
+    GaStringList **tail = &head;
+
+    for (; list; list = list->next) {
+        GaStringList *node = g_malloc(sizeof(GaStringList) + list->size);
+        node->next = NULL;
+        node->size = list->size;
+        memcpy(node->text, list->text, list->size);
+        node->text[list->size] = 0;
+        *tail = node;
+        tail = &node->next;
+    }
+
+    return head;
+}
+
+static void watch_resolved_cb(G_GNUC_UNUSED GaServiceBrowser *browser,
+                              gint interface,
+                              G_GNUC_UNUSED GaProtocol protocol,
+                              G_GNUC_UNUSED const gchar *name,
+                              G_GNUC_UNUSED const gchar *type,
+                              const gchar *domain,
+                              const gchar *host,
+                              GArray *addresses,
+                              gint port,
+                              GaStringList *txt,
+                              GaLookupResultFlags result_flags,
+                              gpointer user_data) {
+    GaServiceResolver *resolver = GA_SERVICE_RESOLVER(user_data);
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    gchar *digest = result_digest(host, addresses, (guint16)port, txt);
+
+    if (g_strcmp0(digest, priv->digest) == 0) {
+        g_debug("GaServiceResolver: '%s' re-resolved without changes", priv->name);
+        g_free(digest);
+        return;
+    }
+
+    g_free(priv->digest);
+    priv->digest = digest;
+
+    GVariant *result = ga_service_browser_peek_resolve_result(priv->browser, interface,
+                                                              priv->name, priv->type,
+                                                              domain);
+
+    /* The address the one-shot resolve would pick, unless the browser
+     * resolved for another family: then prefer the requested family, or
+     * IPv4 */
+    memset(&priv->address, 0, sizeof(priv->address));
+    if (!result || !ga_service_resolve_result_get_address(result, &priv->address) ||
+        (priv->aprotocol != GA_PROTOCOL_UNSPEC && priv->address.proto != priv->aprotocol)) {
+        GaProtocol preferred = priv->aprotocol != GA_PROTOCOL_UNSPEC ? priv->aprotocol
+                                                                     : GA_PROTOCOL_INET;
+
+        for (guint i = 0; i < addresses->len; i++) {
+            const GaAddress *a = &g_array_index(addresses, GaAddress, i);
+            if (i == 0 || a->proto == preferred) {
+                priv->address = *a;
+                if (a->proto == preferred)
+                    break;
+            }
+        }
+    }
+
+    priv->port = (uint16_t)port;
+    g_free(priv->host);
+    priv->host = g_strdup(host);
+    free_txt_list(priv->txt);
+    priv->txt = copy_txt_list(txt);
+
+    if (priv->targets)
+        g_ptr_array_unref(priv->targets);
+    priv->targets = result ? ga_service_resolve_result_get_targets(result) : NULL;
+    g_hash_table_remove_all(priv->scopes);
+    if (result)
+        ga_service_resolve_result_get_scopes(result, priv->scopes);
+
+    priv->resolved = TRUE;
+
+    g_signal_emit(resolver, signals[FOUND], 0,
+                  interface,
+                  priv->protocol,
+                  priv->name,
+                  priv->type,
+                  priv->domain,
+                  priv->host ? priv->host : "",
+                  &priv->address,
+                  (gint)priv->port,
+                  priv->txt,
+                  result_flags);
+}
+
+static void watch_failure_cb(G_GNUC_UNUSED GaServiceBrowser *browser,
+                             GError *error,
+                             gpointer user_data) {
+    g_signal_emit(GA_SERVICE_RESOLVER(user_data), signals[FAILURE], 0, error);
+}
+
+static gboolean watch_start(GaServiceResolver *resolver, GError **error) {
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    GaLookupFlags flags = priv->flags & (GA_LOOKUP_NO_TXT | GA_LOOKUP_NO_ADDRESS);
+
+    /* On all interfaces the service is one service, wherever it shows up */
+    if (priv->interface < 0)
+        flags |= GA_LOOKUP_COLLAPSE_INTERFACES;
+
+    priv->browser = g_object_new(GA_TYPE_SERVICE_BROWSER,
+                                 "interface", priv->interface,
+                                 "protocol", priv->protocol,
+                                 "type", priv->type,
+                                 "domain", priv->domain ? priv->domain : "local",
+                                 "flags", flags,
+                                 "auto-resolve", TRUE,
+                                 "resolve-concurrency", 1,
+                                 NULL);
+    ga_service_browser_set_resolve_target(priv->browser, priv->name, priv->aprotocol);
+
+    g_signal_connect(priv->browser, "service-resolved",
+                     G_CALLBACK(watch_resolved_cb), resolver);
+    g_signal_connect(priv->browser, "failure",
+                     G_CALLBACK(watch_failure_cb), resolver);
+
+    if (!ga_service_browser_attach(priv->browser, priv->client, error)) {
+        g_signal_handlers_disconnect_by_data(priv->browser, resolver);
+        g_object_unref(priv->browser);
+        priv->browser = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+GaServiceResolver *ga_service_resolver_new(GaIfIndex interface,
+                                           GaProtocol protocol,
+                                           const gchar *name,
+                                           const gchar *type,
+                                           const gchar *domain,
+                                           GaProtocol address_protocol,
+                                           GaLookupFlags flags) {
+    return g_object_new(GA_TYPE_SERVICE_RESOLVER,
+                        "interface", interface,
+                        "protocol", protocol,
+                        "name", name,
+                        "type", type,
+                        "domain", domain,
+                        "aprotocol", address_protocol,
+                        "flags", flags,
+                        NULL);
+}
+
+gboolean ga_service_resolver_attach(GaServiceResolver *resolver,
+                                    GaClient *client,
+                                    GError **error) {
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+
+    g_return_val_if_fail(IS_GA_SERVICE_RESOLVER(resolver), FALSE);
+    g_return_val_if_fail(IS_GA_CLIENT(client), FALSE);
+
+    g_object_ref(client);
+    priv->client = client;
+
+    /* Cancellation is dispatched from the attaching thread's context,
+     * like the replies */
+    if (priv->cancellable) {
+        if (g_cancellable_is_cancelled(priv->cancellable)) {
+            if (error)
+                *error = g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                     "Resolving '%s' was cancelled", priv->name);
+            return FALSE;
+        }
+
+        priv->cancel_source = g_cancellable_source_new(priv->cancellable);
+        g_source_set_callback(priv->cancel_source,
+                              (GSourceFunc)(void (*)(void))resolve_cancelled_cb,
+                              resolver, NULL);
+        g_source_attach(priv->cancel_source, g_main_context_get_thread_default());
+    }
+
+    if (priv->watch) {
+        if (ga_client_has_feature(client, GA_CLIENT_FEATURE_BROWSE_SERVICES)) {
+            if (!watch_start(resolver, error)) {
+                resolve_stop(resolver);
+                return FALSE;
+            }
+            return TRUE;
+        }
+        g_debug("GaServiceResolver: BrowseServices unavailable, resolving '%s' once",
+                priv->name);
+    }
+
+    g_free(priv->cache_key);
+    priv->cache_key = g_strdup_printf("service:%d:%d:%u:%s.%s.%s",
+                                      priv->interface, priv->aprotocol,
+                                      priv->flags & (GA_LOOKUP_NO_TXT | GA_LOOKUP_NO_ADDRESS),
+                                      priv->name, priv->type,
+                                      priv->domain ? priv->domain : "local");
+
+    /* Report the last known result right away, the lookup below refreshes it */
+    if (priv->flags & GA_LOOKUP_STALE_WHILE_REVALIDATE) {
+        priv->cached = ga_client_cache_lookup(client, priv->cache_key);
+        if (priv->cached) {
+            priv->cached_source = g_idle_source_new();
+            g_source_set_callback(priv->cached_source, cached_result_cb, resolver, NULL);
+            g_source_attach(priv->cached_source, g_main_context_get_thread_default());
+        }
+    }
+
+    if (priv->parallel_families && priv->aprotocol == GA_PROTOCOL_UNSPEC &&
+        !(priv->flags & GA_LOOKUP_NO_ADDRESS)) {
+        families_start(resolver);
+        return TRUE;
+    }
+
+    /* GA_IF_UNSPEC (-1) is passed directly; systemd-resolved normalizes it to 0
+     * which means "all mDNS interfaces" (Avahi AVAHI_IF_UNSPEC semantics).
+     * Disposing the resolver cancels the call and frees its connection. */
+    priv->call = ga_service_resolve_start(client,
+                                          resolver,
+                                          priv->priority,
+                                          priv->interface,
+                                          priv->name,
+                                          priv->type,
+                                          priv->domain ? priv->domain : "local",
+                                          priv->aprotocol,
+                                          priv->flags,
+                                          priv->timeout_ms,
+                                          resolve_reply_cb,
+                                          resolver);
+
+    return TRUE;
+}
+
+gboolean ga_service_resolver_get_address(GaServiceResolver *resolver,
+                                         GaAddress *address,
+                                         uint16_t *port) {
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+
+    if (!priv->resolved || priv->port == 0)
+        return FALSE;
+
+    *address = priv->address;
+    *port = priv->port;
+    return TRUE;
+}
+
+GPtrArray *ga_service_resolver_get_targets(GaServiceResolver *resolver) {
+    g_return_val_if_fail(IS_GA_SERVICE_RESOLVER(resolver), NULL);
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+
+    if (!priv->resolved || !priv->targets)
+        return NULL;
+
+    return g_ptr_array_ref(priv->targets);
+}
+
+/*
+ * Happy Eyeballs (RFC 8305).
+ *
+ * The addresses of all targets are tried in target order, alternating
+ * between IPv6 and IPv4 within each target. A new attempt starts every
+ * CONNECT_ATTEMPT_DELAY_MS, or as soon as the previous one failed; the
+ * first connection wins and the other attempts are cancelled.
+ */
+
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
+typedef struct {
+    GSocketClient *socket_client;
+    GPtrArray *addresses;       /* GSocketAddress, in the order to try */
+    guint next;
+    guint pending;
+    GPtrArray *attempts;        /* GCancellable of each running attempt */
+    GSource *timer;
+    GSource *cancel_source;
+    GError *error;              /* Of the last failed attempt */
+    gboolean done;
+} ConnectData;
+
+typedef struct {
+    GTask *task;
+    GCancellable *cancellable;
+    GSocketAddress *address;
+} ConnectAttempt;
+
+static void connect_data_free(ConnectData *data) {
+    g_object_unref(data->socket_client);
+    g_ptr_array_unref(data->addresses);
+    g_ptr_array_unref(data->attempts);
+    if (data->error)
+        g_error_free(data->error);
+    g_free(data);
+}
+
+static GSocketAddress *connect_address_new(GaServiceResolverPrivate *priv,
+                                           const GaAddress *address,
+                                           guint16 port) {
+    guint32 scope_id = 0;
+
+    if (ga_address_is_link_local(address)) {
+        gchar buf[INET6_ADDRSTRLEN];
+        gpointer ifindex = NULL;
+
+        if (ga_address_snprint(buf, sizeof(buf), address))
+            ifindex = g_hash_table_lookup(priv->scopes, buf);
+        if (ifindex)
+            scope_id = (guint32)GPOINTER_TO_INT(ifindex);
+        else if (priv->interface > 0)
+            scope_id = (guint32)priv->interface;
+        else
+            return NULL;
+    }
+
+    GInetAddress *inet = g_inet_address_new_from_bytes(address->data.data,
+                                                       address->proto == GA_PROTOCOL_INET
+                                                       ? G_SOCKET_FAMILY_IPV4
+                                                       : G_SOCKET_FAMILY_IPV6);
+    GSocketAddress *socket_address = g_object_new(G_TYPE_INET_SOCKET_ADDRESS,
+                                                  "address", inet,
+                                                  "port", (guint)port,
+                                                  "scope-id", scope_id,
+                                                  NULL);
+    g_object_unref(inet);
+    return socket_address;
+}
+
+static void connect_add_target(GaServiceResolverPrivate *priv,
+                               GPtrArray *addresses,
+                               GArray *target_addresses,
+                               guint16 port) {
+    guint i6 = 0, i4 = 0;
+    gboolean want_v6 = TRUE;
+
+    for (;;) {
+        const GaAddress *a = NULL;
+
+        /* Alternate families, starting with IPv6 */
+        for (guint pass = 0; pass < 2 && !a; pass++, want_v6 = !want_v6) {
+            guint *i = want_v6 ? &i6 : &i4;
+            GaProtocol proto = want_v6 ? GA_PROTOCOL_INET6 : GA_PROTOCOL_INET;
+
+            while (*i < target_addresses->len &&
+                   g_array_index(target_addresses, GaAddress, *i).proto != proto)
+                (*i)++;
+            if (*i < target_addresses->len)
+                a = &g_array_index(target_addresses, GaAddress, (*i)++);
+        }
+
+        if (!a)
+            break;
+
+        GSocketAddress *socket_address = connect_address_new(priv, a, port);
+        if (socket_address)
+            g_ptr_array_add(addresses, socket_address);
+        else
+            g_debug("GaServiceResolver: skipping link-local address of '%s' "
+                    "without interface", priv->name);
+    }
+}
+
+static void connect_stop(ConnectData *data) {
+    data->done = TRUE;
+
+    if (data->timer) {
+        g_source_destroy(data->timer);
+        g_source_unref(data->timer);
+        data->timer = NULL;
+    }
+
+    if (data->cancel_source) {
+        g_source_destroy(data->cancel_source);
+        g_source_unref(data->cancel_source);
+        data->cancel_source = NULL;
+    }
+
+    for (guint i = 0; i < data->attempts->len; i++)
+        g_cancellable_cancel(g_ptr_array_index(data->attempts, i));
+}
+
+static void connect_next(GTask *task);
+
+static gboolean connect_timer_cb(gpointer user_data) {
+    GTask *task = G_TASK(user_data);
+    ConnectData *data = g_task_get_task_data(task);
+
+    g_source_unref(data->timer);
+    data->timer = NULL;
+    connect_next(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void connect_attempt_cb(GObject *source,
+                               GAsyncResult *result,
+                               gpointer user_data) {
+    ConnectAttempt *attempt = user_data;
+    GTask *task = attempt->task;
+    ConnectData *data = g_task_get_task_data(task);
+    GError *error = NULL;
+    GSocketConnection *connection =
+        g_socket_client_connect_finish(G_SOCKET_CLIENT(source), result, &error);
+
+    data->pending--;
+    g_ptr_array_remove(data->attempts, attempt->cancellable);
+
+    if (data->done) {
+        /* Lost the race */
+        if (connection)
+            g_object_unref(connection);
+        if (error)
+            g_error_free(error);
+    } else if (connection) {
+        connect_stop(data);
+        g_task_return_pointer(task, connection, g_object_unref);
+    } else {
+        g_debug("GaServiceResolver: connect attempt failed: %s", error->message);
+        if (data->error)
+            g_error_free(data->error);
+        data->error = error;
+        connect_next(task);
+    }
+
+    g_object_unref(attempt->cancellable);
+    g_object_unref(attempt->address);
+    g_free(attempt);
+    g_object_unref(task);
+}
+
+static void connect_next(GTask *task) {
+    ConnectData *data = g_task_get_task_data(task);
+
+    if (data->timer) {
+        g_source_destroy(data->timer);
+        g_source_unref(data->timer);
+        data->timer = NULL;
+    }
+
+    if (data->next >= data->addresses->len) {
+        if (data->pending == 0) {
+            GError *error = data->error;
+
+            data->error = NULL;
+            connect_stop(data);
+            if (error)
+                g_task_return_error(task, error);
+            else
+                g_task_return_new_error(task, GA_ERROR, GA_ERROR_NO_NETWORK,
+                                        "No address to connect to");
+        }
+        return;
+    }
+
+    ConnectAttempt *attempt = g_new0(ConnectAttempt, 1);
+    attempt->task = g_object_ref(task);
+    attempt->cancellable = g_cancellable_new();
+    attempt->address = g_object_ref(g_ptr_array_index(data->addresses, data->next));
+    data->next++;
+    data->pending++;
+    g_ptr_array_add(data->attempts, g_object_ref(attempt->cancellable));
+
+    g_socket_client_connect_async(data->socket_client,
+                                  G_SOCKET_CONNECTABLE(attempt->address),
+                                  attempt->cancellable,
+                                  connect_attempt_cb,
+                                  attempt);
+
+    if (data->next < data->addresses->len) {
+        data->timer = g_timeout_source_new(CONNECT_ATTEMPT_DELAY_MS);
+        g_source_set_callback(data->timer, connect_timer_cb, task, NULL);
+        g_source_attach(data->timer, g_task_get_context(task));
+    }
+}
+
+static gboolean connect_cancelled_cb(GCancellable *cancellable, gpointer user_data) {
+    GTask *task = G_TASK(user_data);
+    ConnectData *data = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    g_cancellable_set_error_if_cancelled(cancellable, &error);
+    connect_stop(data);
+    g_task_return_error(task, error);
+
+    return G_SOURCE_REMOVE;
+}
+
+void ga_service_resolver_connect_async(GaServiceResolver *resolver,
+                                       GCancellable *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       gpointer user_data) {
+    g_return_if_fail(IS_GA_SERVICE_RESOLVER(resolver));
+    GaServiceResolverPrivate *priv = GA_SERVICE_RESOLVER_GET_PRIVATE(resolver);
+    GTask *task = g_task_new(resolver, cancellable, callback, user_data);
+
+    g_task_set_source_tag(task, ga_service_resolver_connect_async);
+
+    if (!priv->resolved) {
+        g_task_return_new_error(task, GA_ERROR, GA_ERROR_BAD_STATE,
+                                "Service is not resolved");
+        g_object_unref(task);
+        return;
+    }
+
+    ConnectData *data = g_new0(ConnectData, 1);
+    data->socket_client = g_socket_client_new();
+    data->addresses = g_ptr_array_new_with_free_func(g_object_unref);
+    data->attempts = g_ptr_array_new_with_free_func(g_object_unref);
+    g_task_set_task_data(task, data, (GDestroyNotify)connect_data_free);
+
+    if (priv->targets && priv->targets->len > 0) {
+        for (guint i = 0; i < priv->targets->len; i++) {
+            GaServiceTarget *target = g_ptr_array_index(priv->targets, i);
+            connect_add_target(priv, data->addresses, target->addresses, target->port);
+        }
+    } else if (priv->port != 0) {
+        GArray *single = g_array_new(FALSE, FALSE, sizeof(GaAddress));
+        g_array_append_val(single, priv->address);
+        connect_add_target(priv, data->addresses, single, priv->port);
+        g_array_unref(single);
+    }
+
+    g_debug("GaServiceResolver: connecting to '%s' over %u addresses",
+            priv->name, data->addresses->len);
+
+    if (cancellable) {
+        data->cancel_source = g_cancellable_source_new(cancellable);
+        g_source_set_callback(data->cancel_source,
+                              (GSourceFunc)(void (*)(void))connect_cancelled_cb,
+                              task, NULL);
+        g_source_attach(data->cancel_source, g_task_get_context(task));
+    }
+
+    connect_next(task);
+    g_object_unref(task);
+}
+
+GSocketConnection *ga_service_resolver_connect_finish(GaServiceResolver *resolver,
+                                                      GAsyncResult *result,
+                                                      GError **error) {
+    g_return_val_if_fail(g_task_is_valid(result, resolver), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
 }
 
 gchar *ga_address_snprint(gchar *ret, gsize length, const GaAddress *a) {
@@ -7,8 +7,10 @@
 
 #include <glib-object.h>
 #include <stdint.h>
+#include <gio/gio.h>
 #include "ga-client.h"
 #include "ga-enums.h"
+#include "ga-entry-group.h"  /* For GaStringList */
 
 G_BEGIN_DECLS
 
@@ -82,6 +84,118 @@ gboolean
 ga_service_resolver_get_address(GaServiceResolver * resolver,
                                 GaAddress * address, uint16_t * port);
 
+/*
+ * All SRV targets of the service in the order they should be tried
+ * (RFC 2782), as a GPtrArray of GaServiceTarget, or NULL if the service
+ * is not resolved yet. Free with g_ptr_array_unref().
+ */
+GPtrArray *
+ga_service_resolver_get_targets(GaServiceResolver * resolver);
+
+/**
+ * ga_service_resolver_connect_async:
+ * @resolver: A resolved GaServiceResolver
+ * @cancellable: (nullable): A GCancellable
+ * @callback: Called when a connection is established or all attempts failed
+ * @user_data: Data for @callback
+ *
+ * Connect to the service over TCP. Every address of every target is
+ * raced Happy Eyeballs style (RFC 8305): attempts alternate between IPv6
+ * and IPv4 and start 250 ms apart, or as soon as the previous one fails.
+ * Link-local addresses use the interface they were found on.
+ */
+void ga_service_resolver_connect_async(GaServiceResolver *resolver,
+                                       GCancellable *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       gpointer user_data);
+
+/**
+ * ga_service_resolver_connect_finish:
+ *
+ * Returns: (transfer full): The first connection that was established,
+ * or NULL with @error set to the error of the last failed attempt.
+ */
+GSocketConnection *ga_service_resolver_connect_finish(GaServiceResolver *resolver,
+                                                      GAsyncResult *result,
+                                                      GError **error);
+
+/* A SRV target of a resolved service */
+typedef struct {
+    gchar *host;
+    guint16 port;
+    guint16 priority;
+    guint16 weight;
+    GArray *addresses;  /* GaAddress */
+} GaServiceTarget;
+
+void ga_service_target_free(GaServiceTarget *target);
+
+/* One service to resolve with ga_client_resolve_services_async() */
+typedef struct {
+    GaIfIndex interface;
+    GaProtocol protocol;
+    const gchar *name;
+    const gchar *type;
+    const gchar *domain;
+    GaProtocol aprotocol;
+    GaLookupFlags flags;
+} GaServiceResolveRequest;
+
+/*
+ * Outcome of one request. On failure @error is set and the other fields
+ * are empty.
+ */
+typedef struct {
+    gchar *host;
+    GaAddress address;
+    guint16 port;
+    GaStringList *txt;
+    GError *error;
+} GaServiceResolveResult;
+
+void ga_service_resolve_result_free(GaServiceResolveResult *result);
+
+/* Called as each request completes, in completion order */
+typedef void (*GaServiceResolveProgressFunc)(guint index,
+                                             const GaServiceResolveResult *result,
+                                             gpointer user_data);
+
+/**
+ * ga_client_resolve_services_async:
+ * @client: A started client
+ * @requests: (array length=n_requests): Services to resolve; copied
+ * @n_requests: Number of requests
+ * @max_concurrent: Requests in flight at once, 0 for the default
+ * @progress: (nullable): Called for every completed request
+ * @progress_data: Data for @progress
+ * @cancellable: (nullable): A GCancellable
+ * @callback: Called once every request completed
+ * @user_data: Data for @callback
+ *
+ * Resolve many services over the client's pooled connections instead of
+ * one GaServiceResolver each.
+ */
+void ga_client_resolve_services_async(GaClient *client,
+                                      const GaServiceResolveRequest *requests,
+                                      guint n_requests,
+                                      guint max_concurrent,
+                                      GaServiceResolveProgressFunc progress,
+                                      gpointer progress_data,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data);
+
+/**
+ * ga_client_resolve_services_finish:
+ *
+ * Returns: (transfer full): A GPtrArray of GaServiceResolveResult, in
+ * request order, or NULL if the batch was cancelled. Failures of single
+ * requests are reported in their results, not in @error.
+ */
+GPtrArray *ga_client_resolve_services_finish(GaClient *client,
+                                             GAsyncResult *result,
+                                             GError **error);
+
 /**
  * ga_address_snprint:
  * @ret: (out): Buffer to write the address string to
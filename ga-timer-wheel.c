@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-timer-wheel.c - Coarse timers for large numbers of deadlines (systemd-resolved compatibility) */
+
+#include "ga-timer-wheel.h"
+
+/*
+ * Timers are hashed into WHEEL_SLOTS buckets by their deadline tick; a
+ * timer more than one revolution away waits out its remaining rounds in
+ * its bucket. The tick source only runs while timers are pending.
+ */
+#define WHEEL_SLOTS 256
+
+struct _GaTimerWheelEntry {
+    GList link;            /* In slots[slot] or firing; data is the entry */
+    GQueue *queue;
+    guint rounds;
+    GaTimerWheelFunc func;
+    gpointer user_data;
+};
+
+struct _GaTimerWheel {
+    GMainContext *context;
+    guint tick_ms;
+    guint current;
+    guint count;
+    GQueue slots[WHEEL_SLOTS];
+    GQueue firing;         /* Expired this tick, not run yet */
+    GSource *tick_source;
+    gboolean dispatching;
+    gboolean free_pending;
+};
+
+static gboolean wheel_tick_cb(gpointer user_data) {
+    GaTimerWheel *wheel = user_data;
+    GQueue *slot;
+    GList *l;
+
+    wheel->current = (wheel->current + 1) % WHEEL_SLOTS;
+    slot = &wheel->slots[wheel->current];
+
+    for (l = slot->head; l;) {
+        GaTimerWheelEntry *entry = l->data;
+        l = l->next;
+
+        if (entry->rounds > 0) {
+            entry->rounds--;
+            continue;
+        }
+
+        g_queue_unlink(slot, &entry->link);
+        g_queue_push_tail_link(&wheel->firing, &entry->link);
+        entry->queue = &wheel->firing;
+    }
+
+    /* A callback may add timers, remove pending ones or free the wheel */
+    wheel->dispatching = TRUE;
+    while (!wheel->free_pending && (l = g_queue_pop_head_link(&wheel->firing))) {
+        GaTimerWheelEntry *entry = l->data;
+        GaTimerWheelFunc func = entry->func;
+        gpointer data = entry->user_data;
+
+        wheel->count--;
+        g_free(entry);
+        func(data);
+    }
+    wheel->dispatching = FALSE;
+
+    if (wheel->free_pending) {
+        ga_timer_wheel_free(wheel);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (wheel->count == 0) {
+        g_source_unref(wheel->tick_source);
+        wheel->tick_source = NULL;
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+GaTimerWheel *ga_timer_wheel_new(GMainContext *context, guint tick_ms) {
+    GaTimerWheel *wheel = g_new0(GaTimerWheel, 1);
+
+    wheel->context = context ? g_main_context_ref(context) : NULL;
+    wheel->tick_ms = MAX(tick_ms, 1);
+    for (guint i = 0; i < WHEEL_SLOTS; i++)
+        g_queue_init(&wheel->slots[i]);
+    g_queue_init(&wheel->firing);
+
+    return wheel;
+}
+
+static void wheel_clear_queue(GQueue *queue) {
+    GList *l;
+
+    while ((l = g_queue_pop_head_link(queue)))
+        g_free(l->data);
+}
+
+void ga_timer_wheel_free(GaTimerWheel *wheel) {
+    if (!wheel)
+        return;
+
+    if (wheel->dispatching) {
+        wheel->free_pending = TRUE;
+        return;
+    }
+
+    if (wheel->tick_source) {
+        g_source_destroy(wheel->tick_source);
+        g_source_unref(wheel->tick_source);
+    }
+
+    for (guint i = 0; i < WHEEL_SLOTS; i++)
+        wheel_clear_queue(&wheel->slots[i]);
+    wheel_clear_queue(&wheel->firing);
+
+    if (wheel->context)
+        g_main_context_unref(wheel->context);
+
+    g_free(wheel);
+}
+
+GaTimerWheelEntry *ga_timer_wheel_add(GaTimerWheel *wheel,
+                                      guint delay_ms,
+                                      GaTimerWheelFunc func,
+                                      gpointer user_data) {
+    g_return_val_if_fail(wheel != NULL, NULL);
+    g_return_val_if_fail(func != NULL, NULL);
+
+    GaTimerWheelEntry *entry = g_new0(GaTimerWheelEntry, 1);
+    guint64 ticks = delay_ms / wheel->tick_ms + (delay_ms % wheel->tick_ms != 0);
+
+    /* While the tick source runs, part of the current tick is already
+     * over: count from the next one so that the timer never fires early */
+    if (wheel->tick_source)
+        ticks++;
+    ticks = MAX(ticks, 1);
+
+    entry->link.data = entry;
+    entry->rounds = (guint)((ticks - 1) / WHEEL_SLOTS);
+    entry->func = func;
+    entry->user_data = user_data;
+    entry->queue = &wheel->slots[(wheel->current + ticks) % WHEEL_SLOTS];
+    g_queue_push_tail_link(entry->queue, &entry->link);
+    wheel->count++;
+
+    if (!wheel->tick_source) {
+        wheel->tick_source = g_timeout_source_new(wheel->tick_ms);
+        g_source_set_callback(wheel->tick_source, wheel_tick_cb, wheel, NULL);
+        g_source_attach(wheel->tick_source, wheel->context);
+    }
+
+    return entry;
+}
+
+void ga_timer_wheel_remove(GaTimerWheel *wheel, GaTimerWheelEntry *entry) {
+    g_return_if_fail(wheel != NULL);
+
+    if (!entry)
+        return;
+
+    g_queue_unlink(entry->queue, &entry->link);
+    wheel->count--;
+    g_free(entry);
+}
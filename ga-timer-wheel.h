@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * ga-timer-wheel.h - Coarse timers for large numbers of deadlines
+ * (not installed)
+ *
+ * A hashed timer wheel: adding and removing a timer is O(1) and each
+ * tick only visits the timers of one slot, however many are pending.
+ * Timers never fire before their deadline, and at most two ticks after.
+ */
+
+#ifndef __GA_TIMER_WHEEL_H__
+#define __GA_TIMER_WHEEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GaTimerWheel GaTimerWheel;
+typedef struct _GaTimerWheelEntry GaTimerWheelEntry;
+
+/* The entry is gone by the time this runs; do not remove it */
+typedef void (*GaTimerWheelFunc)(gpointer user_data);
+
+GaTimerWheel *ga_timer_wheel_new(GMainContext *context, guint tick_ms);
+
+/* Pending timers are dropped without running */
+void ga_timer_wheel_free(GaTimerWheel *wheel);
+
+GaTimerWheelEntry *ga_timer_wheel_add(GaTimerWheel *wheel,
+                                      guint delay_ms,
+                                      GaTimerWheelFunc func,
+                                      gpointer user_data);
+
+/* Cancel a timer that has not fired yet */
+void ga_timer_wheel_remove(GaTimerWheel *wheel, GaTimerWheelEntry *entry);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_TIMER_WHEEL_H__ */
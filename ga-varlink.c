@@ -0,0 +1,673 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* ga-varlink.c - Internal sd-varlink helpers (systemd-resolved compatibility) */
+
+#include <poll.h>
+#include <string.h>
+
+#include "ga-varlink.h"
+#include "ga-error.h"
+
+/*
+ * GSource wrapping an sd_varlink connection.
+ *
+ * Unlike a plain GIOChannel watch this follows the poll events requested
+ * by sd-varlink (so queued output gets flushed) and wakes up for the
+ * connection's timeout, so pending calls time out even on an idle socket.
+ */
+typedef struct {
+    GSource source;
+    sd_varlink *link;
+    gpointer fd_tag;
+} GaVarlinkSource;
+
+static GIOCondition condition_from_poll_events(int events) {
+    GIOCondition condition = 0;
+
+    if (events & POLLIN)
+        condition |= G_IO_IN;
+    if (events & POLLOUT)
+        condition |= G_IO_OUT;
+
+    return condition;
+}
+
+static gboolean ga_varlink_source_prepare(GSource *source, gint *timeout) {
+    GaVarlinkSource *s = (GaVarlinkSource *)source;
+    uint64_t until;
+    int events;
+
+    *timeout = -1;
+
+    /* Disconnected: dispatch once more so the owner notices */
+    events = sd_varlink_get_events(s->link);
+    if (events < 0)
+        return TRUE;
+
+    g_source_modify_unix_fd(source, s->fd_tag, condition_from_poll_events(events));
+
+    if (sd_varlink_get_timeout(s->link, &until) > 0 && until != UINT64_MAX) {
+        gint64 now = g_get_monotonic_time();
+
+        if ((gint64)until <= now)
+            return TRUE;
+
+        *timeout = (gint)MIN((until - now + 999) / 1000, (uint64_t)G_MAXINT);
+    }
+
+    return FALSE;
+}
+
+static gboolean ga_varlink_source_check(GSource *source) {
+    GaVarlinkSource *s = (GaVarlinkSource *)source;
+    uint64_t until;
+
+    if (g_source_query_unix_fd(source, s->fd_tag) != 0)
+        return TRUE;
+
+    if (sd_varlink_get_timeout(s->link, &until) > 0 && until != UINT64_MAX &&
+        (gint64)until <= g_get_monotonic_time())
+        return TRUE;
+
+    return FALSE;
+}
+
+static gboolean ga_varlink_source_dispatch(GSource *source,
+                                           GSourceFunc callback,
+                                           gpointer user_data) {
+    GaVarlinkSource *s = (GaVarlinkSource *)source;
+    gboolean keep = G_SOURCE_CONTINUE;
+    int r;
+
+    do {
+        r = sd_varlink_process(s->link);
+    } while (r > 0 && !g_source_is_destroyed(source));
+
+    /* The owner tore the connection down from within a reply callback */
+    if (g_source_is_destroyed(source))
+        return G_SOURCE_REMOVE;
+
+    if (callback)
+        keep = ((GaVarlinkSourceFunc)(void (*)(void))callback)(s->link, r < 0 ? r : 0, user_data);
+
+    return r < 0 ? G_SOURCE_REMOVE : keep;
+}
+
+static void ga_varlink_source_finalize(GSource *source) {
+    GaVarlinkSource *s = (GaVarlinkSource *)source;
+
+    sd_varlink_unref(s->link);
+}
+
+static GSourceFuncs ga_varlink_source_funcs = {
+    ga_varlink_source_prepare,
+    ga_varlink_source_check,
+    ga_varlink_source_dispatch,
+    ga_varlink_source_finalize,
+    NULL,
+    NULL
+};
+
+GSource *ga_varlink_source_new(sd_varlink *link) {
+    int fd = sd_varlink_get_fd(link);
+    if (fd < 0)
+        return NULL;
+
+    GSource *source = g_source_new(&ga_varlink_source_funcs, sizeof(GaVarlinkSource));
+    GaVarlinkSource *s = (GaVarlinkSource *)source;
+
+    s->link = sd_varlink_ref(link);
+    s->fd_tag = g_source_add_unix_fd(source, fd, G_IO_IN);
+
+    return source;
+}
+
+/* SD_RESOLVED_* flags of systemd-resolved */
+#define SD_RESOLVED_DNS          (UINT64_C(1) << 0)
+#define SD_RESOLVED_MDNS_IPV4    (UINT64_C(1) << 3)
+#define SD_RESOLVED_MDNS_IPV6    (UINT64_C(1) << 4)
+#define SD_RESOLVED_NO_TXT       (UINT64_C(1) << 6)
+#define SD_RESOLVED_NO_ADDRESS   (UINT64_C(1) << 7)
+#define SD_RESOLVED_NO_NETWORK   (UINT64_C(1) << 15)
+#define SD_RESOLVED_SYNTHETIC    (UINT64_C(1) << 19)
+#define SD_RESOLVED_FROM_CACHE   (UINT64_C(1) << 20)
+#define SD_RESOLVED_FROM_ZONE    (UINT64_C(1) << 21)
+
+guint64 ga_varlink_lookup_flags(GaLookupFlags flags) {
+    guint64 f = 0;
+
+    if (flags & GA_LOOKUP_NO_TXT)
+        f |= SD_RESOLVED_NO_TXT;
+    if (flags & GA_LOOKUP_NO_ADDRESS)
+        f |= SD_RESOLVED_NO_ADDRESS;
+    if (flags & GA_LOOKUP_CACHE_ONLY)
+        f |= SD_RESOLVED_NO_NETWORK;
+
+    return f;
+}
+
+GaLookupResultFlags ga_varlink_result_flags(guint64 flags) {
+    GaLookupResultFlags f = 0;
+
+    if (flags & SD_RESOLVED_FROM_CACHE)
+        f |= GA_LOOKUP_RESULT_CACHED;
+    if (flags & (SD_RESOLVED_MDNS_IPV4 | SD_RESOLVED_MDNS_IPV6))
+        f |= GA_LOOKUP_RESULT_MULTICAST;
+    if (flags & SD_RESOLVED_DNS)
+        f |= GA_LOOKUP_RESULT_WIDE_AREA;
+    if (flags & (SD_RESOLVED_SYNTHETIC | SD_RESOLVED_FROM_ZONE))
+        f |= GA_LOOKUP_RESULT_LOCAL;
+
+    if (!(f & (GA_LOOKUP_RESULT_MULTICAST | GA_LOOKUP_RESULT_WIDE_AREA)))
+        f |= GA_LOOKUP_RESULT_MULTICAST;
+
+    return f;
+}
+
+GError *ga_varlink_error_new(const char *error_id, int r) {
+    if (!error_id)
+        return g_error_new(GA_ERROR, GA_ERROR_FAILURE,
+                           "Varlink call failed: %s", g_strerror(-r));
+
+    if (g_strcmp0(error_id, "io.systemd.TimedOut") == 0)
+        return g_error_new(GA_ERROR, GA_ERROR_TIMEOUT, "%s", error_id);
+
+    if (g_strcmp0(error_id, "io.systemd.Disconnected") == 0)
+        return g_error_new(GA_ERROR, GA_ERROR_DISCONNECTED, "%s", error_id);
+
+    if (g_strcmp0(error_id, "org.varlink.service.MethodNotFound") == 0 ||
+        g_strcmp0(error_id, "org.varlink.service.MethodNotImplemented") == 0 ||
+        g_strcmp0(error_id, "org.varlink.service.InterfaceNotFound") == 0)
+        return g_error_new(GA_ERROR, GA_ERROR_NOT_SUPPORTED, "%s", error_id);
+
+    if (g_strcmp0(error_id, "org.varlink.service.InvalidParameter") == 0)
+        return g_error_new(GA_ERROR, GA_ERROR_INVALID_ARGUMENT, "%s", error_id);
+
+    return g_error_new(GA_ERROR, GA_ERROR_NOT_FOUND, "%s", error_id);
+}
+
+/*
+ * Connection pool.
+ *
+ * A varlink connection carries one method call at a time, so concurrent
+ * calls are spread over up to max_connections sockets and the rest wait
+ * in FIFO order. Calls are only ever started and completed from an idle
+ * source: sd-varlink does not allow issuing a new call on a connection
+ * from within that connection's reply callback.
+ *
+ * Waiting calls are queued per owner object and priority class. Owners
+ * take turns, so one object issuing hundreds of calls does not hold up
+ * the others; interactive calls go before background ones, except that
+ * every POOL_BACKGROUND_SHARE-th start is given to a waiting background
+ * call so that it cannot starve.
+ */
+#define POOL_N_PRIORITIES (GA_REQUEST_PRIORITY_BACKGROUND + 1)
+#define POOL_BACKGROUND_SHARE 8
+
+typedef struct {
+    gconstpointer owner;
+    GaRequestPriority priority;
+    GQueue calls;
+} PoolOwner;
+
+typedef struct {
+    GaVarlinkPool *pool;
+    sd_varlink *link;
+    GSource *source;
+    GaVarlinkCall *call;   /* In-flight call, NULL when idle */
+    gboolean dead;         /* Closed by the peer or timed out, reaped on idle */
+} PoolConnection;
+
+struct _GaVarlinkCall {
+    GaVarlinkPool *pool;
+    PoolConnection *conn;
+    PoolOwner *queue;      /* While waiting for a connection */
+    GaRequestPriority priority;
+    gint64 queued_at;
+    gchar *method;
+    sd_json_variant *params;
+    guint timeout_ms;
+    GaVarlinkReplyFunc func;
+    gpointer user_data;
+    GDestroyNotify destroy;
+    GError *error;         /* Set when the call failed before getting a reply */
+    gboolean completing;
+};
+
+struct _GaVarlinkPool {
+    GMainContext *context;
+    guint max_connections;
+    GPtrArray *connections;
+    GHashTable *owners[POOL_N_PRIORITIES];  /* owner -> PoolOwner */
+    GQueue turns[POOL_N_PRIORITIES];        /* PoolOwner with calls waiting */
+    guint interactive_run;                  /* Starts since the last background one */
+    GaVarlinkPoolStats stats;
+    GQueue failed;         /* Calls that failed locally, completed on idle */
+    GSource *idle_source;
+    gboolean dispatching;
+    gboolean free_pending;
+};
+
+static void pool_schedule(GaVarlinkPool *pool);
+
+static void call_free(GaVarlinkCall *call) {
+    if (call->destroy)
+        call->destroy(call->user_data);
+    g_free(call->method);
+    if (call->params)
+        sd_json_variant_unref(call->params);
+    g_clear_error(&call->error);
+    g_free(call);
+}
+
+static void pool_queue_push(GaVarlinkPool *pool, GaVarlinkCall *call, gconstpointer owner) {
+    GHashTable *owners = pool->owners[call->priority];
+    PoolOwner *po = g_hash_table_lookup(owners, owner);
+
+    if (!po) {
+        po = g_new0(PoolOwner, 1);
+        po->owner = owner;
+        po->priority = call->priority;
+        g_queue_init(&po->calls);
+        g_hash_table_insert(owners, (gpointer)po->owner, po);
+        g_queue_push_tail(&pool->turns[call->priority], po);
+    }
+
+    g_queue_push_tail(&po->calls, call);
+    call->queue = po;
+    call->queued_at = g_get_monotonic_time();
+
+    pool->stats.queued++;
+    pool->stats.queued_max = MAX(pool->stats.queued_max, pool->stats.queued);
+}
+
+static void pool_owner_free(GaVarlinkPool *pool, PoolOwner *po) {
+    g_hash_table_remove(pool->owners[po->priority], po->owner);
+    g_free(po);
+}
+
+static GaVarlinkCall *pool_queue_pop(GaVarlinkPool *pool) {
+    GQueue *interactive = &pool->turns[GA_REQUEST_PRIORITY_INTERACTIVE];
+    GQueue *background = &pool->turns[GA_REQUEST_PRIORITY_BACKGROUND];
+    GQueue *turns;
+
+    if (!g_queue_is_empty(interactive) &&
+        (g_queue_is_empty(background) || pool->interactive_run < POOL_BACKGROUND_SHARE - 1)) {
+        turns = interactive;
+        pool->interactive_run++;
+    } else if (!g_queue_is_empty(background)) {
+        turns = background;
+        pool->interactive_run = 0;
+    } else {
+        return NULL;
+    }
+
+    PoolOwner *po = g_queue_pop_head(turns);
+    GaVarlinkCall *call = g_queue_pop_head(&po->calls);
+
+    if (g_queue_is_empty(&po->calls))
+        pool_owner_free(pool, po);
+    else
+        g_queue_push_tail(turns, po);
+
+    call->queue = NULL;
+    pool->stats.queued--;
+
+    guint64 wait = (guint64)(g_get_monotonic_time() - call->queued_at);
+    pool->stats.started++;
+    pool->stats.wait_last = wait;
+    pool->stats.wait_max = MAX(pool->stats.wait_max, wait);
+    pool->stats.wait_total += wait;
+
+    return call;
+}
+
+static gboolean pool_queue_remove(GaVarlinkPool *pool, GaVarlinkCall *call) {
+    PoolOwner *po = call->queue;
+
+    if (!po)
+        return FALSE;
+
+    g_queue_remove(&po->calls, call);
+    if (g_queue_is_empty(&po->calls)) {
+        g_queue_remove(&pool->turns[po->priority], po);
+        pool_owner_free(pool, po);
+    }
+
+    call->queue = NULL;
+    pool->stats.queued--;
+    return TRUE;
+}
+
+static void pool_connection_free(PoolConnection *conn) {
+    if (conn->source) {
+        g_source_destroy(conn->source);
+        g_source_unref(conn->source);
+    }
+
+    sd_varlink_bind_reply(conn->link, NULL);
+    sd_varlink_set_userdata(conn->link, NULL);
+    sd_varlink_close_unref(conn->link);
+    g_free(conn);
+}
+
+static int pool_reply_cb(G_GNUC_UNUSED sd_varlink *link,
+                         sd_json_variant *parameters,
+                         const char *error_id,
+                         G_GNUC_UNUSED sd_varlink_reply_flags_t flags,
+                         void *userdata) {
+    PoolConnection *conn = userdata;
+    GaVarlinkCall *call = conn->call;
+
+    if (!call)
+        return 0;
+
+    conn->call = NULL;
+    call->conn = NULL;
+    call->completing = TRUE;
+
+    /* sd-varlink closes the connection after a timeout */
+    if (g_strcmp0(error_id, "io.systemd.TimedOut") == 0 ||
+        g_strcmp0(error_id, "io.systemd.Disconnected") == 0)
+        conn->dead = TRUE;
+
+    /* Hand the connection to the next queued call; do all pool bookkeeping
+     * first since the reply function may drop the last client reference. */
+    pool_schedule(conn->pool);
+
+    GError *error = error_id ? ga_varlink_error_new(error_id, 0) : NULL;
+    call->func(error ? NULL : parameters, error, call->user_data);
+    g_clear_error(&error);
+
+    call_free(call);
+    return 0;
+}
+
+static gboolean pool_connection_io_cb(G_GNUC_UNUSED sd_varlink *link,
+                                      int r,
+                                      gpointer user_data) {
+    PoolConnection *conn = user_data;
+
+    if (r >= 0)
+        return G_SOURCE_CONTINUE;
+
+    g_debug("GaVarlinkPool: connection lost: %s", g_strerror(-r));
+    conn->dead = TRUE;
+
+    if (conn->call) {
+        GaVarlinkCall *call = conn->call;
+
+        conn->call = NULL;
+        call->conn = NULL;
+        call->error = ga_varlink_error_new("io.systemd.Disconnected", 0);
+        g_queue_push_tail(&conn->pool->failed, call);
+    }
+
+    pool_schedule(conn->pool);
+    return G_SOURCE_REMOVE;
+}
+
+static PoolConnection *pool_connection_new(GaVarlinkPool *pool, GError **error) {
+    sd_varlink *link = NULL;
+    int r;
+
+    r = sd_varlink_connect_address(&link, RESOLVED_VARLINK_ADDRESS);
+    if (r < 0) {
+        g_set_error(error, GA_ERROR, GA_ERROR_NO_DAEMON,
+                    "Failed to connect to systemd-resolved: %s", g_strerror(-r));
+        return NULL;
+    }
+
+    PoolConnection *conn = g_new0(PoolConnection, 1);
+    conn->pool = pool;
+    conn->link = link;
+    conn->source = ga_varlink_source_new(link);
+    if (!conn->source) {
+        g_set_error(error, GA_ERROR, GA_ERROR_FAILURE, "Failed to get varlink fd");
+        pool_connection_free(conn);
+        return NULL;
+    }
+
+    sd_varlink_set_userdata(link, conn);
+    sd_varlink_bind_reply(link, pool_reply_cb);
+
+    g_source_set_callback(conn->source,
+                          G_SOURCE_FUNC(pool_connection_io_cb),
+                          conn,
+                          NULL);
+    g_source_attach(conn->source, pool->context);
+
+    g_ptr_array_add(pool->connections, conn);
+    return conn;
+}
+
+static PoolConnection *pool_get_idle_connection(GaVarlinkPool *pool) {
+    for (guint i = 0; i < pool->connections->len; i++) {
+        PoolConnection *conn = g_ptr_array_index(pool->connections, i);
+        if (!conn->call && !conn->dead)
+            return conn;
+    }
+    return NULL;
+}
+
+static void pool_start_call(PoolConnection *conn, GaVarlinkCall *call) {
+    int r;
+
+    sd_varlink_set_relative_timeout(conn->link,
+                                    (uint64_t)call->timeout_ms * 1000);
+
+    r = sd_varlink_invoke(conn->link, call->method, call->params);
+    if (r < 0) {
+        conn->dead = TRUE;
+        call->error = ga_varlink_error_new(NULL, r);
+        g_queue_push_tail(&conn->pool->failed, call);
+        return;
+    }
+
+    conn->call = call;
+    call->conn = conn;
+}
+
+static void pool_start_queued(GaVarlinkPool *pool) {
+    while (pool->stats.queued > 0) {
+        PoolConnection *conn = pool_get_idle_connection(pool);
+        GError *error = NULL;
+
+        if (!conn && pool->connections->len < pool->max_connections) {
+            conn = pool_connection_new(pool, &error);
+            if (!conn) {
+                GaVarlinkCall *call = pool_queue_pop(pool);
+                call->error = error;
+                g_queue_push_tail(&pool->failed, call);
+                continue;
+            }
+        }
+
+        if (!conn)
+            break;
+
+        pool_start_call(conn, pool_queue_pop(pool));
+    }
+}
+
+static void pool_reap_dead(GaVarlinkPool *pool) {
+    for (guint i = pool->connections->len; i-- > 0;) {
+        PoolConnection *conn = g_ptr_array_index(pool->connections, i);
+
+        /* Idle connections beyond a lowered maximum go as well */
+        if (!conn->call && (conn->dead || pool->connections->len > pool->max_connections)) {
+            g_ptr_array_remove_index_fast(pool->connections, i);
+            pool_connection_free(conn);
+        }
+    }
+}
+
+static gboolean pool_idle_cb(gpointer user_data) {
+    GaVarlinkPool *pool = user_data;
+    GaVarlinkCall *call;
+
+    g_source_unref(pool->idle_source);
+    pool->idle_source = NULL;
+
+    pool_reap_dead(pool);
+    pool_start_queued(pool);
+
+    /* Complete local failures; a reply function may free the pool */
+    pool->dispatching = TRUE;
+    while (!pool->free_pending && (call = g_queue_pop_head(&pool->failed))) {
+        call->completing = TRUE;
+        call->func(NULL, call->error, call->user_data);
+        call_free(call);
+    }
+    pool->dispatching = FALSE;
+
+    if (pool->free_pending)
+        ga_varlink_pool_free(pool);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void pool_schedule(GaVarlinkPool *pool) {
+    if (pool->idle_source)
+        return;
+
+    pool->idle_source = g_idle_source_new();
+    g_source_set_callback(pool->idle_source, pool_idle_cb, pool, NULL);
+    g_source_attach(pool->idle_source, pool->context);
+}
+
+GaVarlinkPool *ga_varlink_pool_new(GMainContext *context, guint max_connections) {
+    GaVarlinkPool *pool = g_new0(GaVarlinkPool, 1);
+
+    pool->context = context ? g_main_context_ref(context) : NULL;
+    pool->max_connections = MAX(max_connections, 1);
+    pool->connections = g_ptr_array_new();
+    for (guint i = 0; i < POOL_N_PRIORITIES; i++) {
+        pool->owners[i] = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_queue_init(&pool->turns[i]);
+    }
+    g_queue_init(&pool->failed);
+
+    return pool;
+}
+
+void ga_varlink_pool_free(GaVarlinkPool *pool) {
+    GaVarlinkCall *call;
+
+    if (!pool)
+        return;
+
+    if (pool->dispatching) {
+        pool->free_pending = TRUE;
+        return;
+    }
+
+    if (pool->idle_source) {
+        g_source_destroy(pool->idle_source);
+        g_source_unref(pool->idle_source);
+    }
+
+    for (guint i = 0; i < pool->connections->len; i++) {
+        PoolConnection *conn = g_ptr_array_index(pool->connections, i);
+        if (conn->call)
+            call_free(conn->call);
+        pool_connection_free(conn);
+    }
+    g_ptr_array_free(pool->connections, TRUE);
+
+    while ((call = pool_queue_pop(pool)))
+        call_free(call);
+    for (guint i = 0; i < POOL_N_PRIORITIES; i++)
+        g_hash_table_unref(pool->owners[i]);
+    while ((call = g_queue_pop_head(&pool->failed)))
+        call_free(call);
+
+    if (pool->context)
+        g_main_context_unref(pool->context);
+
+    g_free(pool);
+}
+
+void ga_varlink_pool_set_max_connections(GaVarlinkPool *pool, guint max_connections) {
+    g_return_if_fail(pool != NULL);
+
+    pool->max_connections = MAX(max_connections, 1);
+    pool_schedule(pool);
+}
+
+void ga_varlink_pool_get_stats(GaVarlinkPool *pool, GaVarlinkPoolStats *stats) {
+    g_return_if_fail(pool != NULL);
+    g_return_if_fail(stats != NULL);
+
+    *stats = pool->stats;
+    stats->in_flight = 0;
+    for (guint i = 0; i < pool->connections->len; i++) {
+        PoolConnection *conn = g_ptr_array_index(pool->connections, i);
+        if (conn->call)
+            stats->in_flight++;
+    }
+}
+
+GaVarlinkCall *ga_varlink_pool_call(GaVarlinkPool *pool,
+                                    const char *method,
+                                    sd_json_variant *params,
+                                    guint timeout_ms,
+                                    GaVarlinkReplyFunc func,
+                                    gpointer user_data) {
+    return ga_varlink_pool_call_full(pool, NULL, GA_REQUEST_PRIORITY_INTERACTIVE,
+                                     method, params, timeout_ms, func, user_data, NULL);
+}
+
+GaVarlinkCall *ga_varlink_pool_call_full(GaVarlinkPool *pool,
+                                         gconstpointer owner,
+                                         GaRequestPriority priority,
+                                         const char *method,
+                                         sd_json_variant *params,
+                                         guint timeout_ms,
+                                         GaVarlinkReplyFunc func,
+                                         gpointer user_data,
+                                         GDestroyNotify destroy) {
+    g_return_val_if_fail(pool != NULL, NULL);
+    g_return_val_if_fail(priority < POOL_N_PRIORITIES, NULL);
+    g_return_val_if_fail(method != NULL, NULL);
+    g_return_val_if_fail(func != NULL, NULL);
+
+    GaVarlinkCall *call = g_new0(GaVarlinkCall, 1);
+    call->pool = pool;
+    call->method = g_strdup(method);
+    call->params = params ? sd_json_variant_ref(params) : NULL;
+    call->timeout_ms = timeout_ms;
+    call->func = func;
+    call->user_data = user_data;
+    call->destroy = destroy;
+    call->priority = priority;
+
+    pool_queue_push(pool, call, owner);
+    pool_schedule(pool);
+
+    return call;
+}
+
+void ga_varlink_call_cancel(GaVarlinkCall *call) {
+    GaVarlinkPool *pool;
+
+    if (!call || call->completing)
+        return;
+
+    pool = call->pool;
+
+    if (call->conn) {
+        /* The reply can no longer be matched to anything: drop the socket
+         * so the slot is available to the next call right away. */
+        PoolConnection *conn = call->conn;
+
+        conn->call = NULL;
+        g_ptr_array_remove_fast(pool->connections, conn);
+        pool_connection_free(conn);
+        pool_schedule(pool);
+    } else if (!pool_queue_remove(pool, call)) {
+        g_queue_remove(&pool->failed, call);
+    }
+
+    call_free(call);
+}
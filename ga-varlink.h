@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * ga-varlink.h - Internal sd-varlink helpers (not installed)
+ *
+ * GLib main loop integration for sd_varlink connections and a small
+ * connection pool used for one-shot method calls to systemd-resolved.
+ */
+
+#ifndef __GA_VARLINK_H__
+#define __GA_VARLINK_H__
+
+#include <glib.h>
+#include <systemd/sd-varlink.h>
+#include "ga-enums.h"
+
+G_BEGIN_DECLS
+
+#define RESOLVED_VARLINK_ADDRESS "/run/systemd/resolve/io.systemd.Resolve"
+
+/* Default number of pooled connections per client */
+#define GA_VARLINK_POOL_DEFAULT_SIZE 4
+
+/*
+ * Callback for sources created with ga_varlink_source_new(). Invoked after
+ * each round of sd_varlink_process(); @r is 0 or the negative errno that
+ * ended the round. Return G_SOURCE_REMOVE to stop watching the connection.
+ */
+typedef gboolean (*GaVarlinkSourceFunc)(sd_varlink *link, int r, gpointer user_data);
+
+GSource *ga_varlink_source_new(sd_varlink *link);
+
+/* Map a varlink error id (or -errno when @error_id is NULL) to a GA_ERROR */
+GError *ga_varlink_error_new(const char *error_id, int r);
+
+/* SD_RESOLVED_* flags for the "flags" parameter of a resolved query */
+guint64 ga_varlink_lookup_flags(GaLookupFlags flags);
+
+/*
+ * Map the SD_RESOLVED_* "flags" of a resolved reply to GaLookupResultFlags.
+ * Replies that do not name a protocol are taken to come from mDNS.
+ */
+GaLookupResultFlags ga_varlink_result_flags(guint64 flags);
+
+/* Reply of a pooled call: exactly one of @reply and @error is non-NULL */
+typedef void (*GaVarlinkReplyFunc)(sd_json_variant *reply,
+                                   const GError *error,
+                                   gpointer user_data);
+
+typedef struct _GaVarlinkPool GaVarlinkPool;
+typedef struct _GaVarlinkCall GaVarlinkCall;
+
+GaVarlinkPool *ga_varlink_pool_new(GMainContext *context, guint max_connections);
+
+void ga_varlink_pool_free(GaVarlinkPool *pool);
+
+/* Change the number of calls in flight at once; takes effect on idle */
+void ga_varlink_pool_set_max_connections(GaVarlinkPool *pool, guint max_connections);
+
+/* Admission counters of a pool; wait times are in microseconds */
+typedef struct {
+    guint in_flight;
+    guint queued;          /* Calls waiting for a connection now */
+    guint queued_max;
+    guint64 started;
+    guint64 wait_last;
+    guint64 wait_max;
+    guint64 wait_total;
+} GaVarlinkPoolStats;
+
+void ga_varlink_pool_get_stats(GaVarlinkPool *pool, GaVarlinkPoolStats *stats);
+
+/*
+ * Queue a method call. @params may be NULL for an empty parameter object.
+ * @timeout_ms of 0 uses the sd-varlink default. @func is always invoked
+ * from the pool's main context, never from within this function.
+ */
+GaVarlinkCall *ga_varlink_pool_call(GaVarlinkPool *pool,
+                                    const char *method,
+                                    sd_json_variant *params,
+                                    guint timeout_ms,
+                                    GaVarlinkReplyFunc func,
+                                    gpointer user_data);
+
+/*
+ * Like ga_varlink_pool_call(), queued in @priority's class. Calls of the
+ * same @owner are started in order; owners take turns within a class.
+ * @destroy, if not NULL, is called on @user_data once the call is done:
+ * after the reply function, or when the call is cancelled or dropped.
+ */
+GaVarlinkCall *ga_varlink_pool_call_full(GaVarlinkPool *pool,
+                                         gconstpointer owner,
+                                         GaRequestPriority priority,
+                                         const char *method,
+                                         sd_json_variant *params,
+                                         guint timeout_ms,
+                                         GaVarlinkReplyFunc func,
+                                         gpointer user_data,
+                                         GDestroyNotify destroy);
+
+/*
+ * Cancel a queued or in-flight call. The reply function is not invoked,
+ * the destroy notify is, and the connection carrying the call, if any, is
+ * closed right away.
+ */
+void ga_varlink_call_cancel(GaVarlinkCall *call);
+
+G_END_DECLS
+
+#endif /* #ifndef __GA_VARLINK_H__ */
@@ -10,7 +10,10 @@
 #include "ga-error.h"
 #include "ga-entry-group.h"
 #include "ga-record-browser.h"
+#include "ga-multi-record-browser.h"
 #include "ga-service-browser.h"
 #include "ga-service-resolver.h"
+#include "ga-host-name-resolver.h"
+#include "ga-address-resolver.h"
 
 #endif /* __AVAHI_RESOLVED_COMPAT_H__ */
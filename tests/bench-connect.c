@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * bench-connect.c - ga_service_resolver_connect_async() against
+ * connecting to one address after the other
+ *
+ * A resolver is handed SRV targets whose first addresses are blackholed
+ * and whose last one is a local listener, and the time to a connection
+ * is measured with Happy Eyeballs and with serial attempts that give up
+ * after SERIAL_TIMEOUT_S each. Blackholes are a loopback port that is
+ * listening but never accepts, with its backlog of 0 already taken, and
+ * the TEST-NET addresses 192.0.2.1 and 2001:db8::1, which go nowhere
+ * (or fail at once where there is no route). Needs no daemon.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ga-service-resolver-private.h"
+
+/* Per-attempt deadline of the serial connects */
+#define SERIAL_TIMEOUT_S 1
+
+/* Connections that take the backlog of the blackhole port */
+#define BLACKHOLE_FILLERS 3
+
+typedef enum {
+    HOP_LISTENER,   /* 127.0.0.1, accepting */
+    HOP_BACKLOG,    /* 127.0.0.1, backlog full */
+    HOP_TEST_NET4,  /* 192.0.2.1 */
+    HOP_TEST_NET6,  /* 2001:db8::1 */
+} Hop;
+
+typedef struct {
+    const char *label;
+    Hop hops[5];
+    guint n_hops;
+} ConnectCase;
+
+static const ConnectCase cases[] = {
+    { "direct", { HOP_LISTENER }, 1 },
+    { "backlog", { HOP_BACKLOG, HOP_LISTENER }, 2 },
+    { "test-net", { HOP_TEST_NET6, HOP_TEST_NET4, HOP_LISTENER }, 3 },
+    { "all", { HOP_BACKLOG, HOP_TEST_NET6, HOP_BACKLOG, HOP_TEST_NET4, HOP_LISTENER }, 5 },
+};
+
+static guint16 listener_port;
+static guint16 blackhole_port;
+
+static void accept_cb(GObject *source, GAsyncResult *result, G_GNUC_UNUSED gpointer user_data) {
+    GSocketConnection *connection =
+        g_socket_listener_accept_finish(G_SOCKET_LISTENER(source), result, NULL, NULL);
+
+    if (!connection)
+        return;
+    g_object_unref(connection);
+    g_socket_listener_accept_async(G_SOCKET_LISTENER(source), NULL, accept_cb, NULL);
+}
+
+/* A loopback port whose SYNs are dropped: listening, never accepting */
+static GSocket *blackhole_new(GPtrArray *fillers, GError **error) {
+    GSocket *socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                                   G_SOCKET_PROTOCOL_TCP, error);
+    GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(loopback, 0);
+    GSocketAddress *bound = NULL;
+    gboolean ok;
+
+    g_object_unref(loopback);
+    if (!socket) {
+        g_object_unref(address);
+        return NULL;
+    }
+
+    g_socket_set_listen_backlog(socket, 0);
+    ok = g_socket_bind(socket, address, FALSE, error) && g_socket_listen(socket, error) &&
+         (bound = g_socket_get_local_address(socket, error));
+    g_object_unref(address);
+    if (!ok) {
+        g_object_unref(socket);
+        return NULL;
+    }
+    blackhole_port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound));
+
+    /* Fill the accept queue */
+    for (guint i = 0; i < BLACKHOLE_FILLERS; i++) {
+        GSocket *filler = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_TCP, NULL);
+
+        if (!filler)
+            continue;
+        g_socket_set_blocking(filler, FALSE);
+        g_socket_connect(filler, bound, NULL, NULL);
+        g_ptr_array_add(fillers, filler);
+    }
+    g_object_unref(bound);
+    g_usleep(100 * 1000);
+
+    return socket;
+}
+
+static void add_target(GVariantBuilder *targets, GVariantBuilder *addresses,
+                       Hop hop, guint priority) {
+    static const guint8 loopback[4] = { 127, 0, 0, 1 };
+    static const guint8 test_net4[4] = { 192, 0, 2, 1 };
+    static const guint8 test_net6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+    const guint8 *bytes = hop == HOP_TEST_NET4 ? test_net4 :
+                          hop == HOP_TEST_NET6 ? test_net6 : loopback;
+    gint proto = hop == HOP_TEST_NET6 ? GA_PROTOCOL_INET6 : GA_PROTOCOL_INET;
+    guint16 port = hop == HOP_BACKLOG ? blackhole_port : listener_port;
+    GVariantBuilder target_addresses;
+
+    g_variant_builder_init(&target_addresses, G_VARIANT_TYPE("a(iay)"));
+    g_variant_builder_add(&target_addresses, "(i@ay)", proto,
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, bytes,
+                                                    proto == GA_PROTOCOL_INET ? 4 : 16, 1));
+    g_variant_builder_add(addresses, "(i@ay)", proto,
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, bytes,
+                                                    proto == GA_PROTOCOL_INET ? 4 : 16, 1));
+    g_variant_builder_add(targets, "(sqqq@a(iay))", "bench.local",
+                          (guint16)priority, (guint16)0, port,
+                          g_variant_builder_end(&target_addresses));
+}
+
+/* A resolve result with one target per hop, in order */
+static GVariant *case_result(const ConnectCase *c) {
+    GVariantBuilder builder, targets, addresses;
+
+    g_variant_builder_init(&targets, G_VARIANT_TYPE("a(sqqqa(iay))"));
+    g_variant_builder_init(&addresses, G_VARIANT_TYPE("a(iay)"));
+    for (guint i = 0; i < c->n_hops; i++)
+        add_target(&targets, &addresses, c->hops[i], i);
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&builder, "{sv}", "host", g_variant_new_string("bench.local"));
+    g_variant_builder_add(&builder, "{sv}", "port", g_variant_new_uint16(listener_port));
+    g_variant_builder_add(&builder, "{sv}", "addresses", g_variant_builder_end(&addresses));
+    g_variant_builder_add(&builder, "{sv}", "targets", g_variant_builder_end(&targets));
+    g_variant_builder_add(&builder, "{sv}", "flags", g_variant_new_uint32(0));
+
+    return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+typedef struct {
+    gboolean done;
+    GSocketConnection *connection;
+} ConnectWait;
+
+static void connect_cb(GObject *source, GAsyncResult *result, gpointer user_data) {
+    ConnectWait *wait = user_data;
+    GError *error = NULL;
+
+    wait->connection = ga_service_resolver_connect_finish(GA_SERVICE_RESOLVER(source), result, &error);
+    if (!wait->connection) {
+        g_printerr("Happy Eyeballs connect failed: %s\n", error->message);
+        g_error_free(error);
+    }
+    wait->done = TRUE;
+}
+
+/* Milliseconds to a connection over @resolver's targets; negative on failure */
+static gdouble bench_happy_eyeballs(GaServiceResolver *resolver) {
+    ConnectWait wait = { FALSE, NULL };
+    gint64 start = g_get_monotonic_time();
+
+    ga_service_resolver_connect_async(resolver, NULL, connect_cb, &wait);
+    while (!wait.done)
+        g_main_context_iteration(NULL, TRUE);
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    if (!wait.connection)
+        return -1;
+    g_object_unref(wait.connection);
+
+    /* Let the losing attempts wind down */
+    while (g_main_context_iteration(NULL, FALSE))
+        ;
+
+    return elapsed / 1000.0;
+}
+
+/* The same targets tried one after the other */
+static gdouble bench_serial(GaServiceResolver *resolver) {
+    GSocketClient *socket_client = g_socket_client_new();
+    GPtrArray *targets = ga_service_resolver_get_targets(resolver);
+    gint64 start = g_get_monotonic_time();
+    gboolean connected = FALSE;
+
+    g_socket_client_set_timeout(socket_client, SERIAL_TIMEOUT_S);
+    for (guint i = 0; i < targets->len && !connected; i++) {
+        GaServiceTarget *t = g_ptr_array_index(targets, i);
+
+        for (guint ai = 0; ai < t->addresses->len && !connected; ai++) {
+            const GaAddress *a = &g_array_index(t->addresses, GaAddress, ai);
+            GInetAddress *inet = g_inet_address_new_from_bytes(a->data.data,
+                                                               a->proto == GA_PROTOCOL_INET
+                                                               ? G_SOCKET_FAMILY_IPV4
+                                                               : G_SOCKET_FAMILY_IPV6);
+            GSocketAddress *address = g_inet_socket_address_new(inet, t->port);
+            GSocketConnection *connection =
+                g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+
+            if (connection) {
+                connected = TRUE;
+                g_object_unref(connection);
+            }
+            g_object_unref(address);
+            g_object_unref(inet);
+        }
+    }
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_ptr_array_unref(targets);
+    g_object_unref(socket_client);
+
+    return connected ? elapsed / 1000.0 : -1;
+}
+
+int main(void) {
+    GSocketListener *listener = g_socket_listener_new();
+    GPtrArray *fillers = g_ptr_array_new_with_free_func(g_object_unref);
+    GSocket *blackhole = NULL;
+    GError *error = NULL;
+    int ret = EXIT_SUCCESS;
+
+    if (!(listener_port = g_socket_listener_add_any_inet_port(listener, NULL, &error)) ||
+        !(blackhole = blackhole_new(fillers, &error))) {
+        g_printerr("Cannot set up the local ports: %s\n", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+    g_socket_listener_accept_async(listener, NULL, accept_cb, NULL);
+
+    g_print("Serial attempts time out after %d s\n", SERIAL_TIMEOUT_S);
+
+    for (gsize c = 0; c < G_N_ELEMENTS(cases) && ret == EXIT_SUCCESS; c++) {
+        GaServiceResolver *resolver = ga_service_resolver_new(GA_IF_UNSPEC, GA_PROTOCOL_UNSPEC,
+                                                              "Bench", "_bench._tcp", "local",
+                                                              GA_PROTOCOL_UNSPEC,
+                                                              GA_LOOKUP_NO_FLAGS);
+        GVariant *result = case_result(&cases[c]);
+        gdouble happy, serial;
+
+        ga_service_resolver_take_result(resolver, result);
+        g_variant_unref(result);
+
+        happy = bench_happy_eyeballs(resolver);
+        serial = bench_serial(resolver);
+        if (happy < 0 || serial < 0)
+            ret = EXIT_FAILURE;
+        else
+            g_print("%-9s %u hops: happy eyeballs %8.1f ms, serial %8.1f ms\n",
+                    cases[c].label, cases[c].n_hops, happy, serial);
+
+        g_object_unref(resolver);
+    }
+
+    g_socket_listener_close(listener);
+    g_object_unref(listener);
+    g_object_unref(blackhole);
+    g_ptr_array_unref(fillers);
+
+    return ret;
+}
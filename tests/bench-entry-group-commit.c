@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * bench-entry-group-commit.c - Time ga_entry_group_commit() for large groups
+ *
+ * Commits groups of 1000 and 5000 services, one file at a time and in
+ * bulk, and prints how long each commit took to write its files. The
+ * library is built into this program with DNSSD_RUNTIME_DIR pointing
+ * into the build directory and the group is never attached, so nothing
+ * is published and the reload the commit queues never goes out. Needs
+ * no daemon.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ga-entry-group.h"
+
+static const guint group_sizes[] = { 1000, 5000 };
+
+/* Milliseconds one commit of @n services takes; negative on failure */
+static gdouble bench_commit(guint n, gboolean bulk) {
+    GaEntryGroup *group = g_object_new(GA_TYPE_ENTRY_GROUP, "bulk", bulk, NULL);
+    GaStringList *txt = ga_string_list_new("path=/", "container=bench", NULL);
+    GError *error = NULL;
+    gint64 start, elapsed;
+
+    /* Every file gets the TXT lines, the services copy the list */
+    for (guint i = 0; i < n; i++) {
+        gchar *name = g_strdup_printf("Container %u", i);
+
+        if (!ga_entry_group_add_service_strlist(group, name, "_http._tcp",
+                                                (guint16)(8000 + i % 1000), &error, txt)) {
+            g_printerr("Failed to add service %s: %s\n", name, error->message);
+            g_error_free(error);
+            g_free(name);
+            ga_string_list_free(txt);
+            g_object_unref(group);
+            return -1;
+        }
+        g_free(name);
+    }
+    ga_string_list_free(txt);
+
+    start = g_get_monotonic_time();
+    if (!ga_entry_group_commit(group, &error)) {
+        g_printerr("Failed to commit %u services: %s\n", n, error->message);
+        g_error_free(error);
+        g_object_unref(group);
+        return -1;
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    /* Removes the files again */
+    g_object_unref(group);
+
+    return elapsed / 1000.0;
+}
+
+int main(void) {
+    g_print("DNSSD directory: %s\n", DNSSD_RUNTIME_DIR);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(group_sizes); i++) {
+        for (gint bulk = 0; bulk <= 1; bulk++) {
+            gdouble ms = bench_commit(group_sizes[i], bulk);
+
+            if (ms < 0)
+                return EXIT_FAILURE;
+            g_print("%5u services, %-6s %9.1f ms\n",
+                    group_sizes[i], bulk ? "bulk" : "serial", ms);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * bench-record-decode.c - Time ga_record_decode() per record type
+ *
+ * Each case is one of the "rrs" of a ResolveRecord reply as
+ * systemd-resolved sends it. The entry is parsed once; the loop only
+ * decodes it into a GaRecord and drops it again, which is the work a
+ * "new-record-parsed" handler adds per record. Needs no daemon.
+ *
+ * Usage: bench-record-decode [ITERATIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ga-record-browser-private.h"
+
+#define DEFAULT_ITERATIONS 200000
+
+typedef struct {
+    const char *type;
+    const char *json;
+} DecodeCase;
+
+static const DecodeCase cases[] = {
+    { "A",
+      "{\"ifindex\":2,\"rr\":{\"key\":{\"class\":1,\"type\":1,\"name\":\"printer.local\"},"
+      "\"address\":[192,168,1,20]}}" },
+    { "AAAA",
+      "{\"ifindex\":2,\"rr\":{\"key\":{\"class\":1,\"type\":28,\"name\":\"printer.local\"},"
+      "\"address\":[254,128,0,0,0,0,0,0,2,17,34,255,254,51,68,85]}}" },
+    { "SRV",
+      "{\"ifindex\":2,\"rr\":{\"key\":{\"class\":1,\"type\":33,"
+      "\"name\":\"Office Printer._ipp._tcp.local\"},"
+      "\"priority\":0,\"weight\":0,\"port\":631,\"name\":\"printer.local\"}}" },
+    { "TXT",
+      "{\"ifindex\":2,\"rr\":{\"key\":{\"class\":1,\"type\":16,"
+      "\"name\":\"Office Printer._ipp._tcp.local\"},"
+      "\"items\":[\"txtvers=1\",\"qtotal=1\",\"rp=ipp/print\",\"ty=Office Printer\","
+      "\"pdl=application/pdf,image/urf\",\"Color=T\",\"Duplex=T\",\"note=2nd floor\"]}}" },
+    { "PTR",
+      "{\"ifindex\":2,\"rr\":{\"key\":{\"class\":1,\"type\":12,\"name\":\"_ipp._tcp.local\"},"
+      "\"name\":\"Office Printer._ipp._tcp.local\"}}" },
+};
+
+int main(int argc, char *argv[]) {
+    guint iterations = argc > 1 ? (guint)strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+
+    if (iterations == 0)
+        iterations = DEFAULT_ITERATIONS;
+
+    for (gsize c = 0; c < G_N_ELEMENTS(cases); c++) {
+        sd_json_variant *entry = NULL;
+        GaRecord *record;
+        gint64 start, elapsed;
+        int r;
+
+        if ((r = sd_json_parse(cases[c].json, 0, &entry, NULL, NULL)) < 0) {
+            g_printerr("%s: cannot parse the test entry: %s\n", cases[c].type, g_strerror(-r));
+            return EXIT_FAILURE;
+        }
+
+        /* Warm up, and make sure the case decodes at all */
+        if (!(record = ga_record_decode(entry, 2, 120))) {
+            g_printerr("%s: not decoded\n", cases[c].type);
+            sd_json_variant_unref(entry);
+            return EXIT_FAILURE;
+        }
+        ga_record_unref(record);
+
+        start = g_get_monotonic_time();
+        for (guint i = 0; i < iterations; i++)
+            ga_record_unref(ga_record_decode(entry, 2, 120));
+        elapsed = g_get_monotonic_time() - start;
+
+        g_print("%-5s %8.1f ns/record (%u records)\n",
+                cases[c].type, (double)elapsed * 1000.0 / iterations, iterations);
+
+        sd_json_variant_unref(entry);
+    }
+
+    return EXIT_SUCCESS;
+}
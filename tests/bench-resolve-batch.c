@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * bench-resolve-batch.c - ga_client_resolve_services_async() against
+ * one GaServiceResolver per service
+ *
+ * Browses the local network for a service type, then resolves N
+ * services, cycling through the ones found, first with N resolvers
+ * attached at once, then as one batch, and prints the wall time of
+ * each. The found services are resolved once beforehand so both runs
+ * see resolved's cache in the same state. Skipped when
+ * systemd-resolved is not running or nothing of the type is found.
+ *
+ * Usage: bench-resolve-batch [TYPE [N]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ga-client.h"
+#include "ga-service-browser.h"
+#include "ga-service-resolver.h"
+
+#define DEFAULT_TYPE "_workstation._tcp"
+#define DEFAULT_N 500
+
+/* How long the network is browsed for services to resolve */
+#define BROWSE_MS 3000
+
+/* Exit status meson reports as a skipped test */
+#define EXIT_SKIP 77
+
+typedef struct {
+    GaIfIndex interface;
+    gchar *name;
+    gchar *type;
+    gchar *domain;
+} FoundService;
+
+static GaClient *client = NULL;
+
+static void found_service_free(FoundService *service) {
+    g_free(service->name);
+    g_free(service->type);
+    g_free(service->domain);
+    g_free(service);
+}
+
+static void new_service_cb(G_GNUC_UNUSED GaServiceBrowser *browser,
+                           gint interface,
+                           G_GNUC_UNUSED GaProtocol protocol,
+                           const gchar *name,
+                           const gchar *type,
+                           const gchar *domain,
+                           G_GNUC_UNUSED GaLookupResultFlags flags,
+                           GPtrArray *found) {
+    FoundService *service = g_new0(FoundService, 1);
+
+    service->interface = interface;
+    service->name = g_strdup(name);
+    service->type = g_strdup(type);
+    service->domain = g_strdup(domain);
+    g_ptr_array_add(found, service);
+}
+
+static gboolean timeout_cb(gpointer user_data) {
+    *(gboolean *)user_data = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+static GPtrArray *browse(const gchar *type) {
+    GPtrArray *found = g_ptr_array_new_with_free_func((GDestroyNotify)found_service_free);
+    GaServiceBrowser *browser = ga_service_browser_new(type);
+    GError *error = NULL;
+    gboolean done = FALSE;
+
+    g_signal_connect(browser, "new-service", G_CALLBACK(new_service_cb), found);
+    if (!ga_service_browser_attach(browser, client, &error)) {
+        g_printerr("Browsing %s failed: %s\n", type, error->message);
+        g_error_free(error);
+    } else {
+        g_timeout_add(BROWSE_MS, timeout_cb, &done);
+        while (!done)
+            g_main_context_iteration(NULL, TRUE);
+    }
+
+    g_object_unref(browser);
+    return found;
+}
+
+static void resolver_done(guint *pending) {
+    (*pending)--;
+}
+
+/* Milliseconds @n resolvers attached at once take to all finish */
+static gdouble bench_resolvers(GPtrArray *found, guint n) {
+    GPtrArray *resolvers = g_ptr_array_new_with_free_func(g_object_unref);
+    guint pending = n;
+    gint64 start = g_get_monotonic_time();
+
+    for (guint i = 0; i < n; i++) {
+        FoundService *service = g_ptr_array_index(found, i % found->len);
+        GaServiceResolver *resolver;
+        GError *error = NULL;
+
+        resolver = ga_service_resolver_new(service->interface, GA_PROTOCOL_UNSPEC,
+                                           service->name, service->type, service->domain,
+                                           GA_PROTOCOL_UNSPEC, GA_LOOKUP_NO_FLAGS);
+        g_signal_connect_swapped(resolver, "found", G_CALLBACK(resolver_done), &pending);
+        g_signal_connect_swapped(resolver, "failure", G_CALLBACK(resolver_done), &pending);
+        if (!ga_service_resolver_attach(resolver, client, &error)) {
+            g_printerr("Attaching resolver %u failed: %s\n", i, error->message);
+            g_error_free(error);
+            pending--;
+        }
+        g_ptr_array_add(resolvers, resolver);
+    }
+
+    while (pending > 0)
+        g_main_context_iteration(NULL, TRUE);
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_ptr_array_unref(resolvers);
+    return elapsed / 1000.0;
+}
+
+static void batch_done_cb(GObject *source, GAsyncResult *result, gpointer user_data) {
+    GPtrArray **results = user_data;
+    GError *error = NULL;
+
+    *results = ga_client_resolve_services_finish(GA_CLIENT(source), result, &error);
+    if (!*results) {
+        g_printerr("Batch resolve failed: %s\n", error->message);
+        g_error_free(error);
+        *results = g_ptr_array_new();
+    }
+}
+
+/* Milliseconds a batch of @n requests takes; *@failed counts failures */
+static gdouble bench_batch(GPtrArray *found, guint n, guint *failed) {
+    GaServiceResolveRequest *requests = g_new0(GaServiceResolveRequest, n);
+    GPtrArray *results = NULL;
+    gint64 start;
+
+    for (guint i = 0; i < n; i++) {
+        FoundService *service = g_ptr_array_index(found, i % found->len);
+
+        requests[i].interface = service->interface;
+        requests[i].protocol = GA_PROTOCOL_UNSPEC;
+        requests[i].name = service->name;
+        requests[i].type = service->type;
+        requests[i].domain = service->domain;
+        requests[i].aprotocol = GA_PROTOCOL_UNSPEC;
+        requests[i].flags = GA_LOOKUP_NO_FLAGS;
+    }
+
+    start = g_get_monotonic_time();
+    ga_client_resolve_services_async(client, requests, n, 0, NULL, NULL, NULL,
+                                     batch_done_cb, &results);
+    while (!results)
+        g_main_context_iteration(NULL, TRUE);
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    *failed = 0;
+    for (guint i = 0; i < results->len; i++) {
+        GaServiceResolveResult *result = g_ptr_array_index(results, i);
+        if (result->error)
+            (*failed)++;
+        ga_service_resolve_result_free(result);
+    }
+    g_ptr_array_unref(results);
+    g_free(requests);
+
+    return elapsed / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    const gchar *type = argc > 1 ? argv[1] : DEFAULT_TYPE;
+    guint n = argc > 2 ? (guint)strtoul(argv[2], NULL, 10) : DEFAULT_N;
+    GPtrArray *found;
+    guint failed;
+    gdouble ms;
+
+    if (n == 0)
+        n = DEFAULT_N;
+
+    client = ga_client_new(GA_CLIENT_FLAG_NO_FLAGS);
+    if (!ga_client_start(client, NULL)) {
+        g_print("systemd-resolved is not running, skipping\n");
+        g_object_unref(client);
+        return EXIT_SKIP;
+    }
+
+    found = browse(type);
+    if (found->len == 0) {
+        g_print("No %s services found, skipping\n", type);
+        g_ptr_array_unref(found);
+        g_object_unref(client);
+        return EXIT_SKIP;
+    }
+    g_print("Resolving %u requests over %u %s services\n", n, found->len, type);
+
+    /* Warm resolved's cache */
+    bench_batch(found, found->len, &failed);
+
+    ms = bench_resolvers(found, n);
+    g_print("%-10s %9.1f ms (%.3f ms/service)\n", "resolvers", ms, ms / n);
+
+    ms = bench_batch(found, n, &failed);
+    g_print("%-10s %9.1f ms (%.3f ms/service, %u failed)\n", "batch", ms, ms / n, failed);
+
+    g_ptr_array_unref(found);
+    g_object_unref(client);
+
+    return EXIT_SUCCESS;
+}
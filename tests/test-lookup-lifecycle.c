@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/*
+ * test-lookup-lifecycle.c - Create, attach and abandon lookups in a loop
+ *
+ * Service resolvers and record browsers are cancelled, dropped while
+ * their call is queued or in flight, or left to run into their deadline,
+ * thousands of times over. Every way out must give the client's request
+ * slot back; leaks and use-after-free on these paths show up when the
+ * test runs under valgrind (meson test --setup valgrind, which runs 1000
+ * of each) or is built with -Db_sanitize=address. Skipped when
+ * systemd-resolved is not running.
+ *
+ * Usage: test-lookup-lifecycle [ITERATIONS]
+ */
+
+#include <stdlib.h>
+#include <gio/gio.h>
+
+#include "ga-client.h"
+#include "ga-record-browser.h"
+#include "ga-service-resolver.h"
+
+/* Lookups of each kind, unless given as the first argument or in
+ * LIFECYCLE_ITERATIONS */
+#define DEFAULT_ITERATIONS 5000
+
+static guint iterations = DEFAULT_ITERATIONS;
+
+/* Longest wait for a lookup to run into its deadline */
+#define DEADLINE_GUARD_MS 5000
+
+typedef enum {
+    END_CANCEL,         /* Cancelled right after attaching */
+    END_DROP,           /* Unreferenced with the call still queued */
+    END_DROP_IN_FLIGHT, /* Unreferenced once the call went out */
+    END_DEADLINE,       /* Left to run into a 1 ms timeout-ms */
+    N_ENDS
+} LookupEnd;
+
+static GaClient *client = NULL;
+
+static void drain(void) {
+    while (g_main_context_iteration(NULL, FALSE))
+        ;
+}
+
+static void lookup_done(gboolean *done) {
+    *done = TRUE;
+}
+
+static gboolean guard_cb(gpointer user_data) {
+    *(gboolean *)user_data = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+static void wait_done(const gboolean *done) {
+    gboolean timed_out = FALSE;
+    guint guard = g_timeout_add(DEADLINE_GUARD_MS, guard_cb, &timed_out);
+
+    while (!*done && !timed_out)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_assert_false(timed_out);
+    g_source_remove(guard);
+}
+
+static void assert_client_idle(void) {
+    GaClientStatistics stats;
+
+    ga_client_get_statistics(client, &stats);
+    g_assert_cmpuint(stats.requests_in_flight, ==, 0);
+    g_assert_cmpuint(stats.requests_queued, ==, 0);
+}
+
+/* End @lookup the way @end says, then drop it */
+static void lookup_end(GObject *lookup, GCancellable *cancellable,
+                       LookupEnd end, const gboolean *done) {
+    switch (end) {
+        case END_CANCEL:
+            g_cancellable_cancel(cancellable);
+            drain();
+            break;
+        case END_DROP:
+            break;
+        case END_DROP_IN_FLIGHT:
+            drain();
+            break;
+        case END_DEADLINE:
+            wait_done(done);
+            break;
+        default:
+            g_assert_not_reached();
+    }
+
+    g_object_unref(lookup);
+    drain();
+    assert_client_idle();
+}
+
+static void test_service_resolver(void) {
+    if (!client) {
+        g_test_skip("systemd-resolved is not running");
+        return;
+    }
+
+    for (guint i = 0; i < iterations; i++) {
+        LookupEnd end = i % N_ENDS;
+        GCancellable *cancellable = g_cancellable_new();
+        gchar *name = g_strdup_printf("lifecycle-%u", i);
+        GaServiceResolver *resolver;
+        GError *error = NULL;
+        gboolean done = FALSE;
+
+        resolver = ga_service_resolver_new(GA_IF_UNSPEC, GA_PROTOCOL_UNSPEC,
+                                           name, "_http._tcp", "local",
+                                           GA_PROTOCOL_UNSPEC, GA_LOOKUP_NO_FLAGS);
+        g_object_set(resolver,
+                     "cancellable", cancellable,
+                     "timeout-ms", end == END_DEADLINE ? 1 : 0,
+                     "parallel-families", (i / N_ENDS) % 2 == 1,
+                     NULL);
+        g_signal_connect_swapped(resolver, "found", G_CALLBACK(lookup_done), &done);
+        g_signal_connect_swapped(resolver, "failure", G_CALLBACK(lookup_done), &done);
+
+        if (!ga_service_resolver_attach(resolver, client, &error))
+            g_error("Attaching resolver %u failed: %s", i, error->message);
+
+        lookup_end(G_OBJECT(resolver), cancellable, end, &done);
+
+        g_object_unref(cancellable);
+        g_free(name);
+    }
+}
+
+static void test_record_browser(void) {
+    if (!client) {
+        g_test_skip("systemd-resolved is not running");
+        return;
+    }
+
+    for (guint i = 0; i < iterations; i++) {
+        LookupEnd end = i % N_ENDS;
+        GCancellable *cancellable = g_cancellable_new();
+        gchar *name = g_strdup_printf("lifecycle-%u.local", i);
+        GaRecordBrowser *browser;
+        GError *error = NULL;
+        gboolean done = FALSE;
+
+        browser = ga_record_browser_new_full(GA_IF_UNSPEC, GA_PROTOCOL_UNSPEC, name,
+                                             GA_DNS_CLASS_IN, GA_DNS_TYPE_A,
+                                             GA_LOOKUP_NO_FLAGS);
+        g_object_set(browser,
+                     "cancellable", cancellable,
+                     "timeout-ms", end == END_DEADLINE ? 1 : 0,
+                     "continuous", (i / N_ENDS) % 2 == 1,
+                     NULL);
+        g_signal_connect_swapped(browser, "all-for-now", G_CALLBACK(lookup_done), &done);
+        g_signal_connect_swapped(browser, "failure", G_CALLBACK(lookup_done), &done);
+
+        if (!ga_record_browser_attach(browser, client, &error))
+            g_error("Attaching record browser %u failed: %s", i, error->message);
+
+        lookup_end(G_OBJECT(browser), cancellable, end, &done);
+
+        g_object_unref(cancellable);
+        g_free(name);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    if (argc > 1)
+        iterations = (guint)strtoul(argv[1], NULL, 10);
+    else if (g_getenv("LIFECYCLE_ITERATIONS"))
+        iterations = (guint)strtoul(g_getenv("LIFECYCLE_ITERATIONS"), NULL, 10);
+    if (iterations == 0)
+        iterations = DEFAULT_ITERATIONS;
+
+    client = ga_client_new(GA_CLIENT_FLAG_NO_FLAGS);
+    if (!ga_client_start(client, NULL))
+        g_clear_object(&client);
+
+    g_test_add_func("/lifecycle/service-resolver", test_service_resolver);
+    g_test_add_func("/lifecycle/record-browser", test_record_browser);
+
+    ret = g_test_run();
+
+    if (client)
+        g_object_unref(client);
+
+    return ret;
+}